@@ -0,0 +1,107 @@
+/*
+ * This example shows how to log CSV data to an SD Card through the compression stage, and compares
+ * the time and space needed with the same data written without compression.
+ */
+
+#include "Arduino_POSIXStorage.h"
+
+constexpr int numberOfLines = 2000;
+
+// Fills buffer with one line of simulated sensor data and returns its length
+int makeLine(char * const buffer, const size_t bufferSize, const int lineNumber)
+{
+  return snprintf(buffer, bufferSize, "%d,%lu,%d.%02d,%d\n", lineNumber, 1000UL * lineNumber,
+                  21 + (lineNumber % 3), lineNumber % 100, 1013 - (lineNumber % 7));
+}
+
+long fileSize(const char * const pathname)
+{
+  struct stat sb;
+  if (0 != stat(pathname, &sb))
+  {
+    return -1;
+  }
+  return static_cast<long>(sb.st_size);
+}
+
+void setup() {
+  Serial.begin(9600);
+  while (!Serial) ;
+
+  if (0 != mount(DEV_SDCARD, FS_FAT, MNT_DEFAULT))
+  {
+    Serial.println("Error mounting SD Card");
+    Serial.println(errno);
+    return;
+  }
+
+  char line[64];
+
+  // Uncompressed reference -->
+  unsigned long start = micros();
+  FILE *fp = fopen("/sdcard/log.csv", "w");
+  if (nullptr == fp)
+  {
+    Serial.println("Error opening uncompressed file for writing");
+    Serial.println(errno);
+    umount(DEV_SDCARD);
+    return;
+  }
+  for (int i = 0; i < numberOfLines; i++)
+  {
+    const int length = makeLine(line, sizeof(line), i);
+    fwrite(line, 1, length, fp);
+  }
+  fclose(fp);
+  const unsigned long plainTime = micros() - start;
+  // <-- Uncompressed reference
+
+  // Compressed -->
+  start = micros();
+  struct CompressedFile *cfp = compressed_fopen("/sdcard/log.csv.psz", "w");
+  if (nullptr == cfp)
+  {
+    Serial.println("Error opening compressed file for writing");
+    Serial.println(errno);
+    umount(DEV_SDCARD);
+    return;
+  }
+  for (int i = 0; i < numberOfLines; i++)
+  {
+    const int length = makeLine(line, sizeof(line), i);
+    compressed_fwrite(line, 1, length, cfp);
+  }
+  compressed_fclose(cfp);
+  const unsigned long compressedTime = micros() - start;
+  // <-- Compressed
+
+  Serial.print("Uncompressed: ");
+  Serial.print(fileSize("/sdcard/log.csv"));
+  Serial.print(" bytes in ");
+  Serial.print(plainTime);
+  Serial.println(" us");
+  Serial.print("Compressed:   ");
+  Serial.print(fileSize("/sdcard/log.csv.psz"));
+  Serial.print(" bytes in ");
+  Serial.print(compressedTime);
+  Serial.println(" us");
+
+  // Read back the first line of the compressed file
+  cfp = compressed_fopen("/sdcard/log.csv.psz", "r");
+  if (nullptr != cfp)
+  {
+    const int length = makeLine(line, sizeof(line), 0);
+    char readBack[64] = {0};
+    if (static_cast<size_t>(length) == compressed_fread(readBack, 1, length, cfp))
+    {
+      Serial.print("First line: ");
+      Serial.print(readBack);
+    }
+    compressed_fclose(cfp);
+  }
+
+  umount(DEV_SDCARD);
+}
+
+void loop() {
+}
@@ -0,0 +1,466 @@
+/*
+ *
+ * Arduino_POSIXStorage Stress Tests
+ *
+ * Drives mount/write/unmount loops against a device with injected latency, errors, and removal,
+ * and reports throughput and how long it takes to get a working file system back afterwards.
+ * The device must be formatted with FAT, and the tests leave only their own files behind.
+ * Fault injection is left out of the library by default, so build with POSIX_STORAGE_FAULT_INJECTION
+ * defined, for both the library and the sketch. Define FSCK_BITMAP_SIZE as 64 there as well, so that
+ * fsck() checks even a small volume in several windows of 512 clusters, the way it checks a large one.
+ *
+ * This code is in the public domain
+ *
+ */
+
+#include "Arduino_POSIXStorage.h"
+
+#if defined(POSIX_STORAGE_NO_FAULT_INJECTION)
+  #error "These tests need fault injection, define POSIX_STORAGE_FAULT_INJECTION in the build flags"
+#endif
+
+enum TestTypes : uint8_t
+{
+  TEST_PORTENTA_C33_SDCARD,
+  TEST_PORTENTA_C33_USB,
+  TEST_PORTENTA_H7_SDCARD,
+  TEST_PORTENTA_H7_USB,
+  TEST_PORTENTA_MACHINE_CONTROL_USB
+};
+
+// !!! TEST CONFIGURATION !!! -->
+
+constexpr enum TestTypes selectedTest = TEST_PORTENTA_C33_SDCARD;
+
+// Kilobytes written by every throughput run
+constexpr size_t testFileKilobytes = 256;
+
+// Number of simulated removals, each one at a different point of mount, write, and unmount
+constexpr int removalRuns = 20;
+
+// Uncomment the line below to also pull out and plug in a thumb drive by hand, a few times:
+
+//#define PERFORM_PHYSICAL_UNPLUG_TESTS
+
+// <-- !!! TEST CONFIGURATION !!!
+
+volatile bool usbAttached = false;
+volatile bool usbDetached = false;
+
+void usbCallback()
+{
+  usbAttached = true;
+}
+
+void usbCallback2()
+{
+  usbDetached = true;
+}
+
+// Writes a file of numbered 1 KB blocks and returns the elapsed time in *elapsedMicroseconds, or
+// false as soon as anything fails
+bool writeTestFile(const char *path, const size_t kilobytes, uint32_t *elapsedMicroseconds)
+{
+  static char block[1024];
+  const uint32_t startMicroseconds = micros();
+  FILE *fp = fopen(path, "w");
+  if (nullptr == fp)
+  {
+    return false;
+  }
+  bool writeOk = true;
+  for (size_t i=0; i<kilobytes; i++)
+  {
+    memset(block, 'A' + (i % 26), sizeof(block));
+    (void) snprintf(block, sizeof(block), "%08u", static_cast<unsigned int>(i));
+    if (1 != fwrite(block, sizeof(block), 1, fp))
+    {
+      writeOk = false;
+      break;
+    }
+  }
+  if (0 != fclose(fp))
+  {
+    writeOk = false;
+  }
+  *elapsedMicroseconds = micros() - startMicroseconds;
+  return writeOk;
+}
+
+bool verifyTestFile(const char *path, const size_t kilobytes)
+{
+  static char block[1024];
+  static char expected[1024];
+  FILE *fp = fopen(path, "r");
+  if (nullptr == fp)
+  {
+    return false;
+  }
+  bool verifyOk = true;
+  for (size_t i=0; i<kilobytes; i++)
+  {
+    memset(expected, 'A' + (i % 26), sizeof(expected));
+    (void) snprintf(expected, sizeof(expected), "%08u", static_cast<unsigned int>(i));
+    if ((1 != fread(block, sizeof(block), 1, fp)) || (0 != memcmp(block, expected, sizeof(block))))
+    {
+      verifyOk = false;
+      break;
+    }
+  }
+  (void) fclose(fp);
+  return verifyOk;
+}
+
+// umount() can fail once after a device error, when buffered sectors can't be written
+bool umountWithRetries(const enum StorageDevices deviceName)
+{
+  for (int i=0; i<3; i++)
+  {
+    if (0 == umount(deviceName))
+    {
+      return true;
+    }
+    if (EINVAL == errno)    // Not mounted at all
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Stops the fault injection, like plugging in a good device again, then checks the volume and
+// mounts it. Returns the time that took in *recoveryMilliseconds, or false if it didn't work.
+bool recover(const enum StorageDevices deviceName, uint32_t *recoveryMilliseconds)
+{
+  const uint32_t startMilliseconds = millis();
+  if (0 != set_fault_injection(deviceName, nullptr))
+  {
+    return false;
+  }
+  int retVal = -1;
+  do
+  {
+    retVal = fsck(deviceName, FSCK_AUTO, 50000);
+  } while ((-1 == retVal) && (EINPROGRESS == errno));
+  if (0 != retVal)
+  {
+    return false;
+  }
+  if (0 != mount(deviceName, FS_FAT, MNT_DEFAULT))
+  {
+    return false;
+  }
+  *recoveryMilliseconds = millis() - startMilliseconds;
+  return true;
+}
+
+// Checks the unmounted volume once more after a recovery. Anything found means that the repair
+// left problems behind, for example clusters cut loose in a window that was checked already.
+bool isConsistent(const enum StorageDevices deviceName)
+{
+  int retVal = -1;
+  do
+  {
+    retVal = fsck(deviceName, FSCK_FORCE, 50000);
+  } while ((-1 == retVal) && (EINPROGRESS == errno));
+  struct FsckReport report = {};
+  if ((0 != retVal) || (0 != fsck_report(deviceName, &report)))
+  {
+    return false;
+  }
+  return (0 == (report.lostClusters + report.crossLinks + report.brokenChains + report.badEntries));
+}
+
+void printThroughput(const char *label, const uint32_t elapsedMicroseconds)
+{
+  Serial.print(label);
+  Serial.print(": ");
+  Serial.print((testFileKilobytes * 1000000.0) / ((0 != elapsedMicroseconds) ? elapsedMicroseconds : 1));
+  Serial.println(" KB/s");
+}
+
+void printStatistics(const enum StorageDevices deviceName)
+{
+  struct FaultInjectionStatistics statistics;
+  if (0 != fault_injection_statistics(deviceName, &statistics))
+  {
+    return;
+  }
+  Serial.print("  operations: ");
+  Serial.print(statistics.operations);
+  Serial.print(", stalls: ");
+  Serial.print(statistics.stalls);
+  Serial.print(", transient errors: ");
+  Serial.print(statistics.transientErrors);
+  Serial.print(", removed errors: ");
+  Serial.print(statistics.removedErrors);
+  Serial.print(", injected delay: ");
+  Serial.print(static_cast<uint32_t>(statistics.delayedMicroseconds / 1000));
+  Serial.println(" ms");
+}
+
+void setup() {
+  bool allTestsOk = true;
+  enum StorageDevices deviceName;
+  const char *testPath = nullptr;
+  uint32_t elapsedMicroseconds = 0;
+  int retVal = -1;
+
+  if ((TEST_PORTENTA_C33_USB == selectedTest) || (TEST_PORTENTA_H7_USB == selectedTest) || (TEST_PORTENTA_MACHINE_CONTROL_USB == selectedTest))
+  {
+    deviceName = DEV_USB;
+    testPath = "/usb/stress.bin";
+  }
+  else if ((TEST_PORTENTA_C33_SDCARD == selectedTest) || (TEST_PORTENTA_H7_SDCARD == selectedTest))
+  {
+    deviceName = DEV_SDCARD;
+    testPath = "/sdcard/stress.bin";
+  }
+  else
+  {
+    for ( ; ; ) ;   // Shouldn't get here unless there's a bug in the test code
+  }
+
+  Serial.begin(9600);
+  while (!Serial) ; // Wait for the serial port to be ready
+
+  Serial.println("Stress testing started, please wait...");
+  Serial.println();
+
+  // Fault injection when mounted test -->
+  (void) mount(deviceName, FS_FAT, MNT_DEFAULT);
+  retVal = set_fault_injection(deviceName, nullptr);
+  if ((-1 != retVal) || (EBUSY != errno))
+  {
+    allTestsOk = false;
+    Serial.println("[FAIL] Fault injection when mounted test failed");
+  }
+  (void) umount(deviceName);
+  // <-- Fault injection when mounted test
+
+  // Baseline throughput test -->
+  uint32_t baselineMicroseconds = 0;
+  if ((0 != mount(deviceName, FS_FAT, MNT_DEFAULT)) ||
+      (false == writeTestFile(testPath, testFileKilobytes, &baselineMicroseconds)) ||
+      (false == verifyTestFile(testPath, testFileKilobytes)) ||
+      (0 != umount(deviceName)))
+  {
+    allTestsOk = false;
+    Serial.println("[FAIL] Baseline throughput test failed");
+  }
+  else
+  {
+    printThroughput("Baseline write throughput", baselineMicroseconds);
+  }
+  // <-- Baseline throughput test
+
+  // Slow media test -->
+  struct FaultInjectionSettings slowSettings = {};
+  slowSettings.latencyMicroseconds = 300;
+  slowSettings.latencyJitterMicroseconds = 700;
+  slowSettings.stallPermille = 5;
+  slowSettings.stallMicroseconds = 100000;
+  slowSettings.seed = 1;
+  (void) set_fault_injection(deviceName, &slowSettings);
+  if ((0 != mount(deviceName, FS_FAT, MNT_DEFAULT)) ||
+      (false == writeTestFile(testPath, testFileKilobytes, &elapsedMicroseconds)) ||
+      (false == verifyTestFile(testPath, testFileKilobytes)) ||
+      (0 != umount(deviceName)))
+  {
+    allTestsOk = false;
+    Serial.println("[FAIL] Slow media test failed");
+  }
+  else
+  {
+    printThroughput("Slow media write throughput", elapsedMicroseconds);
+  }
+  printStatistics(deviceName);
+  (void) set_fault_injection(deviceName, nullptr);
+  // <-- Slow media test
+
+  // Transient errors test -->
+  struct FaultInjectionSettings errorSettings = {};
+  errorSettings.readErrorPermille = 5;
+  errorSettings.programErrorPermille = 5;
+  errorSettings.seed = 2;
+  (void) set_fault_injection(deviceName, &errorSettings);
+  int failedMounts = 0;
+  int failedWrites = 0;
+  int failedUnmounts = 0;
+  for (int i=0; i<10; i++)
+  {
+    if (0 != mount(deviceName, FS_FAT, MNT_DEFAULT))
+    {
+      failedMounts++;
+      continue;
+    }
+    if (false == writeTestFile(testPath, testFileKilobytes, &elapsedMicroseconds))
+    {
+      failedWrites++;
+    }
+    if (false == umountWithRetries(deviceName))
+    {
+      failedUnmounts++;
+      break;    // Still mounted, so the fault injection can't be stopped
+    }
+  }
+  Serial.print("Transient errors: ");
+  Serial.print(failedMounts);
+  Serial.print(" failed mounts, ");
+  Serial.print(failedWrites);
+  Serial.println(" failed writes");
+  printStatistics(deviceName);
+  uint32_t recoveryMilliseconds = 0;
+  if ((0 != failedUnmounts) || (false == recover(deviceName, &recoveryMilliseconds)) ||
+      (false == writeTestFile(testPath, testFileKilobytes, &elapsedMicroseconds)) ||
+      (false == verifyTestFile(testPath, testFileKilobytes)) ||
+      (0 != umount(deviceName)))
+  {
+    allTestsOk = false;
+    Serial.println("[FAIL] Transient errors test failed");
+  }
+  else
+  {
+    Serial.print("  recovered in ");
+    Serial.print(recoveryMilliseconds);
+    Serial.println(" ms");
+  }
+  // <-- Transient errors test
+
+  // Simulated removal test -->
+  // Every run removes the device a little later, so that removals hit the mount, the FAT and
+  // directory updates, the data, and the final flush
+  uint32_t maxRecoveryMilliseconds = 0;
+  uint32_t totalRecoveryMilliseconds = 0;
+  int recoveries = 0;
+  for (int i=0; i<removalRuns; i++)
+  {
+    struct FaultInjectionSettings removalSettings = {};
+    removalSettings.removeAfterOperations = 10 + (i * 97);
+    removalSettings.seed = 3;
+    (void) set_fault_injection(deviceName, &removalSettings);
+    if (0 == mount(deviceName, FS_FAT, MNT_DEFAULT))
+    {
+      (void) writeTestFile(testPath, testFileKilobytes, &elapsedMicroseconds);
+      if (false == umountWithRetries(deviceName))
+      {
+        allTestsOk = false;
+        Serial.print("[FAIL] Unmount after simulated removal test failed after ");
+        Serial.print(removalSettings.removeAfterOperations);
+        Serial.println(" operations");
+        break;    // Still mounted, so the fault injection can't be stopped
+      }
+    }
+    if (false == recover(deviceName, &recoveryMilliseconds))
+    {
+      allTestsOk = false;
+      Serial.print("[FAIL] Recovery after simulated removal test failed after ");
+      Serial.print(removalSettings.removeAfterOperations);
+      Serial.println(" operations");
+      (void) umount(deviceName);
+      continue;
+    }
+    // The volume must be usable again, whatever happened to the file that was being written
+    if ((false == writeTestFile(testPath, 4, &elapsedMicroseconds)) || (false == verifyTestFile(testPath, 4)))
+    {
+      allTestsOk = false;
+      Serial.print("[FAIL] Writing after simulated removal test failed after ");
+      Serial.print(removalSettings.removeAfterOperations);
+      Serial.println(" operations");
+    }
+    (void) umount(deviceName);
+    if (false == isConsistent(deviceName))
+    {
+      allTestsOk = false;
+      Serial.print("[FAIL] Check after simulated removal test found problems after ");
+      Serial.print(removalSettings.removeAfterOperations);
+      Serial.println(" operations");
+    }
+    recoveries++;
+    totalRecoveryMilliseconds += recoveryMilliseconds;
+    if (recoveryMilliseconds > maxRecoveryMilliseconds)
+    {
+      maxRecoveryMilliseconds = recoveryMilliseconds;
+    }
+  }
+  if (0 != recoveries)
+  {
+    Serial.print("Simulated removals: ");
+    Serial.print(recoveries);
+    Serial.print(" recoveries, average ");
+    Serial.print(totalRecoveryMilliseconds / recoveries);
+    Serial.print(" ms, longest ");
+    Serial.print(maxRecoveryMilliseconds);
+    Serial.println(" ms");
+  }
+  // <-- Simulated removal test
+
+#if defined(PERFORM_PHYSICAL_UNPLUG_TESTS)
+  // Physical unplug test -->
+  if (DEV_USB == deviceName)
+  {
+    (void) register_unplug_callback(DEV_USB, usbCallback2);
+    (void) register_hotplug_callback(DEV_USB, usbCallback);
+    for (int i=0; i<3; i++)
+    {
+      Serial.println();
+      Serial.println("Please remove the thumb drive while the test writes to it");
+      usbDetached = false;
+      if (0 == mount(deviceName, FS_FAT, MNT_DEFAULT))
+      {
+        while (true == writeTestFile(testPath, testFileKilobytes, &elapsedMicroseconds))
+        {
+        }
+        if (false == umountWithRetries(deviceName))
+        {
+          allTestsOk = false;
+          Serial.println("[FAIL] Unmount after physical unplug test failed");
+          break;
+        }
+      }
+      while (false == usbDetached)
+      {
+        delay(100);
+      }
+      Serial.println("Please insert the thumb drive again");
+      usbAttached = false;
+      while (false == usbAttached)
+      {
+        delay(100);
+      }
+      if (false == recover(deviceName, &recoveryMilliseconds))
+      {
+        allTestsOk = false;
+        Serial.println("[FAIL] Recovery after physical unplug test failed");
+        continue;
+      }
+      Serial.print("  recovered in ");
+      Serial.print(recoveryMilliseconds);
+      Serial.println(" ms");
+      (void) umount(deviceName);
+    }
+  }
+  // <-- Physical unplug test
+#endif
+
+  (void) mount(deviceName, FS_FAT, MNT_DEFAULT);
+  (void) remove(testPath);
+  (void) umount(deviceName);
+
+  // Final report -->
+  Serial.println();
+  Serial.println("Stress testing complete.");
+  Serial.println();
+  if (true == allTestsOk)
+  {
+    Serial.println("SUCCESS: Finished without errors");
+  }
+  else
+  {
+    Serial.println("FAILURE: Finished with errors (see list above for details)");
+  }
+  // <-- Final report
+}
+
+void loop() {
+}
@@ -206,6 +206,34 @@ void setup() {
   }
   // <-- LITTLEFS formatting test
 
+  // LITTLEFS formatting with geometry test -->
+  {   // Curly braces necessary to keep new variables inside the test
+    const struct LittleFSGeometry geometry = {0, 1024, 4096, 0};
+    const struct LittleFSGeometry invalidGeometry = {0, 0, 0, 33};
+    retVal = mkfs(deviceName, FS_LITTLEFS, &invalidGeometry);
+    if ((-1 != retVal) || (EINVAL != errno))
+    {
+      allTestsOk = false;
+      Serial.println("[FAIL] mkfs() with invalid LITTLEFS geometry did not fail with EINVAL");
+    }
+    if (0 != mkfs(deviceName, FS_LITTLEFS, &geometry))
+    {
+      allTestsOk = false;
+      Serial.println("[FAIL] mkfs() with LITTLEFS geometry failed");
+    }
+    if (0 != mount(deviceName, FS_LITTLEFS, MNT_DEFAULT, &geometry))
+    {
+      allTestsOk = false;
+      Serial.println("[FAIL] mount() after mkfs() with LITTLEFS geometry failed");
+    }
+    if (0 != umount(deviceName))
+    {
+      allTestsOk = false;
+      Serial.println("[FAIL] umount() after mkfs() with LITTLEFS geometry failed");
+    }
+  }
+  // <-- LITTLEFS formatting with geometry test
+
   // FAT formatting test -->
   if (0 != mkfs(deviceName, FS_FAT))
   {
@@ -313,6 +341,18 @@ void setup() {
   }
   // <-- Mount read only not supported test
 
+  // Geometry with FAT not supported test -->
+  {   // Curly braces necessary to keep new variables inside the test
+    const struct LittleFSGeometry geometry = {0, 0, 0, 0};
+    retVal = mount(deviceName, FS_FAT, MNT_DEFAULT, &geometry);
+    if ((-1 != retVal) || (EINVAL != errno))
+    {
+      allTestsOk = false;
+      Serial.println("[FAIL] Geometry with FAT not supported test failed");
+    }
+  }
+  // <-- Geometry with FAT not supported test
+
   // umount() when not mounted test -->
   retVal = umount(deviceName);
   if ((-1 != retVal) || (EINVAL != errno))
@@ -463,6 +503,645 @@ void setup() {
   (void) umount(deviceName);
   // <-- Persistent storage test
 
+  // Compression stage test -->
+  (void) mount(deviceName, FS_FAT, MNT_DEFAULT);
+  const char *compressedPath = nullptr;
+  if (DEV_USB == deviceName)
+  {
+    compressedPath = "/usb/5395748341.psz";
+  }
+  else if (DEV_SDCARD == deviceName)
+  {
+    compressedPath = "/sdcard/5395748341.psz";
+  }
+  else
+  {
+    for ( ; ;) ;  // Shouldn't get here unless there's a bug in the test code
+  }
+  bool compressionTestFailed = false;
+  struct CompressedFile *cfp = compressed_fopen(compressedPath, "w");
+  if (nullptr == cfp)
+  {
+    compressionTestFailed = true;
+  }
+  else
+  {
+    // More than one frame of compressible data, written in odd-sized pieces
+    for (int i=0; i<1000; i++)
+    {
+      if (11 != compressed_fwrite("Test string", 1, 11, cfp))
+      {
+        compressionTestFailed = true;
+      }
+    }
+    if (0 != compressed_ferror(cfp))
+    {
+      compressionTestFailed = true;
+    }
+    if (0 != compressed_fclose(cfp))
+    {
+      compressionTestFailed = true;
+    }
+  }
+  cfp = compressed_fopen(compressedPath, "r");
+  if (nullptr == cfp)
+  {
+    compressionTestFailed = true;
+  }
+  else
+  {
+    char readBack[11];
+    for (int i=0; i<1000; i++)
+    {
+      if ((11 != compressed_fread(readBack, 1, 11, cfp)) || (0 != memcmp(readBack, "Test string", 11)))
+      {
+        compressionTestFailed = true;
+        break;
+      }
+    }
+    // Nothing but the end of the file should remain
+    if (0 != compressed_fread(readBack, 1, 1, cfp))
+    {
+      compressionTestFailed = true;
+    }
+    (void) compressed_fclose(cfp);
+  }
+  retVal = stat(compressedPath, &sb);
+  if ((0 != retVal) || (sb.st_size >= 11000))
+  {
+    compressionTestFailed = true;
+  }
+  (void) remove(compressedPath);
+  if (true == compressionTestFailed)
+  {
+    allTestsOk = false;
+    Serial.println("[FAIL] Compression stage test failed");
+  }
+  (void) umount(deviceName);
+  // <-- Compression stage test
+
+  // Directory cache test -->
+  bool directoryCacheTestFailed = false;
+  const char *cachedPath = nullptr;
+  const char *renamedPath = nullptr;
+  if (DEV_USB == deviceName)
+  {
+    cachedPath = "/usb/5395748341.txt";
+    renamedPath = "/usb/5395748342.txt";
+  }
+  else if (DEV_SDCARD == deviceName)
+  {
+    cachedPath = "/sdcard/5395748341.txt";
+    renamedPath = "/sdcard/5395748342.txt";
+  }
+  else
+  {
+    for ( ; ;) ;  // Shouldn't get here unless there's a bug in the test code
+  }
+  if (0 != set_directory_cache_size(deviceName, 64))
+  {
+    directoryCacheTestFailed = true;
+  }
+  (void) mount(deviceName, FS_FAT, MNT_DEFAULT);
+  retVal = set_directory_cache_size(deviceName, 32);
+  if ((-1 != retVal) || (EBUSY != errno))
+  {
+    directoryCacheTestFailed = true;
+  }
+  // Twice, so that the second lookup is answered by the cache
+  for (int i=0; i<2; i++)
+  {
+    if ((-1 != stat(cachedPath, &sb)) || (ENOENT != errno))
+    {
+      directoryCacheTestFailed = true;
+    }
+  }
+  fp = fopen(cachedPath, "w");
+  if (nullptr != fp)
+  {
+    (void) fprintf(fp, "Test string");
+    (void) fclose(fp);
+  }
+  for (int i=0; i<2; i++)
+  {
+    if ((0 != stat(cachedPath, &sb)) || (static_cast<off_t>(strlen("Test string")) != sb.st_size))
+    {
+      directoryCacheTestFailed = true;
+    }
+  }
+  if ((0 != rename(cachedPath, renamedPath)) || (-1 != stat(cachedPath, &sb)) || (0 != stat(renamedPath, &sb)))
+  {
+    directoryCacheTestFailed = true;
+  }
+  if ((0 != remove(renamedPath)) || (-1 != stat(renamedPath, &sb)) || (ENOENT != errno))
+  {
+    directoryCacheTestFailed = true;
+  }
+  (void) umount(deviceName);
+  (void) set_directory_cache_size(deviceName, 0);
+  if (true == directoryCacheTestFailed)
+  {
+    allTestsOk = false;
+    Serial.println("[FAIL] Directory cache test failed");
+  }
+  // <-- Directory cache test
+
+  // Trim test -->
+  retVal = storage_trim(deviceName, 0);
+  if ((-1 != retVal) || (EINVAL != errno))
+  {
+    allTestsOk = false;
+    Serial.println("[FAIL] Trim when not mounted test failed");
+  }
+  (void) mount(deviceName, FS_FAT, MNT_DEFAULT);
+  if (DEV_SDCARD == deviceName)
+  {
+    // Free some clusters so that there is something to trim
+    fp = fopen("/sdcard/5395748341.txt", "w");
+    if (nullptr != fp)
+    {
+      for (int i=0; i<1000; i++)
+      {
+        (void) fprintf(fp, "Test string");
+      }
+      (void) fclose(fp);
+    }
+    (void) remove("/sdcard/5395748341.txt");
+    if ((0 != storage_trim(deviceName, 512)) || (0 != storage_trim(deviceName, 0)))
+    {
+      allTestsOk = false;
+      Serial.println("[FAIL] Trim test failed");
+    }
+  }
+  else
+  {
+    retVal = storage_trim(deviceName, 0);
+    if ((-1 != retVal) || (ENOTSUP != errno))
+    {
+      allTestsOk = false;
+      Serial.println("[FAIL] Trim not supported test failed");
+    }
+  }
+  (void) umount(deviceName);
+  // <-- Trim test
+
+  // Write queue test -->
+  bool writeQueueTestFailed = false;
+  const char *queuedPath = nullptr;
+  if (DEV_USB == deviceName)
+  {
+    queuedPath = "/usb/5395748341.txt";
+  }
+  else if (DEV_SDCARD == deviceName)
+  {
+    queuedPath = "/sdcard/5395748341.txt";
+  }
+  else
+  {
+    for ( ; ;) ;  // Shouldn't get here unless there's a bug in the test code
+  }
+  struct WriteQueueSettings queueSettings;
+  queueSettings.bufferSize = 1024;
+  queueSettings.deadlineMicroseconds = 0;
+  queueSettings.fullPolicy = QUEUE_BLOCK;
+  queueSettings.blockTimeoutMicroseconds = 1000000;
+  retVal = write_queue_start(deviceName, &queueSettings);
+  if ((-1 != retVal) || (EINVAL != errno))
+  {
+    allTestsOk = false;
+    Serial.println("[FAIL] Write queue when not mounted test failed");
+  }
+  (void) mount(deviceName, FS_FAT, MNT_DEFAULT);
+  if (0 != write_queue_start(deviceName, &queueSettings))
+  {
+    writeQueueTestFailed = true;
+  }
+  fp = fopen(queuedPath, "w");
+  if (nullptr == fp)
+  {
+    writeQueueTestFailed = true;
+  }
+  else
+  {
+    // 200 writes of 23 bytes each don't fit in the queue at once, so this also waits for room
+    for (int i=0; i<200; i++)
+    {
+      if (11 != queued_write(deviceName, fileno(fp), "Test string", 11))
+      {
+        writeQueueTestFailed = true;
+      }
+    }
+    retVal = queued_write(deviceName, fileno(fp), "Test string", 2048);
+    if ((-1 != retVal) || (EMSGSIZE != errno))
+    {
+      writeQueueTestFailed = true;
+    }
+    if (0 != write_queue_service(deviceName, 0))
+    {
+      writeQueueTestFailed = true;
+    }
+    struct WriteQueueStatistics queueStatistics;
+    if ((0 != write_queue_statistics(deviceName, &queueStatistics)) ||
+        (200 != queueStatistics.queuedWrites) || (200 != queueStatistics.completedWrites) ||
+        (0 != queueStatistics.failedWrites) || (0 != queueStatistics.queuedBytes))
+    {
+      writeQueueTestFailed = true;
+    }
+    (void) fclose(fp);
+  }
+  if (0 != write_queue_stop(deviceName))
+  {
+    writeQueueTestFailed = true;
+  }
+  struct stat queuedStat;
+  if ((0 != stat(queuedPath, &queuedStat)) || ((200 * 11) != queuedStat.st_size))
+  {
+    writeQueueTestFailed = true;
+  }
+  (void) remove(queuedPath);
+  (void) umount(deviceName);
+  if (true == writeQueueTestFailed)
+  {
+    allTestsOk = false;
+    Serial.println("[FAIL] Write queue test failed");
+  }
+  // <-- Write queue test
+
+  // Transfer coalescing test -->
+  bool coalescingTestFailed = false;
+  const char *coalescedPath = nullptr;
+  if (DEV_USB == deviceName)
+  {
+    coalescedPath = "/usb/5395748341.txt";
+  }
+  else if (DEV_SDCARD == deviceName)
+  {
+    coalescedPath = "/sdcard/5395748341.txt";
+  }
+  else
+  {
+    for ( ; ;) ;  // Shouldn't get here unless there's a bug in the test code
+  }
+  retVal = set_transfer_coalescing(deviceName, 4096, 0);
+  if ((-1 != retVal) || (EINVAL != errno))
+  {
+    allTestsOk = false;
+    Serial.println("[FAIL] Transfer coalescing with no window test failed");
+  }
+  retVal = set_transfer_coalescing(deviceName, 1000, 5000);
+  if ((-1 != retVal) || (EINVAL != errno))
+  {
+    allTestsOk = false;
+    Serial.println("[FAIL] Transfer coalescing with odd buffer size test failed");
+  }
+  if (0 != set_transfer_coalescing(deviceName, 8192, 5000))
+  {
+    coalescingTestFailed = true;
+  }
+  (void) mount(deviceName, FS_FAT, MNT_DEFAULT);
+  retVal = set_transfer_coalescing(deviceName, 0, 0);
+  if ((-1 != retVal) || (EBUSY != errno))
+  {
+    allTestsOk = false;
+    Serial.println("[FAIL] Transfer coalescing when mounted test failed");
+  }
+  // Several clusters of numbered lines, so that a misplaced or stale sector shows up on read back
+  fp = fopen(coalescedPath, "w");
+  if (nullptr == fp)
+  {
+    coalescingTestFailed = true;
+  }
+  else
+  {
+    for (int i=0; i<2000; i++)
+    {
+      (void) fprintf(fp, "%08d\n", i);
+    }
+    (void) fclose(fp);
+  }
+  fp = fopen(coalescedPath, "r");
+  if (nullptr == fp)
+  {
+    coalescingTestFailed = true;
+  }
+  else
+  {
+    for (int i=0; i<2000; i++)
+    {
+      int lineNumber = -1;
+      if ((1 != fscanf(fp, "%d", &lineNumber)) || (i != lineNumber))
+      {
+        coalescingTestFailed = true;
+        break;
+      }
+    }
+    (void) fclose(fp);
+  }
+  // Overwrite two sectors in the middle of the file and read it back from the start without a flush in
+  // between, so the read-ahead runs into writes that are still buffered
+  fp = fopen(coalescedPath, "r+");
+  if (nullptr == fp)
+  {
+    coalescingTestFailed = true;
+  }
+  else
+  {
+    (void) setvbuf(fp, nullptr, _IONBF, 0);
+    char sectorBuffer[512];
+    memset(sectorBuffer, 'X', sizeof(sectorBuffer));
+    if ((0 != fseek(fp, 4096, SEEK_SET)) ||
+        (1 != fwrite(sectorBuffer, sizeof(sectorBuffer), 1, fp)) ||
+        (1 != fwrite(sectorBuffer, sizeof(sectorBuffer), 1, fp)) ||
+        (0 != fseek(fp, 0, SEEK_SET)))
+    {
+      coalescingTestFailed = true;
+    }
+    for (long sectorOffset=0; (false == coalescingTestFailed) && (sectorOffset < 8192); sectorOffset += 512)
+    {
+      if (1 != fread(sectorBuffer, sizeof(sectorBuffer), 1, fp))
+      {
+        coalescingTestFailed = true;
+        break;
+      }
+      for (long i=0; i<512; i++)
+      {
+        const long offset = sectorOffset + i;
+        char expected = 'X';
+        if ((offset < 4096) || (offset >= 5120))
+        {
+          char line[10];
+          (void) snprintf(line, sizeof(line), "%08ld\n", offset / 9);
+          expected = line[offset % 9];
+        }
+        if (expected != sectorBuffer[i])
+        {
+          coalescingTestFailed = true;
+          break;
+        }
+      }
+    }
+    (void) fclose(fp);
+  }
+  (void) remove(coalescedPath);
+  (void) umount(deviceName);
+  // Back to the default for the tests below
+  (void) set_transfer_coalescing(deviceName, 0, 0);
+  if (true == coalescingTestFailed)
+  {
+    allTestsOk = false;
+    Serial.println("[FAIL] Transfer coalescing test failed");
+  }
+  // <-- Transfer coalescing test
+
+  // fsck test -->
+  bool fsckTestFailed = false;
+  struct FsckReport fsckResults;
+  (void) mount(deviceName, FS_FAT, MNT_DEFAULT);
+  retVal = fsck(deviceName, FSCK_AUTO, 0);
+  if ((-1 != retVal) || (EBUSY != errno))
+  {
+    allTestsOk = false;
+    Serial.println("[FAIL] fsck when mounted test failed");
+  }
+  (void) umount(deviceName);
+  // Cleanly unmounted just now, so this should take the fast path
+  if ((0 != fsck(deviceName, FSCK_AUTO, 0)) || (0 != fsck_report(deviceName, &fsckResults)) ||
+      (false == fsckResults.wasClean) || (true == fsckResults.checked))
+  {
+    fsckTestFailed = true;
+  }
+  // A full check in small time slices, which shouldn't find anything on a volume the tests wrote to
+  do
+  {
+    retVal = fsck(deviceName, FSCK_CHECK_ONLY, 10000);
+  } while ((-1 == retVal) && (EINPROGRESS == errno));
+  if ((0 != retVal) || (0 != fsck_report(deviceName, &fsckResults)) || (false == fsckResults.checked) ||
+      (100 != fsckResults.progressPercent) || (0 != fsckResults.lostClusters) || (0 != fsckResults.crossLinks) ||
+      (0 != fsckResults.brokenChains) || (0 != fsckResults.badEntries))
+  {
+    fsckTestFailed = true;
+  }
+  if (true == fsckTestFailed)
+  {
+    allTestsOk = false;
+    Serial.println("[FAIL] fsck test failed");
+  }
+  // <-- fsck test
+
+  // File view test -->
+  bool fileViewTestFailed = false;
+  const char *viewedPath = nullptr;
+  if (DEV_USB == deviceName)
+  {
+    viewedPath = "/usb/8160537742.bin";
+  }
+  else if (DEV_SDCARD == deviceName)
+  {
+    viewedPath = "/sdcard/8160537742.bin";
+  }
+  else
+  {
+    for ( ; ;) ;  // Shouldn't get here unless there's a bug in the test code
+  }
+  struct FileView *view = view_open(viewedPath, nullptr);
+  if ((nullptr != view) || (ENOENT != errno))
+  {
+    allTestsOk = false;
+    Serial.println("[FAIL] File view when not mounted test failed");
+  }
+  (void) mount(deviceName, FS_FAT, MNT_DEFAULT);
+  // Byte i of the file is (i % 251), so any misplaced byte shows up
+  fp = fopen(viewedPath, "w");
+  if (nullptr == fp)
+  {
+    fileViewTestFailed = true;
+  }
+  else
+  {
+    for (int i=0; i<20000; i++)
+    {
+      (void) fputc(i % 251, fp);
+    }
+    (void) fclose(fp);
+  }
+  struct FileViewSettings viewSettings;
+  viewSettings.pageSize = 512;
+  viewSettings.pageCount = 4;
+  viewSettings.prefetchPages = 2;
+  view = view_open(viewedPath, &viewSettings);
+  if ((nullptr == view) || (20000 != view_size(view)))
+  {
+    fileViewTestFailed = true;
+  }
+  else
+  {
+    retVal = umount(deviceName);
+    if ((-1 != retVal) || (EBUSY != errno))
+    {
+      allTestsOk = false;
+      Serial.println("[FAIL] Unmount with open file view test failed");
+    }
+    // Windows within a page, straddling two pages, and running past the end of the file
+    const off_t viewOffsets[] = {0, 100, 510, 1000, 19990, 7777, 512, 15000, 3, 19999};
+    for (size_t i=0; i<(sizeof(viewOffsets) / sizeof(viewOffsets[0])); i++)
+    {
+      size_t mapped = 0;
+      const uint8_t *window = static_cast<const uint8_t*>(view_map(view, viewOffsets[i], 100, &mapped));
+      const size_t expected = ((20000 - viewOffsets[i]) < 100) ? (20000 - viewOffsets[i]) : 100;
+      if ((nullptr == window) || (expected != mapped))
+      {
+        fileViewTestFailed = true;
+        break;
+      }
+      for (size_t j=0; j<mapped; j++)
+      {
+        if (((viewOffsets[i] + j) % 251) != window[j])
+        {
+          fileViewTestFailed = true;
+          break;
+        }
+      }
+    }
+    size_t mapped = 0;
+    if ((nullptr != view_map(view, 20000, 1, &mapped)) || (EINVAL != errno))
+    {
+      fileViewTestFailed = true;
+    }
+    if ((nullptr != view_map(view, 0, 513, &mapped)) || (EINVAL != errno))
+    {
+      fileViewTestFailed = true;
+    }
+    if (0 != view_close(view))
+    {
+      fileViewTestFailed = true;
+    }
+  }
+  (void) remove(viewedPath);
+  (void) umount(deviceName);
+  if (true == fileViewTestFailed)
+  {
+    allTestsOk = false;
+    Serial.println("[FAIL] File view test failed");
+  }
+  // <-- File view test
+
+  // Trace test -->
+#if defined(POSIX_STORAGE_NO_TRACE)
+  // Left out of the library unless it's built with POSIX_STORAGE_TRACE defined
+  retVal = set_trace(deviceName, nullptr);
+  if ((-1 != retVal) || (ENOTSUP != errno))
+  {
+    allTestsOk = false;
+    Serial.println("[FAIL] Trace not supported test failed");
+  }
+#else
+  bool traceTestFailed = false;
+  const char *tracedPath = nullptr;
+  const char *renamedTracedPath = nullptr;
+  const char *tracePath = nullptr;
+  if (DEV_USB == deviceName)
+  {
+    tracedPath = "/usb/3217795044.txt";
+    renamedTracedPath = "/usb/3217795045.txt";
+    tracePath = "/usb/3217795044.bin";
+  }
+  else if (DEV_SDCARD == deviceName)
+  {
+    tracedPath = "/sdcard/3217795044.txt";
+    renamedTracedPath = "/sdcard/3217795045.txt";
+    tracePath = "/sdcard/3217795044.bin";
+  }
+  else
+  {
+    for ( ; ;) ;  // Shouldn't get here unless there's a bug in the test code
+  }
+  struct TraceSettings traceSettings;
+  traceSettings.records = 256;
+  traceSettings.blockLevel = true;
+  traceSettings.fileLevel = true;
+  retVal = trace_dump(deviceName, tracePath);
+  if ((-1 != retVal) || (EINVAL != errno))
+  {
+    allTestsOk = false;
+    Serial.println("[FAIL] Trace dump without trace test failed");
+  }
+  (void) mount(deviceName, FS_FAT, MNT_DEFAULT);
+  retVal = set_trace(deviceName, &traceSettings);
+  if ((-1 != retVal) || (EBUSY != errno))
+  {
+    allTestsOk = false;
+    Serial.println("[FAIL] Set trace when mounted test failed");
+  }
+  (void) umount(deviceName);
+  traceSettings.records = 0;
+  retVal = set_trace(deviceName, &traceSettings);
+  if ((-1 != retVal) || (EINVAL != errno))
+  {
+    allTestsOk = false;
+    Serial.println("[FAIL] Set trace without records test failed");
+  }
+  traceSettings.records = 256;
+  if (0 != set_trace(deviceName, &traceSettings))
+  {
+    traceTestFailed = true;
+  }
+  (void) mount(deviceName, FS_FAT, MNT_DEFAULT);
+  fp = fopen(tracedPath, "w");
+  if (nullptr == fp)
+  {
+    traceTestFailed = true;
+  }
+  else
+  {
+    for (int i=0; i<100; i++)
+    {
+      (void) fputs("The quick brown fox jumps over the lazy dog\n", fp);
+    }
+    (void) fclose(fp);
+  }
+  fp = fopen(tracedPath, "r");
+  if (nullptr == fp)
+  {
+    traceTestFailed = true;
+  }
+  else
+  {
+    while (EOF != fgetc(fp)) ;
+    (void) fclose(fp);
+  }
+  // Path operations are traced and replayed as well
+  if ((0 != stat(tracedPath, &sb)) || (0 != rename(tracedPath, renamedTracedPath)) || (0 != rename(renamedTracedPath, tracedPath)))
+  {
+    traceTestFailed = true;
+  }
+  if (0 != trace_dump(deviceName, tracePath))
+  {
+    traceTestFailed = true;
+  }
+  struct TraceReplayReport replayReport;
+  if (0 != trace_replay(tracePath, deviceName, &replayReport))
+  {
+    traceTestFailed = true;
+  }
+  else if ((0 == replayReport.replayedOperations) || (0 != replayReport.failedOperations))
+  {
+    traceTestFailed = true;
+  }
+  (void) remove(tracePath);
+  (void) remove(tracedPath);
+  (void) umount(deviceName);
+  if (0 != set_trace(deviceName, nullptr))
+  {
+    traceTestFailed = true;
+  }
+  if (true == traceTestFailed)
+  {
+    allTestsOk = false;
+    Serial.println("[FAIL] Trace test failed");
+  }
+#endif
+  // <-- Trace test
+
   // These tests can't be performed on the Opta because we log to USB
   if (TEST_OPTA_USB != selectedTest)
   {
@@ -54,19 +54,50 @@
 */
 
 #include "Arduino_POSIXStorage.h"
+#if !defined(POSIX_STORAGE_NO_COALESCING)
+  #include "CoalescingBlockDevice.h"
+#endif
+#if !defined(POSIX_STORAGE_NO_DIRECTORY_CACHE)
+  #include "DirectoryCacheFileSystem.h"
+#endif
+#include "FATChecker.h"
+#if !defined(POSIX_STORAGE_NO_FAULT_INJECTION)
+  #include "FaultInjectionBlockDevice.h"
+#endif
+#include "FileView.h"
+#if !defined(POSIX_STORAGE_NO_TRACE)
+  #include "TraceRecorder.h"
+  #include "TraceReplayer.h"
+  #include "TracingBlockDevice.h"
+  #include "TracingFileSystem.h"
+#endif
+#if !defined(POSIX_STORAGE_NO_TRIM_BATCHING)
+  #include "TrimBatchingBlockDevice.h"
+#endif
+#include "WriteQueue.h"
 
 #include <Arduino.h>
 
 #if defined(ARDUINO_PORTENTA_C33)
-  #include <SDCardBlockDevice.h>
-  #include <UsbHostMsd.h>
+  #if !defined(POSIX_STORAGE_NO_SDCARD)
+    #include <SDCardBlockDevice.h>
+  #endif
+  #if !defined(POSIX_STORAGE_NO_USB)
+    #include <UsbHostMsd.h>
+  #endif
 #elif defined(ARDUINO_PORTENTA_H7_M7) 
-  #include <Arduino_USBHostMbed5.h>
+  #if !defined(POSIX_STORAGE_NO_USB)
+    #include <Arduino_USBHostMbed5.h>
+  #endif
   #include <BlockDevice.h>
   #include <DigitalIn.h>
-  #include <SDMMCBlockDevice.h>
+  #if !defined(POSIX_STORAGE_NO_SDCARD)
+    #include <SDMMCBlockDevice.h>
+  #endif
 #elif defined(ARDUINO_OPTA) 
-  #include <Arduino_USBHostMbed5.h>
+  #if !defined(POSIX_STORAGE_NO_USB)
+    #include <Arduino_USBHostMbed5.h>
+  #endif
   #include <BlockDevice.h>
 #else
   #error "The Arduino_POSIXStorage library does not support this board"
@@ -80,6 +111,7 @@
 
 #if defined(ARDUINO_PORTENTA_H7_M7) || defined(ARDUINO_OPTA)
   using mbed::BlockDevice;
+  using mbed::bd_size_t;
   using mbed::FileSystem;
 #endif
 
@@ -92,6 +124,43 @@
 struct DeviceFileSystemCombination {
   BlockDevice *device    = nullptr;     // Set if mounted or hotplug callback registered
   FileSystem *fileSystem = nullptr;     // Set only if mounted
+#if !defined(POSIX_STORAGE_NO_DIRECTORY_CACHE)
+  size_t directoryCacheEntries = 0;     // Directory cache size for the next mount, 0 if disabled
+#endif
+#if !defined(POSIX_STORAGE_NO_COALESCING)
+  size_t coalescingBufferSize = 0;      // Transfer coalescing buffer size for the next mount, 0 if disabled
+  uint32_t coalescingWindowMicroseconds = 0;
+#endif
+#if !defined(POSIX_STORAGE_NO_FAULT_INJECTION)
+  bool injectFaults = false;            // Fault injection for the next mount
+  struct FaultInjectionSettings faultSettings = {};
+  struct FaultInjectionStatistics faultStatistics = {};
+#endif
+#if !defined(POSIX_STORAGE_NO_TRACE)
+  TraceRecorder *tracer = nullptr;      // Set only if tracing, and kept from one mount to the next
+#endif
+  // Block devices inserted between fileSystem and device, set only if mounted -->
+#if !defined(POSIX_STORAGE_NO_FAULT_INJECTION)
+  FaultInjectionBlockDevice *faultDevice = nullptr;
+#endif
+#if !defined(POSIX_STORAGE_NO_TRIM_BATCHING)
+  TrimBatchingBlockDevice *trimDevice = nullptr;
+#endif
+#if !defined(POSIX_STORAGE_NO_COALESCING)
+  CoalescingBlockDevice *coalescingDevice = nullptr;
+#endif
+#if !defined(POSIX_STORAGE_NO_TRACE)
+  TracingBlockDevice *traceDevice = nullptr;
+#endif
+  // <--
+  WriteQueue *writeQueue = nullptr;     // Set only if the write queue is started
+  int queueStopError = 0;               // Error of queued writes that umount() hasn't reported yet
+  size_t openViews = 0;                 // Views from view_open() that use fileSystem
+  bool markCleanOnUnmount = false;      // The FAT volume was clean when mounted, and is marked as in use
+  FATChecker *checker = nullptr;        // Set only while fsck() is in progress, device is set then too
+  bool keepDeviceAfterCheck = false;    // The device object was there before fsck() started
+  bool hasFsckReport = false;
+  struct FsckReport fsckReport = {};
 };
 
 /*
@@ -129,8 +198,12 @@ enum CallbackTypes : uint8_t
 namespace {
 
 // Always set unused members to nullptr at all times because the rest of the code expects it -->
+#if !defined(POSIX_STORAGE_NO_SDCARD)
 struct DeviceFileSystemCombination sdcard = {nullptr, nullptr};
+#endif
+#if !defined(POSIX_STORAGE_NO_USB)
 struct DeviceFileSystemCombination usb    = {nullptr, nullptr};
+#endif
 // <--
 
 bool hotplugCallbackAlreadyRegistered = false;
@@ -287,10 +360,197 @@ void deleteDevice(const enum StorageDevices deviceName, struct DeviceFileSystemC
   }
 }   // End of deleteDevice()
 
+// Deletes the file system object and the block devices inserted below it, but not the device itself
+void deleteFileSystem(struct DeviceFileSystemCombination * const deviceFileSystemCombination)
+{
+  // Ok to delete with base class pointer because the destructor of the base class is virtual
+  delete deviceFileSystemCombination->fileSystem;
+  deviceFileSystemCombination->fileSystem = nullptr;
+#if !defined(POSIX_STORAGE_NO_TRACE)
+  delete deviceFileSystemCombination->traceDevice;
+  deviceFileSystemCombination->traceDevice = nullptr;
+#endif
+#if !defined(POSIX_STORAGE_NO_COALESCING)
+  delete deviceFileSystemCombination->coalescingDevice;
+  deviceFileSystemCombination->coalescingDevice = nullptr;
+#endif
+#if !defined(POSIX_STORAGE_NO_TRIM_BATCHING)
+  delete deviceFileSystemCombination->trimDevice;
+  deviceFileSystemCombination->trimDevice = nullptr;
+#endif
+#if !defined(POSIX_STORAGE_NO_FAULT_INJECTION)
+  delete deviceFileSystemCombination->faultDevice;
+  deviceFileSystemCombination->faultDevice = nullptr;
+#endif
+}   // End of deleteFileSystem()
+
+// Returns the block device to mount the file system on, or nullptr if out of memory
+BlockDevice *insertBlockDevices(const enum StorageDevices deviceName,
+                                struct DeviceFileSystemCombination * const deviceFileSystemCombination)
+{
+  BlockDevice *top = deviceFileSystemCombination->device;
+#if !defined(POSIX_STORAGE_NO_FAULT_INJECTION)
+  // Right above the device, so that everything else sees the faults as faults of the device
+  if (true == deviceFileSystemCombination->injectFaults)
+  {
+    deviceFileSystemCombination->faultDevice = new(std::nothrow) FaultInjectionBlockDevice(top,
+                                                                                           deviceFileSystemCombination->faultSettings,
+                                                                                           &(deviceFileSystemCombination->faultStatistics));
+    if (nullptr == deviceFileSystemCombination->faultDevice)
+    {
+      return nullptr;
+    }
+    top = deviceFileSystemCombination->faultDevice;
+  }
+#endif
+#if !defined(POSIX_STORAGE_NO_SDCARD) && !defined(POSIX_STORAGE_NO_TRIM_BATCHING)
+  // Only SD Cards benefit from trim, the USBHostMSD class ignores it
+  if (DEV_SDCARD == deviceName)
+  {
+    deviceFileSystemCombination->trimDevice = new(std::nothrow) TrimBatchingBlockDevice(top);
+    if (nullptr == deviceFileSystemCombination->trimDevice)
+    {
+      return nullptr;
+    }
+    top = deviceFileSystemCombination->trimDevice;
+  }
+#else
+  (void) deviceName;    // Silence -Wunused-parameter, because this variable is only used for trimming SD Cards
+#endif
+#if !defined(POSIX_STORAGE_NO_COALESCING)
+  // Above the trim device, so that programs it passes on still cancel pending trims
+  if (0 != deviceFileSystemCombination->coalescingBufferSize)
+  {
+    deviceFileSystemCombination->coalescingDevice = new(std::nothrow) CoalescingBlockDevice(top,
+                                                                                            deviceFileSystemCombination->coalescingBufferSize,
+                                                                                            deviceFileSystemCombination->coalescingWindowMicroseconds);
+    if ((nullptr == deviceFileSystemCombination->coalescingDevice) ||
+        (false == deviceFileSystemCombination->coalescingDevice->isValid()))
+    {
+      return nullptr;
+    }
+    top = deviceFileSystemCombination->coalescingDevice;
+  }
+#endif
+#if !defined(POSIX_STORAGE_NO_TRACE)
+  // On top, so that the trace shows what the file system asks for, whatever the settings below
+  if ((nullptr != deviceFileSystemCombination->tracer) && (true == deviceFileSystemCombination->tracer->tracesBlocks()))
+  {
+    deviceFileSystemCombination->traceDevice = new(std::nothrow) TracingBlockDevice(top, deviceFileSystemCombination->tracer);
+    if (nullptr == deviceFileSystemCombination->traceDevice)
+    {
+      return nullptr;
+    }
+    top = deviceFileSystemCombination->traceDevice;
+  }
+#endif
+  return top;
+}   // End of insertBlockDevices()
+
+#if !defined(POSIX_STORAGE_NO_FAT)
+// Returns the block device to mark the FAT volume clean or in use on. That's through the fault injection,
+// if any, so that a volume on a removed device isn't marked clean.
+BlockDevice *getMarkDevice(const struct DeviceFileSystemCombination * const deviceFileSystemCombination)
+{
+#if !defined(POSIX_STORAGE_NO_FAULT_INJECTION)
+  if (nullptr != deviceFileSystemCombination->faultDevice)
+  {
+    return deviceFileSystemCombination->faultDevice;
+  }
+#endif
+  return deviceFileSystemCombination->device;
+}   // End of getMarkDevice()
+#endif
+
+#if !defined(POSIX_STORAGE_NO_LITTLEFS)
+// Tells the device that all of it is free, right before it's formatted. Only used for LittleFS,
+// because FatFs already does this when it formats.
+void trimWholeDevice(BlockDevice * const device)
+{
+  if (0 != device->init())
+  {
+    return;
+  }
+  // A failed trim is harmless, it just leaves the device's garbage collection with more to do
+  (void) device->trim(0, device->size());
+  (void) device->deinit();
+}   // End of trimWholeDevice()
+
+uint32_t roundUpToMultiple(const uint32_t value, const uint32_t multiple)
+{
+  return (((value + multiple - 1) / multiple) * multiple);
+}   // End of roundUpToMultiple()
+
+// WARNING: Don't set errno and return -1 in this function - just return 0 for success or the errno code!
+// Members of requestedGeometry set to 0 (or a nullptr requestedGeometry) are derived from the device
+int getLittleFSGeometry(BlockDevice * const device,
+                        const struct LittleFSGeometry * const requestedGeometry,
+                        struct LittleFSGeometry * const geometry)
+{
+  // The device must be initialized for USBHostMSD to report its block size
+  if (0 != device->init())
+  {
+    return EIO;
+  }
+  const bd_size_t deviceReadSize    = device->get_read_size();
+  const bd_size_t deviceProgramSize = device->get_program_size();
+  const bd_size_t deviceEraseSize   = device->get_erase_size();
+  (void) device->deinit();
+  if ((0 == deviceReadSize) || (0 == deviceProgramSize) || (0 == deviceEraseSize) ||
+      (deviceReadSize > UINT32_MAX) || (deviceProgramSize > UINT32_MAX) || (deviceEraseSize > UINT32_MAX))
+  {
+    return EIO;
+  }
+  const uint32_t readUnit    = static_cast<uint32_t>(deviceReadSize);
+  const uint32_t programUnit = static_cast<uint32_t>(deviceProgramSize);
+  const uint32_t eraseUnit   = static_cast<uint32_t>(deviceEraseSize);
+  // LittleFS reads and programs whole cache lines, and mbed's defaults (64 bytes) are smaller than a
+  // sector on both SD Cards and USB thumb drives, so a full sector is the smallest useful size
+  geometry->readSize      = roundUpToMultiple(512, readUnit);
+  geometry->programSize   = roundUpToMultiple(512, programUnit);
+  // Same as mbed's default on SD Cards and USB thumb drives, which keeps existing volumes mountable
+  geometry->blockSize     = roundUpToMultiple(512, eraseUnit);
+  // Lookahead misses force LittleFS to traverse the whole file system to find free blocks, so a larger
+  // lookahead (1 KB of RAM) speeds up allocation considerably. mbed caps it at the block count.
+  geometry->lookaheadSize = 8192;
+  if (nullptr != requestedGeometry)
+  {
+    if (0 != requestedGeometry->readSize)
+    {
+      geometry->readSize = requestedGeometry->readSize;
+    }
+    if (0 != requestedGeometry->programSize)
+    {
+      geometry->programSize = requestedGeometry->programSize;
+    }
+    if (0 != requestedGeometry->blockSize)
+    {
+      geometry->blockSize = requestedGeometry->blockSize;
+    }
+    if (0 != requestedGeometry->lookaheadSize)
+    {
+      geometry->lookaheadSize = requestedGeometry->lookaheadSize;
+    }
+  }
+  // LittleFS asserts (and halts) on these rather than returning an error, so check them here
+  if ((0 != (geometry->readSize % readUnit)) ||
+      (0 != (geometry->programSize % programUnit)) ||
+      (0 != (geometry->blockSize % eraseUnit)) ||
+      (0 != (geometry->blockSize % geometry->readSize)) ||
+      (0 != (geometry->blockSize % geometry->programSize)) ||
+      (0 != (geometry->lookaheadSize % 32)))
+  {
+    return EINVAL;
+  }
+  return 0;
+}   // End of getLittleFSGeometry()
+#endif
+
 // WARNING: Don't set errno and return -1 in this function - just return 0 for success or the errno code!
 int mountOrFormatFileSystemOnDevice(const enum StorageDevices deviceName,
                                     struct DeviceFileSystemCombination * const deviceFileSystemCombination,
                                     const enum FileSystems fileSystem,
+                                    const struct LittleFSGeometry * const requestedGeometry,
                                     const char * const mountPoint,
                                     const enum ActionTypes mountOrFormat)
 {
@@ -298,13 +558,56 @@ int mountOrFormatFileSystemOnDevice(const enum StorageDevices deviceName,
   {
     return EFAULT;
   }
+  // Geometry only applies to LittleFS
+  if ((nullptr != requestedGeometry) && (FS_LITTLEFS != fileSystem))
+  {
+    return EINVAL;
+  }
+  // With the directory cache or file tracing enabled, the outermost of those objects takes over the mount
+  // point name and forwards to unnamed objects below it. mkfs() uses neither because there's nothing to
+  // cache or trace.
+#if !defined(POSIX_STORAGE_NO_DIRECTORY_CACHE)
+  const bool useDirectoryCache = ((ACTION_MOUNT == mountOrFormat) && (0 != deviceFileSystemCombination->directoryCacheEntries));
+#else
+  const bool useDirectoryCache = false;
+#endif
+#if !defined(POSIX_STORAGE_NO_TRACE)
+  const bool useFileTracing = ((ACTION_MOUNT == mountOrFormat) && (nullptr != deviceFileSystemCombination->tracer) &&
+                               (true == deviceFileSystemCombination->tracer->tracesFiles()));
+#else
+  const bool useFileTracing = false;
+#endif
+  const char * const fileSystemName = ((true == useDirectoryCache) || (true == useFileTracing)) ? nullptr : mountPoint;
   if (FS_FAT == fileSystem)
   {
-    deviceFileSystemCombination->fileSystem = new(std::nothrow) FATFileSystem(mountPoint);
+#if !defined(POSIX_STORAGE_NO_FAT)
+    deviceFileSystemCombination->fileSystem = new(std::nothrow) FATFileSystem(fileSystemName);
+#else
+    return ENOTSUP;
+#endif
   }
   else if (FS_LITTLEFS == fileSystem)
   {
-    deviceFileSystemCombination->fileSystem = new(std::nothrow) LittleFileSystem(mountPoint);
+#if !defined(POSIX_STORAGE_NO_LITTLEFS)
+    if (nullptr == deviceFileSystemCombination->device)
+    {
+      return EFAULT;
+    }
+    struct LittleFSGeometry geometry;
+    const int geometryReturn = getLittleFSGeometry(deviceFileSystemCombination->device, requestedGeometry, &geometry);
+    if (0 != geometryReturn)
+    {
+      return geometryReturn;
+    }
+    deviceFileSystemCombination->fileSystem = new(std::nothrow) LittleFileSystem(fileSystemName,
+                                                                                 nullptr,
+                                                                                 geometry.readSize,
+                                                                                 geometry.programSize,
+                                                                                 geometry.blockSize,
+                                                                                 geometry.lookaheadSize);
+#else
+    return ENOTSUP;
+#endif
   }
   else
   {
@@ -314,23 +617,89 @@ int mountOrFormatFileSystemOnDevice(const enum StorageDevices deviceName,
   {
     return ENODEV;
   }
+#if !defined(POSIX_STORAGE_NO_DIRECTORY_CACHE)
+  if (true == useDirectoryCache)
+  {
+    DirectoryCacheFileSystem *directoryCache = new(std::nothrow) DirectoryCacheFileSystem((true == useFileTracing) ? nullptr : mountPoint,
+                                                                                         deviceFileSystemCombination->fileSystem,
+                                                                                         deviceFileSystemCombination->directoryCacheEntries,
+                                                                                         (FS_FAT == fileSystem));
+    if (nullptr == directoryCache)
+    {
+      deleteFileSystem(deviceFileSystemCombination);
+      return ENOMEM;
+    }
+    // From here on the directory cache owns the file system object and deletes it with itself
+    deviceFileSystemCombination->fileSystem = directoryCache;
+    if (false == directoryCache->isValid())
+    {
+      deleteFileSystem(deviceFileSystemCombination);
+      return ENOMEM;
+    }
+  }
+#endif
+#if !defined(POSIX_STORAGE_NO_TRACE)
+  // Outside the directory cache, so that the trace shows what the sketch did, not what reached the file system
+  if (true == useFileTracing)
+  {
+    TracingFileSystem *tracingFileSystem = new(std::nothrow) TracingFileSystem(mountPoint,
+                                                                              deviceFileSystemCombination->fileSystem,
+                                                                              deviceFileSystemCombination->tracer);
+    if (nullptr == tracingFileSystem)
+    {
+      deleteFileSystem(deviceFileSystemCombination);
+      return ENOMEM;
+    }
+    // From here on the tracing object owns the file system object and deletes it with itself
+    deviceFileSystemCombination->fileSystem = tracingFileSystem;
+  }
+#endif
   // Check before use in mount(), umount(), or reformat() calls below
   if (nullptr == deviceFileSystemCombination->device)
   {
-    // Ok to delete with base class pointer because the destructor of the base class is virtual
-    delete deviceFileSystemCombination->fileSystem;
-    deviceFileSystemCombination->fileSystem = nullptr;
+    deleteFileSystem(deviceFileSystemCombination);
     return EFAULT;
   }
   if (ACTION_MOUNT == mountOrFormat)
   {
+    BlockDevice * const mountDevice = insertBlockDevices(deviceName, deviceFileSystemCombination);
+    if (nullptr == mountDevice)
+    {
+      deleteFileSystem(deviceFileSystemCombination);
+      return ENOMEM;
+    }
+    // Mark a FAT volume as in use while it's mounted, so that fsck() can tell if it wasn't unmounted.
+    // A volume that was in use already stays that way until it has been checked.
+    deviceFileSystemCombination->markCleanOnUnmount = false;
+#if !defined(POSIX_STORAGE_NO_FAT)
+    BlockDevice * const markDevice = getMarkDevice(deviceFileSystemCombination);
+    if (FS_FAT == fileSystem)
+    {
+      bool wasClean = false;
+      deviceFileSystemCombination->markCleanOnUnmount = ((0 == FATChecker::markVolumeDirty(markDevice, &wasClean)) &&
+                                                         (true == wasClean));
+    }
+#endif
     // See note (1) at the bottom of the file
-    int mountReturn = deviceFileSystemCombination->fileSystem->mount(deviceFileSystemCombination->device);
+    int mountReturn = deviceFileSystemCombination->fileSystem->mount(mountDevice);
+#if !defined(POSIX_STORAGE_NO_COALESCING)
+    // The file systems report a block device that fails to initialize as an I/O error
+    if ((0 != mountReturn) && (nullptr != deviceFileSystemCombination->coalescingDevice) &&
+        (false == deviceFileSystemCombination->coalescingDevice->fitsDevice()))
+    {
+      mountReturn = -EINVAL;
+    }
+#endif
     if (0 != mountReturn)
     {
-      // Ok to delete with base class pointer because the destructor of the base class is virtual
-      delete deviceFileSystemCombination->fileSystem;
-      deviceFileSystemCombination->fileSystem = nullptr;
+#if !defined(POSIX_STORAGE_NO_FAT)
+      if (true == deviceFileSystemCombination->markCleanOnUnmount)
+      {
+        (void) FATChecker::markVolumeClean(markDevice);
+        deviceFileSystemCombination->markCleanOnUnmount = false;
+      }
+#endif
+      deleteFileSystem(deviceFileSystemCombination);
       // mbed's mount() returns negative errno codes
       return (-mountReturn);    // See note (1) at the bottom of the file
     }
@@ -339,38 +708,41 @@ int mountOrFormatFileSystemOnDevice(const enum StorageDevices deviceName,
   else if (ACTION_FORMAT == mountOrFormat)
   {
     int reformatReturn = -1;    // See note (1) at the bottom of the file
+    // The file systems that are left out never get this far, because no object was created for them
     if (FS_FAT == fileSystem)
     {
+#if !defined(POSIX_STORAGE_NO_FAT)
       // Ok to downcast with static_cast because we know for sure that fileSystem isn't pointing to a
       // base-class object, and dynamic_cast wouldn't work anyway because compilation is done with -fno-rtti      
       FATFileSystem *fatFileSystem = static_cast<FATFileSystem*>(deviceFileSystemCombination->fileSystem);
       // FS_FAT needs an allocation unit size specified and 0 just asks for the default one
       reformatReturn = fatFileSystem->reformat(deviceFileSystemCombination->device, 0);
+#endif
     }
     else if (FS_LITTLEFS == fileSystem)
     {
+#if !defined(POSIX_STORAGE_NO_LITTLEFS)
+      if (DEV_SDCARD == deviceName)
+      {
+        trimWholeDevice(deviceFileSystemCombination->device);
+      }
       reformatReturn = deviceFileSystemCombination->fileSystem->reformat(deviceFileSystemCombination->device);
+#endif
     }
     else  // This shouldn't happen unless there is a bug in the code
     {
-      // Ok to delete with base class pointer because the destructor of the base class is virtual
-      delete deviceFileSystemCombination->fileSystem;
-      deviceFileSystemCombination->fileSystem = nullptr;
+      deleteFileSystem(deviceFileSystemCombination);
       return ENODEV;
     }
     if (0 != reformatReturn)
     {
-      // Ok to delete with base class pointer because the destructor of the base class is virtual
-      delete deviceFileSystemCombination->fileSystem;
-      deviceFileSystemCombination->fileSystem = nullptr;
+      deleteFileSystem(deviceFileSystemCombination);
       // mbed's reformat() returns negative errno codes
       return (-reformatReturn);   // See note (1) at the bottom of the file
     }
     if (0 == deviceFileSystemCombination->fileSystem->unmount())
     {
-      // Ok to delete with base class pointer because the destructor of the base class is virtual
-      delete deviceFileSystemCombination->fileSystem;
-      deviceFileSystemCombination->fileSystem = nullptr;
+      deleteFileSystem(deviceFileSystemCombination);
       deleteDevice(deviceName, deviceFileSystemCombination);
     }
     else
@@ -382,18 +754,16 @@ int mountOrFormatFileSystemOnDevice(const enum StorageDevices deviceName,
   }   // End of ACTION_FORMAT
   else
   {
-    // Ok to delete with base class pointer because the destructor of the base class is virtual
-    delete deviceFileSystemCombination->fileSystem;
-    deviceFileSystemCombination->fileSystem = nullptr;
+    deleteFileSystem(deviceFileSystemCombination);
     return ENOTSUP;    // This shouldn't happen unless there's a bug in the code
   }
 }   // End of mountOrFormatFileSystemOnDevice()
 
+#if !defined(POSIX_STORAGE_NO_SDCARD)
 // WARNING: Don't set errno and return -1 in this function - just return 0 for success or the errno code!
-int mountOrFormatSDCard(const enum FileSystems fileSystem,
-                        const enum ActionTypes mountOrFormat)
+int createSDCardDevice()
 {
-  if (nullptr != sdcard.device)   // An SD card is already mounted at that mount point
+  if (nullptr != sdcard.device)   // An SD card is already mounted at that mount point, or being checked
   {
     return EBUSY;
   }
@@ -426,8 +796,20 @@ int mountOrFormatSDCard(const enum FileSystems fileSystem,
     return ENOTBLK;
   }
   // <--
+  return 0;
+}   // End of createSDCardDevice()
 
-  const int mountOrFormatReturn = mountOrFormatFileSystemOnDevice(DEV_SDCARD, &sdcard, fileSystem, "sdcard", mountOrFormat);
+// WARNING: Don't set errno and return -1 in this function - just return 0 for success or the errno code!
+int mountOrFormatSDCard(const enum FileSystems fileSystem,
+                        const struct LittleFSGeometry * const geometry,
+                        const enum ActionTypes mountOrFormat)
+{
+  const int createReturn = createSDCardDevice();
+  if (0 != createReturn)
+  {
+    return createReturn;
+  }
+  const int mountOrFormatReturn = mountOrFormatFileSystemOnDevice(DEV_SDCARD, &sdcard, fileSystem, geometry, "sdcard", mountOrFormat);
   if (0 != mountOrFormatReturn)
   {
     delete sdcard.device;
@@ -436,10 +818,12 @@ int mountOrFormatSDCard(const enum FileSystems fileSystem,
   }
   return 0;
 }   // End of mountOrFormatSDCard()
+#endif
 
+#if !defined(POSIX_STORAGE_NO_USB)
 // WARNING: Don't set errno and return -1 in this function - just return 0 for success or the errno code!
-int mountOrFormatUSBDevice(const enum FileSystems fileSystem,
-                           const enum ActionTypes mountOrFormat)
+// Sets *hotplugKeep if the device object was already there and must be kept if mounting fails
+int connectUSBDevice(bool * const hotplugKeep)
 {
   // We'll need a USBHostMSD pointer because connect() and connected() we'll use later aren't member
   // functions of the base class BlockDevice
@@ -447,11 +831,11 @@ int mountOrFormatUSBDevice(const enum FileSystems fileSystem,
 
   // If the device is registered for the hotplug event or on H7, we mustn't delete it even if
   // we fail to mount a filesystem to it
-  bool hotplugKeep = false;
+  *hotplugKeep = false;
 
   if (nullptr != usb.device) // Already mounted or registered for the hotplug event
   {
-    if (nullptr != usb.fileSystem)  // The device is already mounted
+    if ((nullptr != usb.fileSystem) || (nullptr != usb.checker))  // The device is already mounted or being checked
     {
       return EBUSY;
     }
@@ -461,7 +845,7 @@ int mountOrFormatUSBDevice(const enum FileSystems fileSystem,
       // base-class object, and dynamic_cast wouldn't work anyway because compilation is done with -fno-rtti
       usbHostDevice = static_cast<USBHostMSD*>(usb.device);
       // Make sure not to remove the device object if mount() fails
-      hotplugKeep = true;
+      *hotplugKeep = true;
     }
   }
   else {  // The device isn't used at all yet
@@ -477,14 +861,28 @@ int mountOrFormatUSBDevice(const enum FileSystems fileSystem,
     if (false == (usbHostDevice->connect()))
     {
       // Only delete if the object was created by this function
-      if (false == hotplugKeep)
+      if (false == *hotplugKeep)
       {
         deleteDevice(DEV_USB, &usb);
       }
       return ENOTBLK;
     }
   }
-  const int mountOrFormatReturn = mountOrFormatFileSystemOnDevice(DEV_USB, &usb, fileSystem, "usb", mountOrFormat);
+  return 0;
+}   // End of connectUSBDevice()
+
+// WARNING: Don't set errno and return -1 in this function - just return 0 for success or the errno code!
+int mountOrFormatUSBDevice(const enum FileSystems fileSystem,
+                           const struct LittleFSGeometry * const geometry,
+                           const enum ActionTypes mountOrFormat)
+{
+  bool hotplugKeep = false;
+  const int connectReturn = connectUSBDevice(&hotplugKeep);
+  if (0 != connectReturn)
+  {
+    return connectReturn;
+  }
+  const int mountOrFormatReturn = mountOrFormatFileSystemOnDevice(DEV_USB, &usb, fileSystem, geometry, "usb", mountOrFormat);
   if (0 != mountOrFormatReturn)
   {
     // Only delete if the object was created by this function
@@ -496,24 +894,106 @@ int mountOrFormatUSBDevice(const enum FileSystems fileSystem,
   }
   return 0;
 }   // End of mountOrFormatUSB()
+#endif
 
 // WARNING: Don't set errno and return -1 in this function - just return 0 for success or the errno code!
 int mountOrFormat(const enum StorageDevices deviceName,
                   const enum FileSystems fileSystem,
+                  const struct LittleFSGeometry * const geometry,
                   const enum ActionTypes mountOrFormat)
 {
   portentaMachineControlPowerHandling();
   switch (deviceName)
   {
+#if !defined(POSIX_STORAGE_NO_SDCARD)
     case DEV_SDCARD:
-      return mountOrFormatSDCard(fileSystem, mountOrFormat);
+      return mountOrFormatSDCard(fileSystem, geometry, mountOrFormat);
+#endif
+#if !defined(POSIX_STORAGE_NO_USB)
     case DEV_USB:
-      return mountOrFormatUSBDevice(fileSystem, mountOrFormat);
+      return mountOrFormatUSBDevice(fileSystem, geometry, mountOrFormat);
+#endif
     default:
       return ENOTBLK;
   }
 }   // End of mountOrFormat()
 
+// WARNING: Don't set errno and return -1 in this function - just return 0 for success or the errno code!
+int getDeviceFileSystemCombination(const enum StorageDevices deviceName,
+                                   struct DeviceFileSystemCombination ** const deviceFileSystemCombination)
+{
+  switch (deviceName)
+  {
+#if !defined(POSIX_STORAGE_NO_SDCARD)
+    case DEV_SDCARD:
+      *deviceFileSystemCombination = &sdcard;
+      return 0;
+#endif
+#if !defined(POSIX_STORAGE_NO_USB)
+    case DEV_USB:
+      *deviceFileSystemCombination = &usb;
+      return 0;
+#endif
+    default:
+      return ENOTBLK;
+  }
+}   // End of getDeviceFileSystemCombination()
+
+// WARNING: Don't set errno and return -1 in this function - just return 0 for success or the errno code!
+int getDeviceFromPath(const char * const pathname,
+                      enum StorageDevices * const deviceName,
+                      const char ** const pathInFileSystem)
+{
+  if (0 == strncmp(pathname, "/sdcard/", 8))
+  {
+    *deviceName = DEV_SDCARD;
+    *pathInFileSystem = pathname + 8;
+    return 0;
+  }
+  if (0 == strncmp(pathname, "/usb/", 5))
+  {
+    *deviceName = DEV_USB;
+    *pathInFileSystem = pathname + 5;
+    return 0;
+  }
+  return ENOENT;
+}   // End of getDeviceFromPath()
+
+#if !defined(POSIX_STORAGE_NO_FAT)
+// WARNING: Don't set errno and return -1 in this function - just return 0 for success or the errno code!
+int openDeviceForCheck(const enum StorageDevices deviceName,
+                       struct DeviceFileSystemCombination * const deviceFileSystemCombination)
+{
+  portentaMachineControlPowerHandling();
+  deviceFileSystemCombination->keepDeviceAfterCheck = false;
+  switch (deviceName)
+  {
+#if !defined(POSIX_STORAGE_NO_SDCARD)
+    case DEV_SDCARD:
+      return createSDCardDevice();
+#endif
+#if !defined(POSIX_STORAGE_NO_USB)
+    case DEV_USB:
+      return connectUSBDevice(&(deviceFileSystemCombination->keepDeviceAfterCheck));
+#endif
+    default:
+      return ENOTBLK;
+  }
+}   // End of openDeviceForCheck()
+
+void closeDeviceAfterCheck(const enum StorageDevices deviceName,
+                           struct DeviceFileSystemCombination * const deviceFileSystemCombination)
+{
+  delete deviceFileSystemCombination->checker;
+  deviceFileSystemCombination->checker = nullptr;
+  // Only delete if the object was created by fsck()
+  if (false == deviceFileSystemCombination->keepDeviceAfterCheck)
+  {
+    deleteDevice(deviceName, deviceFileSystemCombination);
+  }
+}   // End of closeDeviceAfterCheck()
+#endif
+
 // WARNING: Don't set errno and return -1 in this function - just return 0 for success or the errno code!
 int register_callback(const enum StorageDevices deviceName, void (* const callbackFunction)(), enum CallbackTypes callbackType)
 {
@@ -528,8 +1008,11 @@ int register_callback(const enum StorageDevices deviceName, void (* const callba
   }
   switch (deviceName)
   {
+#if !defined(POSIX_STORAGE_NO_SDCARD)
     case DEV_SDCARD:    // There is no support for callbacks in the any of the SD Card block device classes
       return ENOTSUP;
+#endif
+#if !defined(POSIX_STORAGE_NO_USB)
     case DEV_USB:
       { // Curly braces necessary to keep new variables inside the case statement
 
@@ -594,6 +1077,7 @@ int register_callback(const enum StorageDevices deviceName, void (* const callba
       return 0;
 
       } // Curly braces necessary to keep new variables inside the case statement
+#endif
     default:
       return ENOTBLK;
   }
@@ -610,6 +1094,14 @@ int register_callback(const enum StorageDevices deviceName, void (* const callba
 int mount(const enum StorageDevices deviceName,
           const enum FileSystems fileSystem,
           const enum MountFlags mountFlags)
+{
+  return mount(deviceName, fileSystem, mountFlags, nullptr);
+}   // End of mount()
+
+int mount(const enum StorageDevices deviceName,
+          const enum FileSystems fileSystem,
+          const enum MountFlags mountFlags,
+          const struct LittleFSGeometry * const geometry)
 {
   // Only MNT_DEFAULT is allowed on this platform, but other platforms could also allow MNT_RDONLY
   if (MNT_DEFAULT != mountFlags)
@@ -617,7 +1109,7 @@ int mount(const enum StorageDevices deviceName,
     errno = ENOTSUP;
     return -1;
   }
-  const int mountOrFormatReturn = mountOrFormat(deviceName, fileSystem, ACTION_MOUNT);
+  const int mountOrFormatReturn = mountOrFormat(deviceName, fileSystem, geometry, ACTION_MOUNT);
   if (0 != mountOrFormatReturn)
   {
     errno = mountOrFormatReturn;
@@ -628,7 +1120,14 @@ int mount(const enum StorageDevices deviceName,
 
 int mkfs(const enum StorageDevices deviceName, const enum FileSystems fileSystem)
 {
-  const int mountOrFormatReturn = mountOrFormat(deviceName, fileSystem, ACTION_FORMAT);
+  return mkfs(deviceName, fileSystem, nullptr);
+}   // End of mkfs()
+
+int mkfs(const enum StorageDevices deviceName,
+         const enum FileSystems fileSystem,
+         const struct LittleFSGeometry * const geometry)
+{
+  const int mountOrFormatReturn = mountOrFormat(deviceName, fileSystem, geometry, ACTION_FORMAT);
   if (0 != mountOrFormatReturn)
   {
     errno = mountOrFormatReturn;
@@ -643,12 +1142,16 @@ int umount(const enum StorageDevices deviceName)
 
   switch (deviceName)
   {  
+#if !defined(POSIX_STORAGE_NO_SDCARD)
     case DEV_SDCARD:
       deviceFileSystemCombination = &sdcard;
       break;
+#endif
+#if !defined(POSIX_STORAGE_NO_USB)
     case DEV_USB:
       deviceFileSystemCombination = &usb;
       break;
+#endif
     default:
       errno = EINVAL; // This shouldn't happen unless there's a bug in the code
       return -1;
@@ -659,18 +1162,52 @@ int umount(const enum StorageDevices deviceName)
     errno = EINVAL;
     return -1;
   }
+  // Views read through the file system object directly, so it must outlive them
+  if (0 != deviceFileSystemCombination->openViews)
+  {
+    errno = EBUSY;
+    return -1;
+  }
+  // The queued writes must reach their files before the file system goes away. Like close(), a failure
+  // is reported, but doesn't keep the device mounted, because the failed writes can't be retried. It's
+  // kept until the file system has been unmounted, so that it isn't lost if that fails.
+  if (nullptr != deviceFileSystemCombination->writeQueue)
+  {
+    const int stopReturn = deviceFileSystemCombination->writeQueue->stop();
+    if (0 != stopReturn)
+    {
+      deviceFileSystemCombination->queueStopError = stopReturn;
+    }
+    delete deviceFileSystemCombination->writeQueue;
+    deviceFileSystemCombination->writeQueue = nullptr;
+  }
   // See note (1) at the bottom of the file
   const int unmountRet = deviceFileSystemCombination->fileSystem->unmount();
   if (0 == unmountRet)
   {
-    // Ok to delete with base class pointer because the destructor of the base class is virtual
-    delete deviceFileSystemCombination->fileSystem;
-    deviceFileSystemCombination->fileSystem = nullptr;
+#if !defined(POSIX_STORAGE_NO_FAT)
+    // Everything has reached the device by now
+    if (true == deviceFileSystemCombination->markCleanOnUnmount)
+    {
+      (void) FATChecker::markVolumeClean(getMarkDevice(deviceFileSystemCombination));
+      deviceFileSystemCombination->markCleanOnUnmount = false;
+    }
+#endif
+    deleteFileSystem(deviceFileSystemCombination);
     deleteDevice(deviceName, deviceFileSystemCombination);
+    const int queueStopError = deviceFileSystemCombination->queueStopError;
+    deviceFileSystemCombination->queueStopError = 0;
+    if (0 != queueStopError)
+    {
+      errno = queueStopError;
+      return -1;
+    }
     return 0;
   }
   else
   {
+    // The device stays mounted, without its write queue. The next umount() that gets through reports
+    // the failed writes, if any.
     // mbed's mount() returns negative errno codes
     errno = -unmountRet;   // See note (1) at the bottom of the file
     return -1;
@@ -715,6 +1252,622 @@ int deregister_unplug_callback(const enum StorageDevices deviceName)
   return -1;
 }   // End of deregister_unplug_callback()
 
+int set_directory_cache_size(const enum StorageDevices deviceName, const size_t entries)
+{
+#if defined(POSIX_STORAGE_NO_DIRECTORY_CACHE)
+  // Silence -Wunused-parameter, because there is no directory cache to configure
+  (void) deviceName;
+  (void) entries;
+  errno = ENOTSUP;
+  return -1;
+#else
+  struct DeviceFileSystemCombination *deviceFileSystemCombination = nullptr;
+  const int getReturn = getDeviceFileSystemCombination(deviceName, &deviceFileSystemCombination);
+  if (0 != getReturn)
+  {
+    errno = getReturn;
+    return -1;
+  }
+  // Only takes effect on the next mount(), so changing it while mounted would be misleading
+  if (nullptr != deviceFileSystemCombination->fileSystem)
+  {
+    errno = EBUSY;
+    return -1;
+  }
+  deviceFileSystemCombination->directoryCacheEntries = entries;
+  return 0;
+#endif
+}   // End of set_directory_cache_size()
+
+int set_transfer_coalescing(const enum StorageDevices deviceName,
+                            const size_t bufferSize,
+                            const uint32_t windowMicroseconds)
+{
+#if defined(POSIX_STORAGE_NO_COALESCING)
+  // Silence -Wunused-parameter, because there is no transfer coalescing to configure
+  (void) deviceName;
+  (void) bufferSize;
+  (void) windowMicroseconds;
+  errno = ENOTSUP;
+  return -1;
+#else
+  struct DeviceFileSystemCombination *deviceFileSystemCombination = nullptr;
+  const int getReturn = getDeviceFileSystemCombination(deviceName, &deviceFileSystemCombination);
+  if (0 != getReturn)
+  {
+    errno = getReturn;
+    return -1;
+  }
+  // Only takes effect on the next mount(), so changing it while mounted would be misleading
+  if (nullptr != deviceFileSystemCombination->fileSystem)
+  {
+    errno = EBUSY;
+    return -1;
+  }
+  // A window of 0 would pass every program on by itself, which is the same as disabling it. The buffer
+  // is passed on in pieces of the device's read and program sizes, which are 512 bytes for SD Cards and
+  // thumb drives.
+  if ((0 != bufferSize) && ((0 == windowMicroseconds) || (0 != (bufferSize % 512))))
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  deviceFileSystemCombination->coalescingBufferSize = bufferSize;
+  deviceFileSystemCombination->coalescingWindowMicroseconds = windowMicroseconds;
+  return 0;
+#endif
+}   // End of set_transfer_coalescing()
+
+int set_fault_injection(const enum StorageDevices deviceName, const struct FaultInjectionSettings * const settings)
+{
+#if defined(POSIX_STORAGE_NO_FAULT_INJECTION)
+  // Silence -Wunused-parameter, because there is no fault injection to configure
+  (void) deviceName;
+  (void) settings;
+  errno = ENOTSUP;
+  return -1;
+#else
+  struct DeviceFileSystemCombination *deviceFileSystemCombination = nullptr;
+  const int getReturn = getDeviceFileSystemCombination(deviceName, &deviceFileSystemCombination);
+  if (0 != getReturn)
+  {
+    errno = getReturn;
+    return -1;
+  }
+  // Only takes effect on the next mount(), so changing it while mounted would be misleading
+  if (nullptr != deviceFileSystemCombination->fileSystem)
+  {
+    errno = EBUSY;
+    return -1;
+  }
+  if (nullptr == settings)
+  {
+    // The counters stay, so that they can be read after the device has been "plugged in" again
+    deviceFileSystemCombination->injectFaults = false;
+    return 0;
+  }
+  deviceFileSystemCombination->injectFaults = true;
+  deviceFileSystemCombination->faultSettings = *settings;
+  deviceFileSystemCombination->faultStatistics = {};
+  return 0;
+#endif
+}   // End of set_fault_injection()
+
+int fault_injection_statistics(const enum StorageDevices deviceName, struct FaultInjectionStatistics * const statistics)
+{
+#if defined(POSIX_STORAGE_NO_FAULT_INJECTION)
+  // Silence -Wunused-parameter, because there are no fault injection counters to read
+  (void) deviceName;
+  (void) statistics;
+  errno = ENOTSUP;
+  return -1;
+#else
+  struct DeviceFileSystemCombination *deviceFileSystemCombination = nullptr;
+  const int getReturn = getDeviceFileSystemCombination(deviceName, &deviceFileSystemCombination);
+  if (0 != getReturn)
+  {
+    errno = getReturn;
+    return -1;
+  }
+  if (nullptr == statistics)
+  {
+    errno = EFAULT;
+    return -1;
+  }
+  *statistics = deviceFileSystemCombination->faultStatistics;
+  return 0;
+#endif
+}   // End of fault_injection_statistics()
+
+int set_trace(const enum StorageDevices deviceName, const struct TraceSettings * const settings)
+{
+#if defined(POSIX_STORAGE_NO_TRACE)
+  // Silence -Wunused-parameter, because there is no tracing to configure
+  (void) deviceName;
+  (void) settings;
+  errno = ENOTSUP;
+  return -1;
+#else
+  struct DeviceFileSystemCombination *deviceFileSystemCombination = nullptr;
+  const int getReturn = getDeviceFileSystemCombination(deviceName, &deviceFileSystemCombination);
+  if (0 != getReturn)
+  {
+    errno = getReturn;
+    return -1;
+  }
+  // The tracing objects of a mounted device record into the ring, so it can't go away under them
+  if (nullptr != deviceFileSystemCombination->fileSystem)
+  {
+    errno = EBUSY;
+    return -1;
+  }
+  if ((nullptr != settings) && ((0 == settings->records) || ((false == settings->blockLevel) && (false == settings->fileLevel))))
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  delete deviceFileSystemCombination->tracer;
+  deviceFileSystemCombination->tracer = nullptr;
+  if (nullptr == settings)
+  {
+    return 0;
+  }
+  deviceFileSystemCombination->tracer = new(std::nothrow) TraceRecorder(*settings);
+  if ((nullptr == deviceFileSystemCombination->tracer) || (false == deviceFileSystemCombination->tracer->isValid()))
+  {
+    delete deviceFileSystemCombination->tracer;
+    deviceFileSystemCombination->tracer = nullptr;
+    errno = ENOMEM;
+    return -1;
+  }
+  return 0;
+#endif
+}   // End of set_trace()
+
+int trace_dump(const enum StorageDevices deviceName, const char * const pathname)
+{
+#if defined(POSIX_STORAGE_NO_TRACE)
+  // Silence -Wunused-parameter, because there is no trace to dump
+  (void) deviceName;
+  (void) pathname;
+  errno = ENOTSUP;
+  return -1;
+#else
+  struct DeviceFileSystemCombination *deviceFileSystemCombination = nullptr;
+  const int getReturn = getDeviceFileSystemCombination(deviceName, &deviceFileSystemCombination);
+  if (0 != getReturn)
+  {
+    errno = getReturn;
+    return -1;
+  }
+  if (nullptr == pathname)
+  {
+    errno = EFAULT;
+    return -1;
+  }
+  if (nullptr == deviceFileSystemCombination->tracer)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  const int dumpReturn = deviceFileSystemCombination->tracer->dump(pathname);
+  if (0 != dumpReturn)
+  {
+    errno = dumpReturn;
+    return -1;
+  }
+  return 0;
+#endif
+}   // End of trace_dump()
+
+int trace_replay(const char * const tracePathname, const enum StorageDevices deviceName, struct TraceReplayReport * const report)
+{
+#if defined(POSIX_STORAGE_NO_TRACE)
+  // Silence -Wunused-parameter, because there is no trace replay
+  (void) tracePathname;
+  (void) deviceName;
+  (void) report;
+  errno = ENOTSUP;
+  return -1;
+#else
+  struct DeviceFileSystemCombination *deviceFileSystemCombination = nullptr;
+  const int getReturn = getDeviceFileSystemCombination(deviceName, &deviceFileSystemCombination);
+  if (0 != getReturn)
+  {
+    errno = getReturn;
+    return -1;
+  }
+  if ((nullptr == tracePathname) || (nullptr == report))
+  {
+    errno = EFAULT;
+    return -1;
+  }
+  // Error if the device isn't mounted
+  if (nullptr == deviceFileSystemCombination->fileSystem)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  TraceReplayer * const replayer = new(std::nothrow) TraceReplayer(deviceFileSystemCombination->fileSystem);
+  if (nullptr == replayer)
+  {
+    errno = ENOMEM;
+    return -1;
+  }
+  // The replay goes through the tracing objects of a traced device, and mustn't end up in its own trace
+  TraceRecorder * const tracer = deviceFileSystemCombination->tracer;
+  if (nullptr != tracer)
+  {
+    tracer->setPaused(true);
+  }
+  const int replayReturn = replayer->run(tracePathname, report);
+  if (nullptr != tracer)
+  {
+    tracer->setPaused(false);
+  }
+  delete replayer;
+  if (0 != replayReturn)
+  {
+    errno = replayReturn;
+    return -1;
+  }
+  return 0;
+#endif
+}   // End of trace_replay()
+
+int storage_trim(const enum StorageDevices deviceName, const size_t maxBytes)
+{
+#if defined(POSIX_STORAGE_NO_TRIM_BATCHING)
+  // Silence -Wunused-parameter, because there are no batched trims to pass on
+  (void) deviceName;
+  (void) maxBytes;
+  errno = ENOTSUP;
+  return -1;
+#else
+  struct DeviceFileSystemCombination *deviceFileSystemCombination = nullptr;
+  const int getReturn = getDeviceFileSystemCombination(deviceName, &deviceFileSystemCombination);
+  if (0 != getReturn)
+  {
+    errno = getReturn;
+    return -1;
+  }
+  // Error if the device isn't mounted
+  if ((nullptr == deviceFileSystemCombination->device) || (nullptr == deviceFileSystemCombination->fileSystem))
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  if (nullptr == deviceFileSystemCombination->trimDevice)
+  {
+    errno = ENOTSUP;
+    return -1;
+  }
+  // Keep the write queue off the device while trimming, the trim table isn't thread safe
+  if (nullptr != deviceFileSystemCombination->writeQueue)
+  {
+    deviceFileSystemCombination->writeQueue->lock();
+  }
+  const int flushReturn = deviceFileSystemCombination->trimDevice->flushTrims(maxBytes);
+  if (nullptr != deviceFileSystemCombination->writeQueue)
+  {
+    deviceFileSystemCombination->writeQueue->unlock();
+  }
+  // The block device layer returns its own error codes, not errno codes
+  if (0 != flushReturn)
+  {
+    errno = EIO;
+    return -1;
+  }
+  return 0;
+#endif
+}   // End of storage_trim()
+
+int fsck(const enum StorageDevices deviceName, const enum FsckModes mode, const uint32_t budgetMicroseconds)
+{
+#if defined(POSIX_STORAGE_NO_FAT)
+  // Silence -Wunused-parameter, because there is nothing to check without FAT support
+  (void) deviceName;
+  (void) mode;
+  (void) budgetMicroseconds;
+  errno = ENOTSUP;
+  return -1;
+#else
+  struct DeviceFileSystemCombination *deviceFileSystemCombination = nullptr;
+  const int getReturn = getDeviceFileSystemCombination(deviceName, &deviceFileSystemCombination);
+  if (0 != getReturn)
+  {
+    errno = getReturn;
+    return -1;
+  }
+  // Repairing under a mounted file system would corrupt it, because FatFs caches the FAT
+  if (nullptr != deviceFileSystemCombination->fileSystem)
+  {
+    errno = EBUSY;
+    return -1;
+  }
+  if (nullptr == deviceFileSystemCombination->checker)
+  {
+    if ((FSCK_AUTO != mode) && (FSCK_FORCE != mode) && (FSCK_CHECK_ONLY != mode))
+    {
+      errno = EINVAL;
+      return -1;
+    }
+    const int openReturn = openDeviceForCheck(deviceName, deviceFileSystemCombination);
+    if (0 != openReturn)
+    {
+      errno = openReturn;
+      return -1;
+    }
+    deviceFileSystemCombination->checker = new(std::nothrow) FATChecker(deviceFileSystemCombination->device, mode);
+    if (nullptr == deviceFileSystemCombination->checker)
+    {
+      closeDeviceAfterCheck(deviceName, deviceFileSystemCombination);
+      errno = ENOMEM;
+      return -1;
+    }
+  }
+  const int stepReturn = deviceFileSystemCombination->checker->step(budgetMicroseconds);
+  deviceFileSystemCombination->checker->getReport(&(deviceFileSystemCombination->fsckReport));
+  deviceFileSystemCombination->hasFsckReport = true;
+  if (EINPROGRESS == stepReturn)
+  {
+    errno = EINPROGRESS;
+    return -1;
+  }
+  closeDeviceAfterCheck(deviceName, deviceFileSystemCombination);
+  if (0 != stepReturn)
+  {
+    errno = stepReturn;
+    return -1;
+  }
+  return 0;
+#endif
+}   // End of fsck()
+
+int fsck_report(const enum StorageDevices deviceName, struct FsckReport * const report)
+{
+  struct DeviceFileSystemCombination *deviceFileSystemCombination = nullptr;
+  const int getReturn = getDeviceFileSystemCombination(deviceName, &deviceFileSystemCombination);
+  if (0 != getReturn)
+  {
+    errno = getReturn;
+    return -1;
+  }
+  if ((nullptr == report) || (false == deviceFileSystemCombination->hasFsckReport))
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  *report = deviceFileSystemCombination->fsckReport;
+  return 0;
+}   // End of fsck_report()
+
+struct FileView *view_open(const char * const pathname, const struct FileViewSettings * const settings)
+{
+  if (nullptr == pathname)
+  {
+    errno = EFAULT;
+    return nullptr;
+  }
+  enum StorageDevices deviceName = DEV_SDCARD;
+  const char *pathInFileSystem = nullptr;
+  const int pathReturn = getDeviceFromPath(pathname, &deviceName, &pathInFileSystem);
+  if (0 != pathReturn)
+  {
+    errno = pathReturn;
+    return nullptr;
+  }
+  struct DeviceFileSystemCombination *deviceFileSystemCombination = nullptr;
+  const int getReturn = getDeviceFileSystemCombination(deviceName, &deviceFileSystemCombination);
+  if (0 != getReturn)
+  {
+    errno = getReturn;
+    return nullptr;
+  }
+  // Error if the device isn't mounted
+  if (nullptr == deviceFileSystemCombination->fileSystem)
+  {
+    errno = ENOENT;
+    return nullptr;
+  }
+  const struct FileViewSettings defaultSettings = {0, 0, 1};
+  FileView * const view = new(std::nothrow) FileView(deviceName, (nullptr != settings) ? *settings : defaultSettings);
+  if (nullptr == view)
+  {
+    errno = ENOMEM;
+    return nullptr;
+  }
+  const int openReturn = view->open(deviceFileSystemCombination->fileSystem, pathInFileSystem);
+  if (0 != openReturn)
+  {
+    delete view;
+    errno = openReturn;
+    return nullptr;
+  }
+  deviceFileSystemCombination->openViews++;
+  return view;
+}   // End of view_open()
+
+const void *view_map(struct FileView * const view, const off_t offset, const size_t length, size_t * const mapped)
+{
+  if ((nullptr == view) || (nullptr == mapped))
+  {
+    errno = EINVAL;
+    return nullptr;
+  }
+  const void *window = nullptr;
+  const int mapReturn = view->map(offset, length, &window, mapped);
+  if (0 != mapReturn)
+  {
+    errno = mapReturn;
+    return nullptr;
+  }
+  return window;
+}   // End of view_map()
+
+off_t view_size(struct FileView * const view)
+{
+  if (nullptr == view)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  return view->size();
+}   // End of view_size()
+
+int view_close(struct FileView * const view)
+{
+  if (nullptr == view)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  struct DeviceFileSystemCombination *deviceFileSystemCombination = nullptr;
+  if (0 == getDeviceFileSystemCombination(view->getDeviceName(), &deviceFileSystemCombination))
+  {
+    deviceFileSystemCombination->openViews--;
+  }
+  const int closeReturn = view->close();
+  delete view;
+  if (0 != closeReturn)
+  {
+    errno = closeReturn;
+    return -1;
+  }
+  return 0;
+}   // End of view_close()
+
+int write_queue_start(const enum StorageDevices deviceName, const struct WriteQueueSettings * const settings)
+{
+  struct DeviceFileSystemCombination *deviceFileSystemCombination = nullptr;
+  const int getReturn = getDeviceFileSystemCombination(deviceName, &deviceFileSystemCombination);
+  if (0 != getReturn)
+  {
+    errno = getReturn;
+    return -1;
+  }
+  if (nullptr == settings)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  // Error if the device isn't mounted
+  if ((nullptr == deviceFileSystemCombination->device) || (nullptr == deviceFileSystemCombination->fileSystem))
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  if (nullptr != deviceFileSystemCombination->writeQueue)
+  {
+    errno = EBUSY;
+    return -1;
+  }
+  WriteQueue * const writeQueue = new(std::nothrow) WriteQueue(*settings);
+  if (nullptr == writeQueue)
+  {
+    errno = ENOMEM;
+    return -1;
+  }
+  const int startReturn = writeQueue->start();
+  if (0 != startReturn)
+  {
+    delete writeQueue;
+    errno = startReturn;
+    return -1;
+  }
+  deviceFileSystemCombination->writeQueue = writeQueue;
+  return 0;
+}   // End of write_queue_start()
+
+int write_queue_stop(const enum StorageDevices deviceName)
+{
+  struct DeviceFileSystemCombination *deviceFileSystemCombination = nullptr;
+  const int getReturn = getDeviceFileSystemCombination(deviceName, &deviceFileSystemCombination);
+  if (0 != getReturn)
+  {
+    errno = getReturn;
+    return -1;
+  }
+  if (nullptr == deviceFileSystemCombination->writeQueue)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  const int stopReturn = deviceFileSystemCombination->writeQueue->stop();
+  delete deviceFileSystemCombination->writeQueue;
+  deviceFileSystemCombination->writeQueue = nullptr;
+  if (0 != stopReturn)
+  {
+    errno = stopReturn;
+    return -1;
+  }
+  return 0;
+}   // End of write_queue_stop()
+
+ssize_t queued_write(const enum StorageDevices deviceName, const int fd, const void * const buf, const size_t count)
+{
+  struct DeviceFileSystemCombination *deviceFileSystemCombination = nullptr;
+  const int getReturn = getDeviceFileSystemCombination(deviceName, &deviceFileSystemCombination);
+  if (0 != getReturn)
+  {
+    errno = getReturn;
+    return -1;
+  }
+  if (nullptr == deviceFileSystemCombination->writeQueue)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  const int enqueueReturn = deviceFileSystemCombination->writeQueue->enqueue(fd, buf, count);
+  if (0 != enqueueReturn)
+  {
+    errno = enqueueReturn;
+    return -1;
+  }
+  return static_cast<ssize_t>(count);
+}   // End of queued_write()
+
+int write_queue_service(const enum StorageDevices deviceName, const uint32_t budgetMicroseconds)
+{
+  struct DeviceFileSystemCombination *deviceFileSystemCombination = nullptr;
+  const int getReturn = getDeviceFileSystemCombination(deviceName, &deviceFileSystemCombination);
+  if (0 != getReturn)
+  {
+    errno = getReturn;
+    return -1;
+  }
+  if (nullptr == deviceFileSystemCombination->writeQueue)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  const int serviceReturn = deviceFileSystemCombination->writeQueue->service(budgetMicroseconds);
+  if (0 != serviceReturn)
+  {
+    errno = serviceReturn;
+    return -1;
+  }
+  return 0;
+}   // End of write_queue_service()
+
+int write_queue_statistics(const enum StorageDevices deviceName, struct WriteQueueStatistics * const statistics)
+{
+  struct DeviceFileSystemCombination *deviceFileSystemCombination = nullptr;
+  const int getReturn = getDeviceFileSystemCombination(deviceName, &deviceFileSystemCombination);
+  if (0 != getReturn)
+  {
+    errno = getReturn;
+    return -1;
+  }
+  if ((nullptr == deviceFileSystemCombination->writeQueue) || (nullptr == statistics))
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  deviceFileSystemCombination->writeQueue->getStatistics(statistics);
+  return 0;
+}   // End of write_queue_statistics()
+
 /*
 *********************************************************************************************************
 *                                                Notes
@@ -51,6 +51,47 @@
 #ifndef Arduino_POSIXStorage_H
 #define Arduino_POSIXStorage_H
 
+/*
+*********************************************************************************************************
+*                                       Compile-time configuration
+*********************************************************************************************************
+*/
+
+// Firmware that only uses some of the storage devices and file systems can leave the others out of
+// the library, and with them the drivers and file system code they pull in from the core. Define any
+// of these in the build flags, because the library is compiled separately from the sketch:
+//
+//   POSIX_STORAGE_NO_SDCARD     DEV_SDCARD fails with ENOTBLK
+//   POSIX_STORAGE_NO_USB        DEV_USB fails with ENOTBLK
+//   POSIX_STORAGE_NO_FAT        FS_FAT fails with ENOTSUP, and so does fsck()
+//   POSIX_STORAGE_NO_LITTLEFS   FS_LITTLEFS fails with ENOTSUP
+//
+// The optional layers that mount() can insert above the device or around the file system can be left
+// out the same way. Their setters then fail with ENOTSUP:
+//
+//   POSIX_STORAGE_NO_DIRECTORY_CACHE   set_directory_cache_size()
+//   POSIX_STORAGE_NO_TRIM_BATCHING     storage_trim()
+//   POSIX_STORAGE_NO_COALESCING        set_transfer_coalescing()
+//   POSIX_STORAGE_NO_FAULT_INJECTION   set_fault_injection() and fault_injection_statistics()
+//   POSIX_STORAGE_NO_TRACE             set_trace(), trace_dump(), and trace_replay()
+//
+// Fault injection and tracing are test tools, so they are left out unless POSIX_STORAGE_FAULT_INJECTION
+// or POSIX_STORAGE_TRACE is defined.
+
+#if !defined(POSIX_STORAGE_FAULT_INJECTION) && !defined(POSIX_STORAGE_NO_FAULT_INJECTION)
+  #define POSIX_STORAGE_NO_FAULT_INJECTION
+#endif
+#if !defined(POSIX_STORAGE_TRACE) && !defined(POSIX_STORAGE_NO_TRACE)
+  #define POSIX_STORAGE_NO_TRACE
+#endif
+
+#if defined(POSIX_STORAGE_NO_SDCARD) && defined(POSIX_STORAGE_NO_USB)
+  #error "POSIX_STORAGE_NO_SDCARD and POSIX_STORAGE_NO_USB leave no storage device to use"
+#endif
+#if defined(POSIX_STORAGE_NO_FAT) && defined(POSIX_STORAGE_NO_LITTLEFS)
+  #error "POSIX_STORAGE_NO_FAT and POSIX_STORAGE_NO_LITTLEFS leave no file system to use"
+#endif
+
 /*
 *********************************************************************************************************
 *                            Included header files to be exposed to the sketch
@@ -63,8 +104,12 @@
   #include <mbed.h>
 #endif
 
-#include <FATFileSystem.h>
-#include <LittleFileSystem.h>
+#if !defined(POSIX_STORAGE_NO_FAT)
+  #include <FATFileSystem.h>
+#endif
+#if !defined(POSIX_STORAGE_NO_LITTLEFS)
+  #include <LittleFileSystem.h>
+#endif
 
 // <--
 
@@ -77,8 +122,12 @@
 // These are necessary to expose to the sketch to get the retargeting from mbed -->
 
 #if defined(ARDUINO_PORTENTA_H7_M7) || defined(ARDUINO_OPTA)
-  using mbed::FATFileSystem;
-  using mbed::LittleFileSystem;
+  #if !defined(POSIX_STORAGE_NO_FAT)
+    using mbed::FATFileSystem;
+  #endif
+  #if !defined(POSIX_STORAGE_NO_LITTLEFS)
+    using mbed::LittleFileSystem;
+  #endif
 #endif
 
 // <--
@@ -110,6 +159,170 @@ enum MountFlags : uint8_t
   MNT_RDONLY   ///< Read only mode
 };
 
+/// @brief Enum to select what fsck() does.
+enum FsckModes : uint8_t
+{
+  FSCK_AUTO,       ///< Check and repair, unless the volume was cleanly unmounted
+  FSCK_FORCE,      ///< Check and repair, even if the volume was cleanly unmounted
+  FSCK_CHECK_ONLY  ///< Check and report, but don't change anything
+};
+
+/// @brief Enum to select what queued_write() does when the write queue is full.
+enum QueueFullPolicies : uint8_t
+{
+  QUEUE_DROP,  ///< Reject the write at once
+  QUEUE_BLOCK  ///< Wait for room, up to the block timeout
+};
+
+/// @brief Operations in a trace from set_trace(). Block operations are numbered from 0 and file operations from 16.
+enum TraceOperations : uint8_t
+{
+  TRACE_BLOCK_READ     = 0,   ///< The file system read from the device
+  TRACE_BLOCK_PROGRAM  = 1,   ///< The file system programmed the device
+  TRACE_BLOCK_ERASE    = 2,   ///< The file system erased part of the device
+  TRACE_BLOCK_TRIM     = 3,   ///< The file system told the device that part of it is free
+  TRACE_BLOCK_SYNC     = 4,   ///< The file system synced the device
+  TRACE_FILE_OPEN      = 16,  ///< A file was opened, the size is the open flags
+  TRACE_FILE_CLOSE     = 17,  ///< A file was closed
+  TRACE_FILE_READ      = 18,  ///< A file was read at the offset
+  TRACE_FILE_WRITE     = 19,  ///< A file was written at the offset
+  TRACE_FILE_SYNC      = 20,  ///< A file was flushed to the device
+  TRACE_FILE_TRUNCATE  = 21,  ///< A file was truncated or extended to the offset
+  TRACE_FILE_REMOVE    = 22,  ///< A file or directory was removed
+  TRACE_FILE_RENAME    = 23,  ///< A file or directory was renamed, the offset is the number of the new path
+  TRACE_FILE_MKDIR     = 24,  ///< A directory was created, the size is the mode
+  TRACE_FILE_STAT      = 25   ///< A file or directory was looked up with stat()
+};
+
+/*
+*********************************************************************************************************
+*                              Data structures to be exposed to the sketch
+*********************************************************************************************************
+*/
+
+/// @brief LittleFS geometry for mount() and mkfs(). Members set to 0 are derived from the device.
+struct LittleFSGeometry
+{
+  uint32_t readSize;      ///< Read size (and read cache size) in bytes, a multiple of the device read size. Default: 512 bytes.
+  uint32_t programSize;   ///< Program size (and program cache size) in bytes, a multiple of the device program size. Default: 512 bytes.
+  uint32_t blockSize;     ///< Block size in bytes, a multiple of the device erase size. Must be the same for mount() as for mkfs(). Default: 512 bytes.
+  uint32_t lookaheadSize; ///< Number of blocks tracked by the free block lookahead, a multiple of 32. Uses lookaheadSize / 8 bytes of RAM. Default: 8192.
+};
+
+/// @brief Results of fsck(), returned by fsck_report(). The counters are for problems found, and repaired unless the mode is FSCK_CHECK_ONLY.
+struct FsckReport
+{
+  bool wasClean;            ///< The volume was cleanly unmounted the last time it was mounted
+  bool checked;             ///< The volume was checked, false if FSCK_AUTO skipped a clean volume
+  bool repaired;            ///< Problems were found and repaired
+  uint8_t progressPercent;  ///< Rough progress of the check, 100 when done. Starts over when a repaired cross-link makes the check run again.
+  uint32_t lostChains;      ///< Chains of allocated clusters that no file or directory uses
+  uint32_t lostClusters;    ///< Clusters in those chains, freed by a repair
+  uint32_t crossLinks;      ///< Clusters used by two files or directories, or twice by one. The one found second is truncated.
+  uint32_t brokenChains;    ///< Cluster chains that run into a free or invalid cluster, terminated where they break
+  uint32_t badEntries;      ///< Directory entries with an invalid first cluster or a size larger than their chain
+};
+
+/// @brief Faults to inject with set_fault_injection(). Members set to 0 inject nothing.
+struct FaultInjectionSettings
+{
+  uint32_t latencyMicroseconds;         ///< Added to every read, program, erase, and trim.
+  uint32_t latencyJitterMicroseconds;   ///< Up to this much more is added on top, uniformly distributed.
+  uint16_t stallPermille;               ///< Operations per thousand that stall, like a card that is busy with garbage collection.
+  uint32_t stallMicroseconds;           ///< Added to an operation that stalls.
+  uint16_t readErrorPermille;           ///< Reads per thousand that fail. Retrying a failed read can succeed.
+  uint16_t programErrorPermille;        ///< Programs per thousand that fail without changing the device. Retrying a failed program can succeed.
+  uint64_t badStart;                    ///< First byte address of a region where every read, program, erase, and trim fails.
+  uint64_t badSize;                     ///< Size of that region in bytes.
+  uint32_t removeAfterOperations;       ///< Every operation after this many fails, as if the device had been pulled out.
+  uint32_t seed;                        ///< Seed for the random faults and delays, so that a failing run can be repeated.
+};
+
+/// @brief Statistics returned by fault_injection_statistics(). The counters run from the set_fault_injection() call that enabled injection.
+struct FaultInjectionStatistics
+{
+  uint32_t operations;            ///< Reads, programs, erases, and trims that were passed through the fault injection
+  uint32_t stalls;                ///< Operations that stalled
+  uint32_t transientErrors;       ///< Reads and programs that failed at random
+  uint32_t permanentErrors;       ///< Operations that failed in the bad region
+  uint32_t removedErrors;         ///< Calls that failed because the device had been removed
+  uint64_t delayedMicroseconds;   ///< Total injected latency
+  bool removed;                   ///< The device counts as removed, until injection is set again
+};
+
+/// @brief Settings for set_trace().
+struct TraceSettings
+{
+  size_t records;     ///< Records that the RAM ring holds, 32 bytes each. When it's full, the oldest records are overwritten.
+  bool blockLevel;    ///< Record the reads, programs, erases, trims, and syncs that the file system sends to the device.
+  bool fileLevel;     ///< Record the opens, closes, reads, writes, syncs, and truncates of files, and removes, renames, mkdir() calls, and stat() calls. Numbering the paths takes 4 KB more.
+};
+
+/// @brief One operation in a trace. Trace files written by trace_dump() are a TraceFileHeader followed by these, little-endian.
+struct TraceRecord
+{
+  uint32_t timestampMicroseconds;   ///< micros() when the operation started
+  uint32_t durationMicroseconds;    ///< How long the operation took
+  uint64_t offset;                  ///< Byte address on the device, or offset in the file
+  uint32_t size;                    ///< Bytes requested, or the flags for TRACE_FILE_OPEN
+  int32_t result;                   ///< Bytes transferred for file reads and writes, otherwise 0 for success. Negative on failure.
+  uint8_t operation;                ///< One of the TraceOperations
+  uint8_t reserved[3];              ///< Always 0
+  uint32_t file;                    ///< Number of the path, from 1 in the order the paths were first used successfully. 0 for block operations, and for paths without a number.
+};
+
+/// @brief The start of a trace file written by trace_dump().
+struct TraceFileHeader
+{
+  char magic[4];                    ///< Always "PSTR"
+  uint16_t version;                 ///< Always 2
+  uint16_t recordSize;              ///< Size of a TraceRecord in bytes, 32
+  uint32_t records;                 ///< Records that follow the header
+  uint32_t overwrittenRecords;      ///< Older records that were lost because the ring was full
+  uint32_t files;                   ///< Paths that were numbered, so no record has a higher file number
+  uint32_t droppedRecords;          ///< Operations that weren't recorded because the paths they used couldn't be numbered any more
+};
+
+/// @brief Results of trace_replay().
+struct TraceReplayReport
+{
+  uint32_t replayedOperations;      ///< File operations that were replayed
+  uint32_t failedOperations;        ///< Replayed operations that failed although they succeeded in the trace, or transferred fewer bytes
+  uint32_t skippedRecords;          ///< Block operations, operations on paths without a number, and operations on files that weren't open
+  uint32_t recordedMicroseconds;    ///< Time from the first to the end of the last replayed operation in the trace
+  uint32_t elapsedMicroseconds;     ///< Time the replay took
+};
+
+/// @brief Settings for view_open(). Members set to 0 get the default, except prefetchPages.
+struct FileViewSettings
+{
+  size_t pageSize;        ///< Bytes per cache page, and the largest window view_map() returns. A multiple of 512 is best. Default: 512 bytes.
+  size_t pageCount;       ///< Number of cache pages, at least 2. Default: 8.
+  size_t prefetchPages;   ///< Pages to read ahead after a page that wasn't cached, less than pageCount. 0 disables read ahead.
+};
+
+/// @brief Settings for write_queue_start().
+struct WriteQueueSettings
+{
+  size_t bufferSize;                    ///< Size of the preallocated queue in bytes. Every queued write uses 12 bytes of it on top of its data.
+  uint32_t deadlineMicroseconds;        ///< A write that reaches the file later than this after it was queued counts as a deadline overrun. 0 disables the check.
+  enum QueueFullPolicies fullPolicy;    ///< What queued_write() does when there is no room for a write: QUEUE_DROP or QUEUE_BLOCK.
+  uint32_t blockTimeoutMicroseconds;    ///< The longest time queued_write() waits for room with QUEUE_BLOCK. On the Portenta C33, queued_write() makes room by writing the oldest queued writes itself, so it can take one such write longer than this.
+};
+
+/// @brief Statistics returned by write_queue_statistics(). The counters run from write_queue_start().
+struct WriteQueueStatistics
+{
+  uint32_t queuedWrites;            ///< Writes accepted into the queue
+  uint32_t completedWrites;         ///< Queued writes that reached their file
+  uint32_t droppedWrites;           ///< Writes rejected because the queue was full
+  uint32_t failedWrites;            ///< Queued writes for which write() failed
+  uint32_t deadlineOverruns;        ///< Queued writes that reached their file after the deadline
+  uint32_t maxLatencyMicroseconds;  ///< Longest time from queueing a write to it reaching its file
+  uint32_t highWaterMark;           ///< Most bytes of the queue ever in use at once
+  uint32_t queuedBytes;             ///< Bytes of the queue in use right now
+};
+
 /*
 *********************************************************************************************************
 *                     Non-retargeted storage functions to be exposed to the sketch
@@ -127,10 +340,23 @@ int mount(const enum StorageDevices deviceName,
           const enum FileSystems fileSystem,
           const enum MountFlags mountFlags);
 
+/**
+* @brief Attach a file system to a device, with a specific LittleFS geometry.
+* @param deviceName The device to attach to: DEV_SDCARD or DEV_USB.
+* @param fileSystem The file system type to attach: FS_LITTLEFS, or FS_FAT if geometry is nullptr.
+* @param mountFlags The only valid flag at this time: MNT_DEFAULT.
+* @param geometry The LittleFS geometry, or nullptr to derive it from the device.
+* @return On success: 0. On failure: -1 with an error code in the errno variable.
+*/
+int mount(const enum StorageDevices deviceName,
+          const enum FileSystems fileSystem,
+          const enum MountFlags mountFlags,
+          const struct LittleFSGeometry *geometry);
+
 /**
 * @brief Remove the attached file system from a device.
 * @param deviceName The device to remove from: DEV_SDCARD or DEV_USB.
-* @return On success: 0. On failure: -1 with an error code in the errno variable.
+* @return On success: 0. On failure: -1 with an error code in the errno variable. EIO means that writes still in the write queue failed, and the device was unmounted nonetheless. With any other error the device stays mounted, its write queue is stopped anyway, and a failure of the queued writes is reported by the next umount() that succeeds.
 */
 int umount(const enum StorageDevices deviceName);
 
@@ -172,4 +398,252 @@ int deregister_unplug_callback(const enum StorageDevices deviceName);
 */
 int mkfs(const enum StorageDevices deviceName, const enum FileSystems fileSystem);
 
+/**
+* @brief Format a device (make file system), with a specific LittleFS geometry.
+* @param deviceName The device to format: DEV_SDCARD or DEV_USB.
+* @param fileSystem The file system type to format: FS_LITTLEFS, or FS_FAT if geometry is nullptr.
+* @param geometry The LittleFS geometry, or nullptr to derive it from the device. Mount with the same block size.
+* @return On success: 0. On failure: -1 with an error code in the errno variable.
+*/
+int mkfs(const enum StorageDevices deviceName,
+         const enum FileSystems fileSystem,
+         const struct LittleFSGeometry *geometry);
+
+/**
+* @brief Set the number of entries in the directory entry cache that the next mount() of a device uses. The cache remembers the results of earlier path lookups, so that stat() and opening missing files don't have to scan the directories on the device again. It's dropped by umount(). Each entry uses 24 bytes of heap memory.
+* @param deviceName The device to set the cache size for: DEV_SDCARD or DEV_USB.
+* @param entries The number of cache entries, or 0 (default) to disable the cache.
+* @return On success: 0. On failure: -1 with an error code in the errno variable.
+*/
+int set_directory_cache_size(const enum StorageDevices deviceName, const size_t entries);
+
+/**
+* @brief Set how the next mount() of a device merges runs of adjacent sector reads and writes into larger transfers. Writes to consecutive sectors are collected in a buffer and written together when the run is broken, the buffer is full, a write comes after the window has passed, or a file is flushed or closed. There is no timer, so a run stays in RAM until one of those happens or the device is unmounted, and is lost if the device is removed before that. Reads that continue where the previous read ended read a full buffer ahead. Uses 2 * bufferSize bytes of heap memory while mounted. How much this gains depends on whether the device driver turns a large transfer into one multi-sector command. Disabled by default.
+* @param deviceName The device to set coalescing for: DEV_SDCARD or DEV_USB.
+* @param bufferSize The largest transfer in bytes, a multiple of 512, or 0 to disable coalescing. mount() fails with EINVAL if it isn't also a multiple of the device's read and program sizes.
+* @param windowMicroseconds A write that comes later than this after the first write of a run starts a new run, which bounds how long a run can keep growing, not how long it stays buffered. Must not be 0 unless bufferSize is 0.
+* @return On success: 0. On failure: -1 with an error code in the errno variable.
+*/
+int set_transfer_coalescing(const enum StorageDevices deviceName,
+                            const size_t bufferSize,
+                            const uint32_t windowMicroseconds);
+
+/**
+* @brief Set faults for the next mount() of a device to run into, for stress testing. A block device inserted right above the device delays operations and makes them fail, like a slow, worn out, or removed device would. The counters and the removal carry over from one mount to the next, and fsck() reads the device directly, without the faults. Unplug callbacks aren't called when the device counts as removed.
+* @param deviceName The device to inject faults for: DEV_SDCARD or DEV_USB.
+* @param settings The faults to inject, or nullptr to stop injecting them. Passing settings resets the counters and the removal.
+* @return On success: 0. On failure: -1 with an error code in the errno variable.
+*/
+int set_fault_injection(const enum StorageDevices deviceName, const struct FaultInjectionSettings *settings);
+
+/**
+* @brief Get the counters of the fault injection for a device. They are kept when injection is stopped, until it is set again.
+* @param deviceName The device to get the counters for: DEV_SDCARD or DEV_USB.
+* @param statistics The structure to fill in.
+* @return On success: 0. On failure: -1 with an error code in the errno variable.
+*/
+int fault_injection_statistics(const enum StorageDevices deviceName, struct FaultInjectionStatistics *statistics);
+
+/**
+* @brief Record the operations on a device from its next mount() into a ring in RAM, for example to replay a production workload with trace_replay() against different settings. The trace and its ring carry over from one mount to the next. Tracing adds a micros() call and a 32 byte copy to every operation.
+* @param deviceName The device to trace: DEV_SDCARD or DEV_USB.
+* @param settings The ring size and what to record, or nullptr to stop tracing and free the ring. Passing settings starts a new, empty trace.
+* @return On success: 0. On failure: -1 with an error code in the errno variable.
+*/
+int set_trace(const enum StorageDevices deviceName, const struct TraceSettings *settings);
+
+/**
+* @brief Write the records in the ring of a device to a file, oldest first. The ring isn't cleared, and the dump itself isn't recorded, even if the file is on the traced device.
+* @param deviceName The traced device.
+* @param pathname The file to write, for example "/sdcard/trace.bin".
+* @return On success: 0. On failure: -1 with an error code in the errno variable.
+*/
+int trace_dump(const enum StorageDevices deviceName, const char *pathname);
+
+/**
+* @brief Replay the file operations of a trace file as fast as possible on a mounted device. Each traced path is replayed as a file or directory named after its number in a "replay" directory, with data of the traced sizes at the traced offsets, and removes, renames, mkdir() calls, and stat() calls on the same numbers. Everything is removed afterwards. Before the timing starts, the paths that the trace uses before creating them are created, and filled with as much data as the trace reads from them. Block operations are skipped, because replaying them would overwrite the file system. If the device is being traced, nothing is recorded while the replay runs.
+* @param tracePathname The trace file from trace_dump().
+* @param deviceName The device to replay on, mounted with the file system and settings to try.
+* @param report The structure to fill in with the results.
+* @return On success: 0, even if some replayed operations failed. On failure: -1 with an error code in the errno variable.
+*/
+int trace_replay(const char *tracePathname, const enum StorageDevices deviceName, struct TraceReplayReport *report);
+
+// Bytes of heap memory for the cluster bitmap of fsck(). Volumes with more than (8 * FSCK_BITMAP_SIZE)
+// clusters are checked in several passes, which takes longer.
+#if !defined(FSCK_BITMAP_SIZE)
+  #define FSCK_BITMAP_SIZE 8192
+#endif
+
+/**
+* @brief Check and repair the FAT16 or FAT32 volume on a device that isn't mounted, for example after a power loss. Call it repeatedly until it doesn't fail with EINPROGRESS, and mount() afterwards. mount() marks a FAT volume as in use and umount() marks it as cleanly unmounted again, so with FSCK_AUTO a volume that was cleanly unmounted is skipped after just reading one sector. Repairs free lost cluster chains, truncate cross-linked and broken chains, and cut file sizes down to what their chains hold. Files can lose data at the end, but the volume doesn't have to be formatted.
+* @param deviceName The device to check: DEV_SDCARD or DEV_USB.
+* @param mode FSCK_AUTO, FSCK_FORCE, or FSCK_CHECK_ONLY. Only the mode of the first call of a check is used.
+* @param budgetMicroseconds Return after about this long, to keep other work going while the check runs. 0 means until done.
+* @return On success: 0 when done. -1 with EINPROGRESS in the errno variable if there is more to do. On failure: -1 with another error code in the errno variable, ENOTSUP if the device doesn't hold a FAT16 or FAT32 volume.
+*/
+int fsck(const enum StorageDevices deviceName, const enum FsckModes mode, const uint32_t budgetMicroseconds);
+
+/**
+* @brief Get the results of the last (or the running) fsck() of a device.
+* @param deviceName The device to get the results for: DEV_SDCARD or DEV_USB.
+* @param report The structure to fill in.
+* @return On success: 0. On failure: -1 with an error code in the errno variable.
+*/
+int fsck_report(const enum StorageDevices deviceName, struct FsckReport *report);
+
+/**
+* @brief Tell the device which of its blocks the file system has freed. Freed ranges are collected while the device is mounted, and passed on by this function, when too many have been collected, and by umount(). Call it when the application is idle to keep the garbage collection of the card ahead of the writes. Only supported for DEV_SDCARD.
+* @param deviceName The device to trim: DEV_SDCARD.
+* @param maxBytes Stop after about this many bytes have been trimmed, to limit the time spent. 0 trims everything collected so far.
+* @return On success: 0. On failure: -1 with an error code in the errno variable.
+*/
+int storage_trim(const enum StorageDevices deviceName, const size_t maxBytes);
+
+/**
+* @brief Start the write queue of a mounted device. queued_write() then copies data into a queue that is allocated here, in a time that only depends on the size of the data, and the queue is written to the files in the background. On the Portenta H7 and Opta a thread of its own does this, and the sketch may keep using files on the device meanwhile, but must not use a file descriptor with queued writes until they have reached the file. The other functions of this library must still be called from one thread only. On the Portenta C33 the sketch has to call write_queue_service() regularly. umount() writes what is left and stops the queue, and fails with EIO if any of those writes failed, although the device is unmounted anyway.
+* @param deviceName The device to start the queue for: DEV_SDCARD or DEV_USB.
+* @param settings The queue size, deadline, and policy for a full queue.
+* @return On success: 0. On failure: -1 with an error code in the errno variable.
+*/
+int write_queue_start(const enum StorageDevices deviceName, const struct WriteQueueSettings *settings);
+
+/**
+* @brief Write everything that is still queued and stop the write queue of a device.
+* @param deviceName The device to stop the queue for: DEV_SDCARD or DEV_USB.
+* @return On success: 0. On failure: -1 with an error code in the errno variable, EIO if some of the queued writes failed. The queue is stopped in either case.
+*/
+int write_queue_stop(const enum StorageDevices deviceName);
+
+/**
+* @brief Queue a write to a file on a device. The file descriptor must stay open until the write has reached the file, for example until write_queue_service() or write_queue_stop() returns 0. Errors from the write itself are only counted in the statistics.
+* @param deviceName The device the file is on: DEV_SDCARD or DEV_USB.
+* @param fd The file descriptor from open(), or from fileno() of a stream.
+* @param buf The data to write. It's copied, so the buffer can be reused at once.
+* @param count The number of bytes to write.
+* @return On success: count. On failure: -1 with an error code in the errno variable, EAGAIN or ETIMEDOUT if the queue was full.
+*/
+ssize_t queued_write(const enum StorageDevices deviceName, const int fd, const void *buf, const size_t count);
+
+/**
+* @brief Give the write queue of a device time to reach the files. On the Portenta C33 this does the writing, on the other boards it waits for the queue thread.
+* @param deviceName The device to service: DEV_SDCARD or DEV_USB.
+* @param budgetMicroseconds Return after about this long. The write in progress is finished first, so this can be exceeded by one write. 0 means until the queue is empty.
+* @return On success: 0 if the queue is empty. -1 with EINPROGRESS in the errno variable if it isn't yet. On failure: -1 with another error code in the errno variable.
+*/
+int write_queue_service(const enum StorageDevices deviceName, const uint32_t budgetMicroseconds);
+
+/**
+* @brief Get the counters of the write queue of a device.
+* @param deviceName The device to get the counters for: DEV_SDCARD or DEV_USB.
+* @param statistics The structure to fill in.
+* @return On success: 0. On failure: -1 with an error code in the errno variable.
+*/
+int write_queue_statistics(const enum StorageDevices deviceName, struct WriteQueueStatistics *statistics);
+
+/*
+*********************************************************************************************************
+*                                 Read-only file views to be exposed to the sketch
+*********************************************************************************************************
+*/
+
+/// @brief Opaque handle to a file opened with view_open().
+struct FileView;
+
+/**
+* @brief Open a file for random access through a cache of its pages. The file is read through the file system object of the mounted device directly, not through stdio. The file must not be written while the view is open, and the device can't be unmounted until every view on it is closed.
+* @param pathname The file to open, for example "/sdcard/data.bin" or "/usb/data.bin".
+* @param settings The page size, number of pages, and read ahead, or nullptr for the defaults (8 pages of 512 bytes, reading 1 page ahead).
+* @return On success: a handle to the view. On failure: nullptr with an error code in the errno variable.
+*/
+struct FileView *view_open(const char *pathname, const struct FileViewSettings *settings);
+
+/**
+* @brief Get a pointer to a window of the file. The data stays valid until the next view_map() or view_close() of the same view.
+* @param view The view handle.
+* @param offset The offset in the file of the first byte, less than the file size.
+* @param length The number of bytes, at most the page size.
+* @param mapped Set to the number of bytes available in the window, which is less than length only at the end of the file.
+* @return On success: a pointer to the data. On failure: nullptr with an error code in the errno variable.
+*/
+const void *view_map(struct FileView *view, off_t offset, size_t length, size_t *mapped);
+
+/**
+* @brief Get the size of the file, as it was when the view was opened.
+* @param view The view handle.
+* @return On success: the size in bytes. On failure: -1 with an error code in the errno variable.
+*/
+off_t view_size(struct FileView *view);
+
+/**
+* @brief Close a view and free its cache. The handle is invalid afterwards, even on failure.
+* @param view The view handle.
+* @return On success: 0. On failure: -1 with an error code in the errno variable.
+*/
+int view_close(struct FileView *view);
+
+/*
+*********************************************************************************************************
+*                              Compression stage to be exposed to the sketch
+*********************************************************************************************************
+*/
+
+// Number of uncompressed bytes per frame. Every open compressed file uses roughly
+// (2 * COMPRESSION_BLOCK_SIZE + 2 KB) of heap memory. Must not be larger than 32767.
+#if !defined(COMPRESSION_BLOCK_SIZE)
+  #define COMPRESSION_BLOCK_SIZE 2048
+#endif
+
+/// @brief Opaque handle to a file opened through the compression stage.
+struct CompressedFile;
+
+/**
+* @brief Open a file through the compression stage. Data is stored as independent compressed frames, so a file that was cut short by a power loss is readable up to the last complete frame.
+* @param pathname The file to open, for example "/sdcard/log.csv.psz" or "/usb/log.csv.psz".
+* @param mode "r" to read, "w" to create or truncate, or "a" to append after the last complete frame.
+* @return On success: a handle to the file. On failure: nullptr with an error code in the errno variable.
+*/
+struct CompressedFile *compressed_fopen(const char *pathname, const char *mode);
+
+/**
+* @brief Write to a file opened for writing or appending with compressed_fopen(). Data is buffered until a full frame has been collected.
+* @param ptr The data to write.
+* @param size The size of each element.
+* @param nmemb The number of elements.
+* @param stream The file handle.
+* @return The number of elements accepted. On failure: fewer than nmemb with an error code in the errno variable. Once a frame couldn't be written, the data buffered for it is lost and every later write fails, see compressed_ferror().
+*/
+size_t compressed_fwrite(const void *ptr, size_t size, size_t nmemb, struct CompressedFile *stream);
+
+/**
+* @brief Read from a file opened for reading with compressed_fopen(). Reading stops at the first incomplete or damaged frame.
+* @param ptr The buffer to read into.
+* @param size The size of each element.
+* @param nmemb The number of elements.
+* @param stream The file handle.
+* @return The number of elements read.
+*/
+size_t compressed_fread(void *ptr, size_t size, size_t nmemb, struct CompressedFile *stream);
+
+/**
+* @brief Write any buffered data as a (possibly short) frame, flush it to the file, and sync the file to the device, so that the frames written so far survive a power loss.
+* @param stream The file handle.
+* @return On success: 0. On failure: -1 with an error code in the errno variable.
+*/
+int compressed_fflush(struct CompressedFile *stream);
+
+/**
+* @brief Check whether a frame couldn't be written, or the file had a read or write error. Like ferror(), the error stays until the file is closed, and compressed_fclose() fails as well.
+* @param stream The file handle.
+* @return 0 if there was no error, 1 if there was. On failure: -1 with an error code in the errno variable.
+*/
+int compressed_ferror(struct CompressedFile *stream);
+
+/**
+* @brief Write any buffered data as a final frame and close the file. The handle is invalid afterwards, even on failure.
+* @param stream The file handle.
+* @return On success: 0. On failure: -1 with an error code in the errno variable.
+*/
+int compressed_fclose(struct CompressedFile *stream);
+
 #endif  // Arduino_POSIXStorage_H
@@ -0,0 +1,681 @@
+/*
+*********************************************************************************************************
+*                                      Arduino_POSIXStorage Library
+*
+*                            Copyright 2023 Arduino SA. http://arduino.cc
+*
+*                    Streaming compression stage for files on SD Cards and USB thumb drives.
+*
+*                    Data is split into blocks of COMPRESSION_BLOCK_SIZE bytes, and every block
+*                    is written as a self-contained frame (header, LZ4 block format payload, and
+*                    checksum). Because frames don't depend on each other, a file that was cut
+*                    short by a power loss is readable up to the last complete frame.
+*
+*
+*                             SPDX-License-Identifier: LGPL-2.1-or-later
+*
+*                    This library is free software; you can redistribute it and/or
+*                    modify it under the terms of the GNU Lesser General Public
+*                    License as published by the Free Software Foundation; either
+*                    version 2.1 of the License, or (at your option) any later version.
+*
+*                    This library is distributed in the hope that it will be useful,
+*                    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*                    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*                    Lesser General Public License for more details.
+*
+*                    You should have received a copy of the GNU Lesser General
+*                    Public License along with this library; if not, write to the
+*                    Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+*                    Boston, MA  02111-1307  USA
+*
+*********************************************************************************************************
+*/
+
+/*
+*********************************************************************************************************
+*                                         Included header files
+*********************************************************************************************************
+*/
+
+#include "Arduino_POSIXStorage.h"
+
+#include <Arduino.h>
+#include <unistd.h>
+
+/*
+*********************************************************************************************************
+*                                    Library-internal constants
+*********************************************************************************************************
+*/
+
+namespace {
+
+// Frame layout (all multi-byte fields little-endian):
+//
+//   offset 0: magic "PSZ1"
+//   offset 4: uint16 number of uncompressed bytes in the frame (1 to COMPRESSION_BLOCK_SIZE)
+//   offset 6: uint16 number of payload bytes, with FRAME_STORED set if the payload is uncompressed
+//   offset 8: uint32 Adler-32 checksum of the payload
+//   offset 12: payload
+constexpr uint8_t  frameMagic[4]    = {'P', 'S', 'Z', '1'};
+constexpr size_t   frameHeaderSize  = 12;
+constexpr uint16_t FRAME_STORED     = 0x8000;
+
+// The hash table holds 16-bit positions, so it costs (2 << hashLog) bytes per open file
+constexpr unsigned hashLog          = 10;
+constexpr size_t   hashTableEntries = (1u << hashLog);
+
+// LZ4 block format rules
+constexpr size_t minMatch           = 4;
+constexpr size_t lastLiterals       = 5;    // The last 5 bytes are always literals
+constexpr size_t matchFindLimit     = 12;   // No match may start in the last 12 bytes
+
+static_assert(COMPRESSION_BLOCK_SIZE <= 0x7FFF, "COMPRESSION_BLOCK_SIZE must fit in 15 bits");
+
+}   // End of unnamed namespace
+
+/*
+*********************************************************************************************************
+*                                   Library-internal data structures
+*********************************************************************************************************
+*/
+
+enum CompressedFileModes : uint8_t
+{
+  CMODE_READ,
+  CMODE_WRITE
+};
+
+struct CompressedFile {
+  FILE *fp                       = nullptr;
+  enum CompressedFileModes mode  = CMODE_READ;
+  bool endOfFile                 = false;   // Only used in CMODE_READ
+  int error                      = 0;       // errno code of the first frame that couldn't be written (CMODE_WRITE)
+  size_t rawLength               = 0;       // Bytes in rawBuffer
+  size_t rawPosition             = 0;       // Next byte to return from rawBuffer (CMODE_READ)
+  uint8_t rawBuffer[COMPRESSION_BLOCK_SIZE];
+  uint8_t frameBuffer[frameHeaderSize + COMPRESSION_BLOCK_SIZE];
+  uint16_t hashTable[hashTableEntries];     // Only used in CMODE_WRITE
+};
+
+/*
+*********************************************************************************************************
+*                            Unnamed namespace for library-internal functions
+*********************************************************************************************************
+*/
+
+namespace {
+
+uint16_t readLE16(const uint8_t * const p)
+{
+  return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+uint32_t readLE32(const uint8_t * const p)
+{
+  return (static_cast<uint32_t>(p[0])) | (static_cast<uint32_t>(p[1]) << 8) |
+         (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+void writeLE16(uint8_t * const p, const uint16_t value)
+{
+  p[0] = static_cast<uint8_t>(value);
+  p[1] = static_cast<uint8_t>(value >> 8);
+}
+
+void writeLE32(uint8_t * const p, const uint32_t value)
+{
+  p[0] = static_cast<uint8_t>(value);
+  p[1] = static_cast<uint8_t>(value >> 8);
+  p[2] = static_cast<uint8_t>(value >> 16);
+  p[3] = static_cast<uint8_t>(value >> 24);
+}
+
+uint32_t adler32(const uint8_t *data, size_t length)
+{
+  uint32_t a = 1;
+  uint32_t b = 0;
+  while (length > 0)
+  {
+    // 5552 is the largest n for which the sums can't overflow before the modulo
+    size_t chunk = (length < 5552) ? length : 5552;
+    length -= chunk;
+    while (chunk-- > 0)
+    {
+      a += *data++;
+      b += a;
+    }
+    a %= 65521;
+    b %= 65521;
+  }
+  return ((b << 16) | a);
+}   // End of adler32()
+
+uint32_t hashPosition(const uint8_t * const p)
+{
+  return ((readLE32(p) * 2654435761u) >> (32 - hashLog));
+}
+
+// Writes an LZ4 length continuation (the part that didn't fit in the token nibble)
+bool writeLengthContinuation(uint8_t ** const op, const uint8_t * const outputEnd, size_t length)
+{
+  while (length >= 255)
+  {
+    if (*op >= outputEnd)
+    {
+      return false;
+    }
+    *(*op)++ = 255;
+    length -= 255;
+  }
+  if (*op >= outputEnd)
+  {
+    return false;
+  }
+  *(*op)++ = static_cast<uint8_t>(length);
+  return true;
+}   // End of writeLengthContinuation()
+
+// Writes one LZ4 sequence. matchLength is 0 for the final, literals-only sequence.
+bool writeSequence(uint8_t ** const op, const uint8_t * const outputEnd,
+                   const uint8_t * const literals, const size_t literalLength,
+                   const size_t offset, const size_t matchLength)
+{
+  if (*op >= outputEnd)
+  {
+    return false;
+  }
+  uint8_t * const token = (*op)++;
+  *token = static_cast<uint8_t>(((literalLength < 15) ? literalLength : 15) << 4);
+  if ((literalLength >= 15) && (false == writeLengthContinuation(op, outputEnd, literalLength - 15)))
+  {
+    return false;
+  }
+  if (static_cast<size_t>(outputEnd - *op) < literalLength)
+  {
+    return false;
+  }
+  memcpy(*op, literals, literalLength);
+  *op += literalLength;
+  if (0 == matchLength)
+  {
+    return true;
+  }
+  if ((outputEnd - *op) < 2)
+  {
+    return false;
+  }
+  writeLE16(*op, static_cast<uint16_t>(offset));
+  *op += 2;
+  const size_t matchCode = matchLength - minMatch;
+  *token |= static_cast<uint8_t>((matchCode < 15) ? matchCode : 15);
+  if ((matchCode >= 15) && (false == writeLengthContinuation(op, outputEnd, matchCode - 15)))
+  {
+    return false;
+  }
+  return true;
+}   // End of writeSequence()
+
+// Returns the compressed size, or 0 if the output would not fit in outputCapacity bytes (the
+// caller then stores the block uncompressed)
+size_t compressBlock(const uint8_t * const input, const size_t inputLength,
+                     uint8_t * const output, const size_t outputCapacity,
+                     uint16_t * const hashTable)
+{
+  uint8_t *op = output;
+  const uint8_t * const outputEnd = output + outputCapacity;
+  size_t anchor = 0;    // Start of the pending literals
+  if (inputLength > matchFindLimit)
+  {
+    memset(hashTable, 0, hashTableEntries * sizeof(hashTable[0]));
+    const size_t matchStartLimit = inputLength - matchFindLimit;
+    const size_t matchEndLimit = inputLength - lastLiterals;
+    size_t position = 0;
+    while (position < matchStartLimit)
+    {
+      const uint32_t hash = hashPosition(input + position);
+      const size_t candidate = hashTable[hash];
+      hashTable[hash] = static_cast<uint16_t>(position);
+      if ((candidate >= position) || (0 != memcmp(input + candidate, input + position, minMatch)))
+      {
+        position++;
+        continue;
+      }
+      size_t matchLength = minMatch;
+      while (((position + matchLength) < matchEndLimit) &&
+             (input[candidate + matchLength] == input[position + matchLength]))
+      {
+        matchLength++;
+      }
+      if (false == writeSequence(&op, outputEnd, input + anchor, position - anchor, position - candidate, matchLength))
+      {
+        return 0;
+      }
+      position += matchLength;
+      anchor = position;
+    }
+  }
+  if (false == writeSequence(&op, outputEnd, input + anchor, inputLength - anchor, 0, 0))
+  {
+    return 0;
+  }
+  return static_cast<size_t>(op - output);
+}   // End of compressBlock()
+
+// Reads an LZ4 length continuation, returns false on malformed input
+bool readLengthContinuation(const uint8_t ** const ip, const uint8_t * const inputEnd, size_t * const length)
+{
+  uint8_t byte;
+  do
+  {
+    if (*ip >= inputEnd)
+    {
+      return false;
+    }
+    byte = *(*ip)++;
+    *length += byte;
+  } while (255 == byte);
+  return true;
+}   // End of readLengthContinuation()
+
+// Returns true only if the input decodes to exactly outputLength bytes
+bool decompressBlock(const uint8_t * const input, const size_t inputLength,
+                     uint8_t * const output, const size_t outputLength)
+{
+  const uint8_t *ip = input;
+  const uint8_t * const inputEnd = input + inputLength;
+  uint8_t *op = output;
+  const uint8_t * const outputEnd = output + outputLength;
+  while (ip < inputEnd)
+  {
+    const uint8_t token = *ip++;
+    size_t literalLength = token >> 4;
+    if ((15 == literalLength) && (false == readLengthContinuation(&ip, inputEnd, &literalLength)))
+    {
+      return false;
+    }
+    if ((static_cast<size_t>(inputEnd - ip) < literalLength) || (static_cast<size_t>(outputEnd - op) < literalLength))
+    {
+      return false;
+    }
+    memcpy(op, ip, literalLength);
+    ip += literalLength;
+    op += literalLength;
+    if (ip == inputEnd)
+    {
+      break;    // The final sequence has no match part
+    }
+    if ((inputEnd - ip) < 2)
+    {
+      return false;
+    }
+    const size_t offset = readLE16(ip);
+    ip += 2;
+    size_t matchLength = token & 0x0F;
+    if ((15 == matchLength) && (false == readLengthContinuation(&ip, inputEnd, &matchLength)))
+    {
+      return false;
+    }
+    matchLength += minMatch;
+    if ((0 == offset) || (offset > static_cast<size_t>(op - output)) ||
+        (static_cast<size_t>(outputEnd - op) < matchLength))
+    {
+      return false;
+    }
+    // Byte by byte because the source and destination may overlap
+    const uint8_t *match = op - offset;
+    while (matchLength-- > 0)
+    {
+      *op++ = *match++;
+    }
+  }
+  return (op == outputEnd);
+}   // End of decompressBlock()
+
+// WARNING: Don't set errno and return -1 in this function - just return 0 for success or the errno code!
+int writeFrame(struct CompressedFile * const stream)
+{
+  if (0 == stream->rawLength)
+  {
+    return 0;
+  }
+  uint8_t * const payload = stream->frameBuffer + frameHeaderSize;
+  // Only keep the compressed payload if it's actually smaller than the raw data
+  size_t payloadLength = compressBlock(stream->rawBuffer, stream->rawLength, payload, stream->rawLength - 1, stream->hashTable);
+  uint16_t storedField = static_cast<uint16_t>(payloadLength);
+  if (0 == payloadLength)
+  {
+    memcpy(payload, stream->rawBuffer, stream->rawLength);
+    payloadLength = stream->rawLength;
+    storedField = static_cast<uint16_t>(payloadLength | FRAME_STORED);
+  }
+  memcpy(stream->frameBuffer, frameMagic, sizeof(frameMagic));
+  writeLE16(stream->frameBuffer + 4, static_cast<uint16_t>(stream->rawLength));
+  writeLE16(stream->frameBuffer + 6, storedField);
+  writeLE32(stream->frameBuffer + 8, adler32(payload, payloadLength));
+  const size_t frameLength = frameHeaderSize + payloadLength;
+  // A single fwrite() per frame keeps the number of partially written frames after a power loss at one
+  errno = 0;
+  if (frameLength != fwrite(stream->frameBuffer, 1, frameLength, stream->fp))
+  {
+    return (0 != errno) ? errno : EIO;
+  }
+  stream->rawLength = 0;
+  return 0;
+}   // End of writeFrame()
+
+// Returns true if a complete and intact frame was decoded into rawBuffer. Anything else, including a
+// frame cut short by a power loss, is treated as the end of the compressed data.
+bool readFrame(struct CompressedFile * const stream)
+{
+  uint8_t * const header = stream->frameBuffer;
+  if (frameHeaderSize != fread(header, 1, frameHeaderSize, stream->fp))
+  {
+    return false;
+  }
+  if (0 != memcmp(header, frameMagic, sizeof(frameMagic)))
+  {
+    return false;
+  }
+  const size_t rawLength = readLE16(header + 4);
+  const uint16_t storedField = readLE16(header + 6);
+  const bool stored = (0 != (storedField & FRAME_STORED));
+  const size_t payloadLength = storedField & static_cast<uint16_t>(~FRAME_STORED);
+  if ((0 == rawLength) || (rawLength > COMPRESSION_BLOCK_SIZE) || (0 == payloadLength) ||
+      (payloadLength > COMPRESSION_BLOCK_SIZE) || ((true == stored) && (payloadLength != rawLength)))
+  {
+    return false;
+  }
+  uint8_t * const payload = stream->frameBuffer + frameHeaderSize;
+  if (payloadLength != fread(payload, 1, payloadLength, stream->fp))
+  {
+    return false;
+  }
+  if (readLE32(header + 8) != adler32(payload, payloadLength))
+  {
+    return false;
+  }
+  if (true == stored)
+  {
+    memcpy(stream->rawBuffer, payload, payloadLength);
+  }
+  else if (false == decompressBlock(payload, payloadLength, stream->rawBuffer, rawLength))
+  {
+    return false;
+  }
+  stream->rawLength = rawLength;
+  stream->rawPosition = 0;
+  return true;
+}   // End of readFrame()
+
+// Positions an existing file right after its last intact frame so that appended frames are reachable,
+// even if the file ends with a frame that was cut short by a power loss
+bool seekPastLastFrame(struct CompressedFile * const stream)
+{
+  long endOfValidData = 0;
+  while (true == readFrame(stream))
+  {
+    endOfValidData = ftell(stream->fp);
+  }
+  stream->rawLength = 0;
+  stream->rawPosition = 0;
+  return (0 == fseek(stream->fp, endOfValidData, SEEK_SET));
+}   // End of seekPastLastFrame()
+
+}   // End of unnamed namespace
+
+/*
+*********************************************************************************************************
+*                                        Compression API functions
+*********************************************************************************************************
+*/
+
+struct CompressedFile *compressed_fopen(const char * const pathname, const char * const mode)
+{
+  if ((nullptr == pathname) || (nullptr == mode))
+  {
+    errno = EFAULT;
+    return nullptr;
+  }
+  enum CompressedFileModes fileMode;
+  bool append = false;
+  if ('r' == mode[0])
+  {
+    fileMode = CMODE_READ;
+  }
+  else if ('w' == mode[0])
+  {
+    fileMode = CMODE_WRITE;
+  }
+  else if ('a' == mode[0])
+  {
+    fileMode = CMODE_WRITE;
+    append = true;
+  }
+  else
+  {
+    errno = EINVAL;
+    return nullptr;
+  }
+  struct CompressedFile * const stream = new(std::nothrow) CompressedFile;
+  if (nullptr == stream)
+  {
+    errno = ENOMEM;
+    return nullptr;
+  }
+  stream->mode = fileMode;
+  if (true == append)
+  {
+    // Opening with "r+" lets us overwrite a partially written last frame instead of appending after it
+    stream->fp = fopen(pathname, "r+b");
+    if ((nullptr != stream->fp) && (false == seekPastLastFrame(stream)))
+    {
+      const int savedErrno = errno;
+      (void) fclose(stream->fp);
+      delete stream;
+      errno = savedErrno;
+      return nullptr;
+    }
+    // Anything but a missing file is an error, the log must never be truncated because it couldn't be opened
+    if ((nullptr == stream->fp) && (ENOENT == errno))
+    {
+      stream->fp = fopen(pathname, "wb");
+    }
+  }
+  else
+  {
+    stream->fp = fopen(pathname, (CMODE_READ == fileMode) ? "rb" : "wb");
+  }
+  if (nullptr == stream->fp)
+  {
+    const int savedErrno = errno;
+    delete stream;
+    errno = savedErrno;
+    return nullptr;
+  }
+  return stream;
+}   // End of compressed_fopen()
+
+size_t compressed_fwrite(const void * const ptr, const size_t size, const size_t nmemb, struct CompressedFile * const stream)
+{
+  if ((nullptr == stream) || (CMODE_WRITE != stream->mode))
+  {
+    errno = EBADF;
+    return 0;
+  }
+  if ((0 == size) || (0 == nmemb))
+  {
+    return 0;
+  }
+  if (nullptr == ptr)
+  {
+    errno = EFAULT;
+    return 0;
+  }
+  if (nmemb > (SIZE_MAX / size))
+  {
+    errno = EINVAL;
+    return 0;
+  }
+  // Frames written after a damaged one couldn't be read back
+  if (0 != stream->error)
+  {
+    errno = stream->error;
+    return 0;
+  }
+  const uint8_t *source = static_cast<const uint8_t*>(ptr);
+  const size_t total = size * nmemb;
+  size_t written = 0;
+  while (written < total)
+  {
+    size_t chunk = COMPRESSION_BLOCK_SIZE - stream->rawLength;
+    if (chunk > (total - written))
+    {
+      chunk = total - written;
+    }
+    memcpy(stream->rawBuffer + stream->rawLength, source + written, chunk);
+    stream->rawLength += chunk;
+    written += chunk;
+    if (COMPRESSION_BLOCK_SIZE == stream->rawLength)
+    {
+      const int frameReturn = writeFrame(stream);
+      if (0 != frameReturn)
+      {
+        // Part of the frame may be in the file already, which ends the readable data there. Bytes that
+        // earlier calls put into the frame were reported as accepted and are lost with it, so only this
+        // call's part can be taken back, and the error sticks to the stream for compressed_ferror().
+        stream->error = frameReturn;
+        errno = frameReturn;
+        written -= chunk;
+        stream->rawLength = 0;
+        break;
+      }
+    }
+  }
+  return (written / size);
+}   // End of compressed_fwrite()
+
+size_t compressed_fread(void * const ptr, const size_t size, const size_t nmemb, struct CompressedFile * const stream)
+{
+  if ((nullptr == stream) || (CMODE_READ != stream->mode))
+  {
+    errno = EBADF;
+    return 0;
+  }
+  if ((0 == size) || (0 == nmemb))
+  {
+    return 0;
+  }
+  if (nullptr == ptr)
+  {
+    errno = EFAULT;
+    return 0;
+  }
+  if (nmemb > (SIZE_MAX / size))
+  {
+    errno = EINVAL;
+    return 0;
+  }
+  uint8_t *destination = static_cast<uint8_t*>(ptr);
+  const size_t total = size * nmemb;
+  size_t readBytes = 0;
+  while (readBytes < total)
+  {
+    if (stream->rawPosition == stream->rawLength)
+    {
+      if ((true == stream->endOfFile) || (false == readFrame(stream)))
+      {
+        stream->endOfFile = true;
+        break;
+      }
+    }
+    size_t chunk = stream->rawLength - stream->rawPosition;
+    if (chunk > (total - readBytes))
+    {
+      chunk = total - readBytes;
+    }
+    memcpy(destination + readBytes, stream->rawBuffer + stream->rawPosition, chunk);
+    stream->rawPosition += chunk;
+    readBytes += chunk;
+  }
+  // Like fread(), a partially read element is consumed but not counted
+  return (readBytes / size);
+}   // End of compressed_fread()
+
+int compressed_fflush(struct CompressedFile * const stream)
+{
+  if (nullptr == stream)
+  {
+    errno = EBADF;
+    return -1;
+  }
+  if (CMODE_WRITE == stream->mode)
+  {
+    if (0 != stream->error)
+    {
+      errno = stream->error;
+      return -1;
+    }
+    const int frameReturn = writeFrame(stream);
+    if (0 != frameReturn)
+    {
+      stream->error = frameReturn;
+      errno = frameReturn;
+      return -1;
+    }
+  }
+  if (0 != fflush(stream->fp))
+  {
+    return -1;    // fflush() has already set errno
+  }
+  // fflush() only hands the frames to the file system, which may still cache them
+  if ((CMODE_WRITE == stream->mode) && (0 != fsync(fileno(stream->fp))))
+  {
+    return -1;    // fsync() has already set errno
+  }
+  return 0;
+}   // End of compressed_fflush()
+
+int compressed_ferror(struct CompressedFile * const stream)
+{
+  if (nullptr == stream)
+  {
+    errno = EBADF;
+    return -1;
+  }
+  if ((0 != stream->error) || (0 != ferror(stream->fp)))
+  {
+    return 1;
+  }
+  return 0;
+}   // End of compressed_ferror()
+
+int compressed_fclose(struct CompressedFile * const stream)
+{
+  if (nullptr == stream)
+  {
+    errno = EBADF;
+    return -1;
+  }
+  int frameReturn = stream->error;
+  if ((CMODE_WRITE == stream->mode) && (0 == frameReturn))
+  {
+    frameReturn = writeFrame(stream);
+  }
+  // Always close and free the stream, even if the last frame couldn't be written
+  const int closeReturn = fclose(stream->fp);
+  const int closeErrno = errno;
+  delete stream;
+  if (0 != frameReturn)
+  {
+    errno = frameReturn;
+    return -1;
+  }
+  if (0 != closeReturn)
+  {
+    errno = closeErrno;
+    return -1;
+  }
+  return 0;
+}   // End of compressed_fclose()
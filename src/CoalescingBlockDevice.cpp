@@ -0,0 +1,262 @@
+/*
+*********************************************************************************************************
+*                                      Arduino_POSIXStorage Library
+*
+*                            Copyright 2023 Arduino SA. http://arduino.cc
+*
+*                    Block device that merges runs of adjacent reads and programs into larger
+*                    transfers to the device.
+*
+*
+*                             SPDX-License-Identifier: LGPL-2.1-or-later
+*
+*                    This library is free software; you can redistribute it and/or
+*                    modify it under the terms of the GNU Lesser General Public
+*                    License as published by the Free Software Foundation; either
+*                    version 2.1 of the License, or (at your option) any later version.
+*
+*                    This library is distributed in the hope that it will be useful,
+*                    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*                    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*                    Lesser General Public License for more details.
+*
+*                    You should have received a copy of the GNU Lesser General
+*                    Public License along with this library; if not, write to the
+*                    Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+*                    Boston, MA  02111-1307  USA
+*
+*********************************************************************************************************
+*/
+
+/*
+*********************************************************************************************************
+*                                         Included header files
+*********************************************************************************************************
+*/
+
+#include "CoalescingBlockDevice.h"
+
+#include <Arduino.h>
+
+/*
+*********************************************************************************************************
+*                                 CoalescingBlockDevice member functions
+*********************************************************************************************************
+*/
+
+CoalescingBlockDevice::CoalescingBlockDevice(BlockDevice * const underlyingDevice,
+                                             const bd_size_t coalescingBufferSize,
+                                             const uint32_t coalescingWindowMicroseconds)
+  : ForwardingBlockDevice(underlyingDevice),
+    bufferSize(coalescingBufferSize),
+    windowMicroseconds(coalescingWindowMicroseconds),
+    enabled(false),
+    fits(true),
+    programBuffer(new(std::nothrow) uint8_t[coalescingBufferSize]),
+    programStart(0),
+    programLength(0),
+    programStartedMicroseconds(0),
+    readBuffer(new(std::nothrow) uint8_t[coalescingBufferSize]),
+    readStart(0),
+    readLength(0),
+    nextSequentialRead(0)
+{
+}   // End of CoalescingBlockDevice::CoalescingBlockDevice()
+
+CoalescingBlockDevice::~CoalescingBlockDevice()
+{
+  delete[] programBuffer;
+  delete[] readBuffer;
+}   // End of CoalescingBlockDevice::~CoalescingBlockDevice()
+
+bool CoalescingBlockDevice::isValid() const
+{
+  return ((nullptr != programBuffer) && (nullptr != readBuffer));
+}   // End of CoalescingBlockDevice::isValid()
+
+bool CoalescingBlockDevice::fitsDevice() const
+{
+  return fits;
+}   // End of CoalescingBlockDevice::fitsDevice()
+
+int CoalescingBlockDevice::init()
+{
+  const int initReturn = underlying->init();
+  if (0 != initReturn)
+  {
+    return initReturn;
+  }
+  // The sizes are only known once the device is initialized
+  const bd_size_t readSize = underlying->get_read_size();
+  const bd_size_t programSize = underlying->get_program_size();
+  fits = ((0 != readSize) && (0 != programSize) && (0 == (bufferSize % readSize)) && (0 == (bufferSize % programSize)));
+  if (false == fits)
+  {
+    enabled = false;
+    (void) underlying->deinit();
+    return BD_ERROR_DEVICE_ERROR;
+  }
+  enabled = isValid();
+  programLength = 0;
+  readLength = 0;
+  nextSequentialRead = 0;
+  return 0;
+}   // End of CoalescingBlockDevice::init()
+
+int CoalescingBlockDevice::deinit()
+{
+  const int flushReturn = flushPrograms();
+  readLength = 0;
+  const int deinitReturn = underlying->deinit();
+  return (0 != flushReturn) ? flushReturn : deinitReturn;
+}   // End of CoalescingBlockDevice::deinit()
+
+int CoalescingBlockDevice::sync()
+{
+  // Both file systems call sync() when a file is flushed or closed, so nothing stays buffered past that
+  const int flushReturn = flushPrograms();
+  if (0 != flushReturn)
+  {
+    return flushReturn;
+  }
+  return underlying->sync();
+}   // End of CoalescingBlockDevice::sync()
+
+int CoalescingBlockDevice::read(void * const buffer, const bd_addr_t addr, const bd_size_t size)
+{
+  if (false == enabled)
+  {
+    return underlying->read(buffer, addr, size);
+  }
+  const int flushReturn = flushProgramsIfOverlapping(addr, addr + size);
+  if (0 != flushReturn)
+  {
+    return flushReturn;
+  }
+  const bool sequential = (addr == nextSequentialRead);
+  nextSequentialRead = addr + size;
+  if ((0 != readLength) && (readStart <= addr) && ((addr + size) <= (readStart + readLength)))
+  {
+    memcpy(buffer, readBuffer + (addr - readStart), size);
+    return 0;
+  }
+  // Only read ahead once a second consecutive read shows that this is a sequential pass. Scattered
+  // reads, like FAT lookups, would otherwise pay for a full buffer every time.
+  if ((false == sequential) || (size >= bufferSize))
+  {
+    return underlying->read(buffer, addr, size);
+  }
+  bd_size_t length = bufferSize;
+  const bd_size_t deviceSize = underlying->size();
+  if ((addr + length) > deviceSize)
+  {
+    length = deviceSize - addr;   // Still a multiple of the read size, as the device size is
+  }
+  // Buffered programs anywhere in the read-ahead must reach the device first, or the buffer would keep
+  // the old contents of those sectors after the programs are passed on
+  const int aheadFlushReturn = flushProgramsIfOverlapping(addr, addr + length);
+  if (0 != aheadFlushReturn)
+  {
+    return aheadFlushReturn;
+  }
+  readLength = 0;
+  const int readReturn = underlying->read(readBuffer, addr, length);
+  if (0 != readReturn)
+  {
+    return readReturn;
+  }
+  readStart = addr;
+  readLength = length;
+  memcpy(buffer, readBuffer, size);
+  return 0;
+}   // End of CoalescingBlockDevice::read()
+
+int CoalescingBlockDevice::program(const void * const buffer, const bd_addr_t addr, const bd_size_t size)
+{
+  if (false == enabled)
+  {
+    return underlying->program(buffer, addr, size);
+  }
+  dropReadAheadIfOverlapping(addr, addr + size);
+  // Extend the current run if this program continues it, fits, and the run is still young enough
+  if ((0 != programLength) && (addr == (programStart + programLength)) &&
+      ((programLength + size) <= bufferSize) &&
+      ((micros() - programStartedMicroseconds) < windowMicroseconds))
+  {
+    memcpy(programBuffer + programLength, buffer, size);
+    programLength += size;
+    return 0;
+  }
+  const int flushReturn = flushPrograms();
+  if (0 != flushReturn)
+  {
+    return flushReturn;
+  }
+  if (size >= bufferSize)
+  {
+    return underlying->program(buffer, addr, size);   // Already as large as we would make it
+  }
+  memcpy(programBuffer, buffer, size);
+  programStart = addr;
+  programLength = size;
+  programStartedMicroseconds = micros();
+  return 0;
+}   // End of CoalescingBlockDevice::program()
+
+int CoalescingBlockDevice::erase(const bd_addr_t addr, const bd_size_t size)
+{
+  if (false == enabled)
+  {
+    return underlying->erase(addr, size);
+  }
+  const int flushReturn = flushProgramsIfOverlapping(addr, addr + size);
+  if (0 != flushReturn)
+  {
+    return flushReturn;
+  }
+  dropReadAheadIfOverlapping(addr, addr + size);
+  return underlying->erase(addr, size);
+}   // End of CoalescingBlockDevice::erase()
+
+int CoalescingBlockDevice::trim(const bd_addr_t addr, const bd_size_t size)
+{
+  if (false == enabled)
+  {
+    return underlying->trim(addr, size);
+  }
+  const int flushReturn = flushProgramsIfOverlapping(addr, addr + size);
+  if (0 != flushReturn)
+  {
+    return flushReturn;
+  }
+  dropReadAheadIfOverlapping(addr, addr + size);
+  return underlying->trim(addr, size);
+}   // End of CoalescingBlockDevice::trim()
+
+int CoalescingBlockDevice::flushPrograms()
+{
+  if (0 == programLength)
+  {
+    return 0;
+  }
+  const bd_size_t length = programLength;
+  programLength = 0;    // Don't retry a failed program forever, the error goes to the caller
+  return underlying->program(programBuffer, programStart, length);
+}   // End of CoalescingBlockDevice::flushPrograms()
+
+int CoalescingBlockDevice::flushProgramsIfOverlapping(const bd_addr_t start, const bd_addr_t end)
+{
+  if ((0 == programLength) || (end <= programStart) || ((programStart + programLength) <= start))
+  {
+    return 0;
+  }
+  return flushPrograms();
+}   // End of CoalescingBlockDevice::flushProgramsIfOverlapping()
+
+void CoalescingBlockDevice::dropReadAheadIfOverlapping(const bd_addr_t start, const bd_addr_t end)
+{
+  if ((0 != readLength) && (start < (readStart + readLength)) && (readStart < end))
+  {
+    readLength = 0;
+  }
+}   // End of CoalescingBlockDevice::dropReadAheadIfOverlapping()
@@ -0,0 +1,91 @@
+/*
+*********************************************************************************************************
+*                                      Arduino_POSIXStorage Library
+*
+*                            Copyright 2023 Arduino SA. http://arduino.cc
+*
+*                    Block device that merges runs of adjacent reads and programs into larger
+*                    transfers to the device.
+*
+*
+*                             SPDX-License-Identifier: LGPL-2.1-or-later
+*
+*                    This library is free software; you can redistribute it and/or
+*                    modify it under the terms of the GNU Lesser General Public
+*                    License as published by the Free Software Foundation; either
+*                    version 2.1 of the License, or (at your option) any later version.
+*
+*                    This library is distributed in the hope that it will be useful,
+*                    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*                    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*                    Lesser General Public License for more details.
+*
+*                    You should have received a copy of the GNU Lesser General
+*                    Public License along with this library; if not, write to the
+*                    Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+*                    Boston, MA  02111-1307  USA
+*
+*********************************************************************************************************
+*/
+
+#ifndef CoalescingBlockDevice_H
+#define CoalescingBlockDevice_H
+
+#include "ForwardingBlockDevice.h"
+
+#if defined(ARDUINO_PORTENTA_H7_M7) || defined(ARDUINO_OPTA)
+  using mbed::BD_ERROR_DEVICE_ERROR;
+#endif
+
+// FatFs and LittleFS mostly read and program one sector at a time, even when they walk through a
+// file from start to end, and every call is a separate command to the device. This class collects
+// a run of programs to consecutive addresses in a buffer and passes it on as one program() call
+// when the run is broken, the buffer is full, the run is older than the window, or on sync() and
+// deinit(). A read that continues where the previous one ended fills a second buffer with the
+// following sectors, and the reads after it are answered from there. Reads (including the whole
+// read-ahead), erases, and trims that overlap buffered programs pass those on first, so the device
+// always sees the same order of changes to any one address.
+class CoalescingBlockDevice : public ForwardingBlockDevice {
+public:
+  // A bufferSize that isn't a multiple of the device's read and program sizes makes init() fail,
+  // because the buffered runs couldn't be passed on in sizes the device takes
+  CoalescingBlockDevice(BlockDevice *underlyingDevice, bd_size_t bufferSize, uint32_t windowMicroseconds);
+  virtual ~CoalescingBlockDevice();
+
+  // False if the buffers couldn't be allocated
+  bool isValid() const;
+  // False if init() failed because of the bufferSize
+  bool fitsDevice() const;
+
+  virtual int init();
+  virtual int deinit();
+  virtual int sync();
+  virtual int read(void *buffer, bd_addr_t addr, bd_size_t size);
+  virtual int program(const void *buffer, bd_addr_t addr, bd_size_t size);
+  virtual int erase(bd_addr_t addr, bd_size_t size);
+  virtual int trim(bd_addr_t addr, bd_size_t size);
+
+private:
+  // Returns 0 or a negative error code from the device. A failed program is reported by the
+  // call that passes it on, which can be a later call than the one that buffered it.
+  int flushPrograms();
+  int flushProgramsIfOverlapping(bd_addr_t start, bd_addr_t end);
+  void dropReadAheadIfOverlapping(bd_addr_t start, bd_addr_t end);
+
+  const bd_size_t bufferSize;
+  const uint32_t windowMicroseconds;
+  bool enabled;
+  bool fits;
+
+  uint8_t *programBuffer;
+  bd_addr_t programStart;
+  bd_size_t programLength;      // 0 if nothing is buffered
+  uint32_t programStartedMicroseconds;
+
+  uint8_t *readBuffer;
+  bd_addr_t readStart;
+  bd_size_t readLength;         // 0 if nothing is buffered
+  bd_addr_t nextSequentialRead;
+};
+
+#endif  // CoalescingBlockDevice_H
@@ -0,0 +1,475 @@
+/*
+*********************************************************************************************************
+*                                      Arduino_POSIXStorage Library
+*
+*                            Copyright 2023 Arduino SA. http://arduino.cc
+*
+*                    Directory entry cache that sits between the retargeted POSIX functions and
+*                    the file system object the library owns for a mounted device.
+*
+*
+*                             SPDX-License-Identifier: LGPL-2.1-or-later
+*
+*                    This library is free software; you can redistribute it and/or
+*                    modify it under the terms of the GNU Lesser General Public
+*                    License as published by the Free Software Foundation; either
+*                    version 2.1 of the License, or (at your option) any later version.
+*
+*                    This library is distributed in the hope that it will be useful,
+*                    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*                    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*                    Lesser General Public License for more details.
+*
+*                    You should have received a copy of the GNU Lesser General
+*                    Public License along with this library; if not, write to the
+*                    Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+*                    Boston, MA  02111-1307  USA
+*
+*********************************************************************************************************
+*/
+
+/*
+*********************************************************************************************************
+*                                         Included header files
+*********************************************************************************************************
+*/
+
+#include "DirectoryCacheFileSystem.h"
+
+#include <Arduino.h>
+
+/*
+*********************************************************************************************************
+*                                   Library-internal data structures
+*********************************************************************************************************
+*/
+
+namespace {
+
+constexpr uint64_t fnvOffsetBasis = 14695981039346656037ULL;
+constexpr uint64_t fnvPrime       = 1099511628211ULL;
+
+}   // End of unnamed namespace
+
+/*
+*********************************************************************************************************
+*                                 DirectoryCacheFileSystem member functions
+*********************************************************************************************************
+*/
+
+DirectoryCacheFileSystem::DirectoryCacheFileSystem(const char * const name,
+                                                   FileSystem * const underlyingFileSystem,
+                                                   const size_t entries,
+                                                   const bool caseInsensitive)
+  : ForwardingFileSystem(name, underlyingFileSystem),
+    table(nullptr),
+    tableEntries(entries),
+    foldCase(caseInsensitive),
+    uncacheableWriters(0),
+    generation(0)
+{
+  if (0 != tableEntries)
+  {
+    table = new(std::nothrow) CacheEntry[tableEntries]();
+  }
+}   // End of DirectoryCacheFileSystem::DirectoryCacheFileSystem()
+
+DirectoryCacheFileSystem::~DirectoryCacheFileSystem()
+{
+  delete[] table;
+}   // End of DirectoryCacheFileSystem::~DirectoryCacheFileSystem()
+
+bool DirectoryCacheFileSystem::isValid() const
+{
+  return ((nullptr != underlying) && (nullptr != table));
+}   // End of DirectoryCacheFileSystem::isValid()
+
+// Hashes a normalized form of the path, so that "dir//file", "/dir/./file", and "dir/file" share an
+// entry. Paths that could name the same file as a differently spelled path are not cached: ".." on
+// both file systems, and on FAT also short name aliases ("LONGFI~1.TXT"), names with trailing dots or
+// spaces (FatFs strips them), and non-ASCII names (FatFs folds their case with a code page).
+bool DirectoryCacheFileSystem::hashPath(const char *path, uint64_t * const pathHash) const
+{
+  if (nullptr == path)
+  {
+    return false;
+  }
+  uint64_t hash = fnvOffsetBasis;
+  bool firstSegment = true;
+  while ('\0' != *path)
+  {
+    while ('/' == *path)
+    {
+      path++;
+    }
+    size_t length = 0;
+    while (('\0' != path[length]) && ('/' != path[length]))
+    {
+      length++;
+    }
+    if (0 == length)
+    {
+      break;
+    }
+    if ((1 == length) && ('.' == path[0]))
+    {
+      path += length;
+      continue;
+    }
+    if ((2 == length) && ('.' == path[0]) && ('.' == path[1]))
+    {
+      return false;
+    }
+    if ((true == foldCase) && (('.' == path[length - 1]) || (' ' == path[length - 1])))
+    {
+      return false;
+    }
+    if (false == firstSegment)
+    {
+      hash = (hash ^ '/') * fnvPrime;
+    }
+    for (size_t i = 0; i < length; i++)
+    {
+      uint8_t c = static_cast<uint8_t>(path[i]);
+      if (true == foldCase)
+      {
+        if (('~' == c) || (c >= 0x80))
+        {
+          return false;
+        }
+        if ((c >= 'A') && (c <= 'Z'))
+        {
+          c = static_cast<uint8_t>(c - 'A' + 'a');
+        }
+      }
+      hash = (hash ^ c) * fnvPrime;
+    }
+    firstSegment = false;
+    path += length;
+  }
+  *pathHash = (0 != hash) ? hash : 1;   // 0 marks unused entries
+  return true;
+}   // End of DirectoryCacheFileSystem::hashPath()
+
+bool DirectoryCacheFileSystem::lookup(const uint64_t pathHash, struct CacheEntry * const entry, uint32_t * const lookupGeneration)
+{
+  lock();
+  *lookupGeneration = generation;
+  const struct CacheEntry * const tableEntry = &table[pathHash % tableEntries];
+  // Entries can't be trusted while a file with an uncacheable path is open for writing, because
+  // that path may name a cached file
+  const bool found = ((0 == uncacheableWriters) && (pathHash == tableEntry->pathHash));
+  if (true == found)
+  {
+    *entry = *tableEntry;
+  }
+  unlock();
+  return found;
+}   // End of DirectoryCacheFileSystem::lookup()
+
+bool DirectoryCacheFileSystem::store(const uint32_t lookupGeneration, const uint64_t pathHash, const struct stat * const st)
+{
+  lock();
+  if ((0 != uncacheableWriters) || (lookupGeneration != generation))
+  {
+    unlock();
+    return false;
+  }
+  struct CacheEntry * const entry = &table[pathHash % tableEntries];
+  if (nullptr == st)
+  {
+    entry->pathHash = pathHash;
+    entry->size = 0;
+    entry->mode = 0;
+    entry->modificationTime = 0;
+  }
+  // Don't cache what we can't represent
+  else if ((st->st_size < 0) || (static_cast<uint64_t>(st->st_size) > UINT32_MAX) || (0 == st->st_mode))
+  {
+    if (pathHash == entry->pathHash)
+    {
+      entry->pathHash = 0;
+    }
+  }
+  else
+  {
+    entry->pathHash = pathHash;
+    entry->size = static_cast<uint32_t>(st->st_size);
+    entry->mode = static_cast<uint32_t>(st->st_mode);
+    entry->modificationTime = static_cast<uint32_t>(st->st_mtime);
+  }
+  unlock();
+  return true;
+}   // End of DirectoryCacheFileSystem::store()
+
+uint32_t DirectoryCacheFileSystem::currentGeneration()
+{
+  lock();
+  const uint32_t currentGeneration = generation;
+  unlock();
+  return currentGeneration;
+}   // End of DirectoryCacheFileSystem::currentGeneration()
+
+void DirectoryCacheFileSystem::invalidate(const uint64_t pathHash)
+{
+  lock();
+  struct CacheEntry * const entry = &table[pathHash % tableEntries];
+  if (pathHash == entry->pathHash)
+  {
+    entry->pathHash = 0;
+  }
+  generation++;
+  unlock();
+}   // End of DirectoryCacheFileSystem::invalidate()
+
+void DirectoryCacheFileSystem::invalidatePath(const char * const path)
+{
+  uint64_t pathHash;
+  if (true == hashPath(path, &pathHash))
+  {
+    invalidate(pathHash);
+  }
+  else
+  {
+    clear();
+  }
+}   // End of DirectoryCacheFileSystem::invalidatePath()
+
+void DirectoryCacheFileSystem::clear()
+{
+  lock();
+  memset(table, 0, tableEntries * sizeof(table[0]));
+  generation++;
+  unlock();
+}   // End of DirectoryCacheFileSystem::clear()
+
+void DirectoryCacheFileSystem::addUncacheableWriter(const int change)
+{
+  lock();
+  uncacheableWriters += change;
+  unlock();
+}   // End of DirectoryCacheFileSystem::addUncacheableWriter()
+
+void DirectoryCacheFileSystem::lock()
+{
+#if defined(DIRECTORY_CACHE_HAS_MUTEX)
+  mutex.lock();
+#endif
+}   // End of DirectoryCacheFileSystem::lock()
+
+void DirectoryCacheFileSystem::unlock()
+{
+#if defined(DIRECTORY_CACHE_HAS_MUTEX)
+  mutex.unlock();
+#endif
+}   // End of DirectoryCacheFileSystem::unlock()
+
+int DirectoryCacheFileSystem::mount(BlockDevice * const bd)
+{
+  clear();
+  return ForwardingFileSystem::mount(bd);
+}   // End of DirectoryCacheFileSystem::mount()
+
+int DirectoryCacheFileSystem::unmount()
+{
+  clear();
+  return ForwardingFileSystem::unmount();
+}   // End of DirectoryCacheFileSystem::unmount()
+
+int DirectoryCacheFileSystem::reformat(BlockDevice * const bd)
+{
+  clear();
+  return ForwardingFileSystem::reformat(bd);
+}   // End of DirectoryCacheFileSystem::reformat()
+
+int DirectoryCacheFileSystem::remove(const char * const path)
+{
+  const uint32_t removeGeneration = currentGeneration();
+  const int removeReturn = ForwardingFileSystem::remove(path);
+  uint64_t pathHash;
+  if (false == hashPath(path, &pathHash))
+  {
+    clear();
+  }
+  else if ((0 != removeReturn) || (false == store(removeGeneration, pathHash, nullptr)))
+  {
+    invalidate(pathHash);
+  }
+  return removeReturn;
+}   // End of DirectoryCacheFileSystem::remove()
+
+int DirectoryCacheFileSystem::rename(const char * const path, const char * const newpath)
+{
+  // Renaming a directory moves every path below it, and those can't be found from a hash, so only
+  // renames of paths known to be regular files are handled without dropping the whole cache
+  uint64_t oldHash;
+  uint64_t newHash;
+  bool knownRegularFile = false;
+  uint32_t renameGeneration = 0;
+  if ((true == hashPath(path, &oldHash)) && (true == hashPath(newpath, &newHash)))
+  {
+    struct CacheEntry entry;
+    knownRegularFile = ((true == lookup(oldHash, &entry, &renameGeneration)) && (S_ISREG(entry.mode)));
+  }
+  const int renameReturn = ForwardingFileSystem::rename(path, newpath);
+  if (true == knownRegularFile)
+  {
+    if ((0 != renameReturn) || (false == store(renameGeneration, oldHash, nullptr)))
+    {
+      invalidate(oldHash);
+    }
+    invalidate(newHash);
+  }
+  else
+  {
+    clear();
+  }
+  return renameReturn;
+}   // End of DirectoryCacheFileSystem::rename()
+
+int DirectoryCacheFileSystem::stat(const char * const path, struct stat * const st)
+{
+  uint64_t pathHash;
+  uint32_t statGeneration = 0;
+  const bool cacheable = hashPath(path, &pathHash);
+  if ((true == cacheable) && (nullptr != st))
+  {
+    struct CacheEntry entry;
+    if (true == lookup(pathHash, &entry, &statGeneration))
+    {
+      if (0 == entry.mode)
+      {
+        return -ENOENT;
+      }
+      memset(st, 0, sizeof(*st));
+      st->st_size = static_cast<off_t>(entry.size);
+      st->st_mode = static_cast<mode_t>(entry.mode);
+      st->st_mtime = static_cast<time_t>(entry.modificationTime);
+      return 0;
+    }
+  }
+  const int statReturn = ForwardingFileSystem::stat(path, st);
+  if ((true == cacheable) && (nullptr != st))
+  {
+    if (0 == statReturn)
+    {
+      (void) store(statGeneration, pathHash, st);
+    }
+    else if (-ENOENT == statReturn)
+    {
+      (void) store(statGeneration, pathHash, nullptr);
+    }
+  }
+  return statReturn;
+}   // End of DirectoryCacheFileSystem::stat()
+
+int DirectoryCacheFileSystem::mkdir(const char * const path, const mode_t mode)
+{
+  const int mkdirReturn = ForwardingFileSystem::mkdir(path, mode);
+  invalidatePath(path);
+  return mkdirReturn;
+}   // End of DirectoryCacheFileSystem::mkdir()
+
+int DirectoryCacheFileSystem::file_open(fs_file_t * const file, const char * const path, const int flags)
+{
+  uint64_t pathHash;
+  uint32_t openGeneration = 0;
+  const bool cacheable = hashPath(path, &pathHash);
+  const bool writable = (0 != (flags & (O_WRONLY | O_RDWR | O_CREAT | O_TRUNC | O_APPEND)));
+  // This is the case the cache speeds up: a read-only open() of a path that is known not to exist
+  if ((true == cacheable) && (false == writable))
+  {
+    struct CacheEntry entry;
+    if ((true == lookup(pathHash, &entry, &openGeneration)) && (0 == entry.mode))
+    {
+      return -ENOENT;
+    }
+  }
+  struct CachedFile * const cachedFile = new(std::nothrow) CachedFile;
+  if (nullptr == cachedFile)
+  {
+    return -ENOMEM;
+  }
+  cachedFile->writable = writable;
+  if (true == cacheable)
+  {
+    cachedFile->pathHash = pathHash;
+  }
+  // Invalidate before opening, because O_CREAT and O_TRUNC change the entry even if open() fails later
+  if (true == writable)
+  {
+    invalidatePath(path);
+  }
+  // Deletes cachedFile if the open fails
+  const int openReturn = openForwardedFile(cachedFile, file, path, flags);
+  // And again after, in case another thread stored what it saw while the file was being created
+  if (true == writable)
+  {
+    invalidatePath(path);
+  }
+  if (0 != openReturn)
+  {
+    if ((true == cacheable) && (false == writable) && (-ENOENT == openReturn))
+    {
+      (void) store(openGeneration, pathHash, nullptr);
+    }
+    return openReturn;
+  }
+  if ((false == cacheable) && (true == writable))
+  {
+    addUncacheableWriter(1);
+  }
+  return 0;
+}   // End of DirectoryCacheFileSystem::file_open()
+
+int DirectoryCacheFileSystem::file_close(const fs_file_t file)
+{
+  const struct CachedFile * const cachedFile = static_cast<struct CachedFile*>(getForwardedFile(file));
+  const bool writable = cachedFile->writable;
+  const uint64_t pathHash = cachedFile->pathHash;
+  // Deletes cachedFile
+  const int closeReturn = ForwardingFileSystem::file_close(file);
+  if (true == writable)
+  {
+    if (0 != pathHash)
+    {
+      invalidate(pathHash);
+    }
+    else
+    {
+      addUncacheableWriter(-1);
+      clear();
+    }
+  }
+  return closeReturn;
+}   // End of DirectoryCacheFileSystem::file_close()
+
+ssize_t DirectoryCacheFileSystem::file_write(const fs_file_t file, const void * const buffer, const size_t size)
+{
+  struct CachedFile * const cachedFile = static_cast<struct CachedFile*>(getForwardedFile(file));
+  if (0 != cachedFile->pathHash)
+  {
+    invalidate(cachedFile->pathHash);   // The size is about to change
+  }
+  const ssize_t writeReturn = ForwardingFileSystem::file_write(file, buffer, size);
+  if (0 != cachedFile->pathHash)
+  {
+    invalidate(cachedFile->pathHash);   // Another thread may have stored the size while it changed
+  }
+  return writeReturn;
+}   // End of DirectoryCacheFileSystem::file_write()
+
+int DirectoryCacheFileSystem::file_truncate(const fs_file_t file, const off_t length)
+{
+  struct CachedFile * const cachedFile = static_cast<struct CachedFile*>(getForwardedFile(file));
+  if (0 != cachedFile->pathHash)
+  {
+    invalidate(cachedFile->pathHash);
+  }
+  const int truncateReturn = ForwardingFileSystem::file_truncate(file, length);
+  if (0 != cachedFile->pathHash)
+  {
+    invalidate(cachedFile->pathHash);
+  }
+  return truncateReturn;
+}   // End of DirectoryCacheFileSystem::file_truncate()
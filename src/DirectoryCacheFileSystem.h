@@ -0,0 +1,115 @@
+/*
+*********************************************************************************************************
+*                                      Arduino_POSIXStorage Library
+*
+*                            Copyright 2023 Arduino SA. http://arduino.cc
+*
+*                    Directory entry cache that sits between the retargeted POSIX functions and
+*                    the file system object the library owns for a mounted device.
+*
+*
+*                             SPDX-License-Identifier: LGPL-2.1-or-later
+*
+*                    This library is free software; you can redistribute it and/or
+*                    modify it under the terms of the GNU Lesser General Public
+*                    License as published by the Free Software Foundation; either
+*                    version 2.1 of the License, or (at your option) any later version.
+*
+*                    This library is distributed in the hope that it will be useful,
+*                    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*                    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*                    Lesser General Public License for more details.
+*
+*                    You should have received a copy of the GNU Lesser General
+*                    Public License along with this library; if not, write to the
+*                    Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+*                    Boston, MA  02111-1307  USA
+*
+*********************************************************************************************************
+*/
+
+#ifndef DirectoryCacheFileSystem_H
+#define DirectoryCacheFileSystem_H
+
+#include "ForwardingFileSystem.h"
+
+// On the mbed based boards the write queue's worker thread writes files while the sketch calls stat()
+// and open(), so the table is protected by a mutex there
+#if defined(ARDUINO_PORTENTA_H7_M7) || defined(ARDUINO_OPTA)
+  #define DIRECTORY_CACHE_HAS_MUTEX
+#endif
+
+// Neither FatFs nor LittleFS expose where a directory entry lives, so the cache can't skip the
+// directory scan that opening an existing file performs. What it can do is to remember the result
+// of earlier lookups (type and size, or that the path doesn't exist) and answer stat() and
+// read-only open() of missing files without touching the device. The cache is a direct-mapped
+// table of 64-bit path hashes, 24 bytes per entry, and is kept coherent by invalidating entries on
+// every operation that can create, change, rename, or remove a path, both before and after it reaches
+// the file system. A lookup that misses only stores its result if no entry was invalidated while it
+// went to the file system, because the result may predate a change made by another thread.
+class DirectoryCacheFileSystem : public ForwardingFileSystem {
+public:
+  // Takes ownership of underlyingFileSystem, like ForwardingFileSystem
+  DirectoryCacheFileSystem(const char *name, FileSystem *underlyingFileSystem, size_t entries, bool caseInsensitive);
+  virtual ~DirectoryCacheFileSystem();
+
+  // False if the cache table couldn't be allocated
+  bool isValid() const;
+
+  virtual int mount(BlockDevice *bd);
+  virtual int unmount();
+  virtual int reformat(BlockDevice *bd);
+  virtual int remove(const char *path);
+  virtual int rename(const char *path, const char *newpath);
+  virtual int stat(const char *path, struct stat *st);
+  virtual int mkdir(const char *path, mode_t mode);
+
+protected:
+  virtual int file_open(fs_file_t *file, const char *path, int flags);
+  virtual int file_close(fs_file_t file);
+  virtual ssize_t file_write(fs_file_t file, const void *buffer, size_t size);
+  virtual int file_truncate(fs_file_t file, off_t length);
+
+private:
+  struct CachedFile : public ForwardedFile {
+    uint64_t pathHash = 0;    // 0 if the path couldn't be cached
+    bool writable     = false;
+  };
+
+  struct CacheEntry {
+    uint64_t pathHash;    // 0 if the entry is unused
+    uint32_t size;
+    uint32_t mode;        // 0 if the path is known not to exist
+    uint32_t modificationTime;
+  };
+
+  // Returns false if the path can't be cached (it could name the same file as another path)
+  bool hashPath(const char *path, uint64_t *pathHash) const;
+  // Copies the entry, and returns false if there is none. Always returns the generation to pass to
+  // store() after the file system has been asked instead.
+  bool lookup(uint64_t pathHash, struct CacheEntry *entry, uint32_t *generation);
+  // A nullptr st records that the path doesn't exist. Does nothing and returns false if anything was
+  // invalidated since the generation was returned by lookup() or currentGeneration().
+  bool store(uint32_t generation, uint64_t pathHash, const struct stat *st);
+  uint32_t currentGeneration();
+  void invalidate(uint64_t pathHash);
+  // Invalidates a single path, or everything if the path can't be cached
+  void invalidatePath(const char *path);
+  void clear();
+  void addUncacheableWriter(int change);
+
+  // The table, generation, and uncacheableWriters may only be used by the functions above, under the lock
+  void lock();
+  void unlock();
+
+  struct CacheEntry *table;
+  size_t tableEntries;
+  bool foldCase;
+  size_t uncacheableWriters;    // Open files with uncacheable paths that can change the file system
+  uint32_t generation;          // Advanced by every invalidation
+#if defined(DIRECTORY_CACHE_HAS_MUTEX)
+  rtos::Mutex mutex;
+#endif
+};
+
+#endif  // DirectoryCacheFileSystem_H
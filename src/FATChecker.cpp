@@ -0,0 +1,1031 @@
+/*
+*********************************************************************************************************
+*                                      Arduino_POSIXStorage Library
+*
+*                            Copyright 2023 Arduino SA. http://arduino.cc
+*
+*                    Checks and repairs FAT16 and FAT32 volumes in bounded time slices, and
+*                    tracks whether a volume was cleanly unmounted.
+*
+*
+*                             SPDX-License-Identifier: LGPL-2.1-or-later
+*
+*                    This library is free software; you can redistribute it and/or
+*                    modify it under the terms of the GNU Lesser General Public
+*                    License as published by the Free Software Foundation; either
+*                    version 2.1 of the License, or (at your option) any later version.
+*
+*                    This library is distributed in the hope that it will be useful,
+*                    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*                    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*                    Lesser General Public License for more details.
+*
+*                    You should have received a copy of the GNU Lesser General
+*                    Public License along with this library; if not, write to the
+*                    Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+*                    Boston, MA  02111-1307  USA
+*
+*********************************************************************************************************
+*/
+
+/*
+*********************************************************************************************************
+*                                         Included header files
+*********************************************************************************************************
+*/
+
+#include "FATChecker.h"
+
+#include <Arduino.h>
+
+/*
+*********************************************************************************************************
+*                                    Library-internal constants
+*********************************************************************************************************
+*/
+
+namespace {
+
+// Directory entry layout
+constexpr uint32_t entrySize            = 32;
+constexpr uint32_t entryAttributes      = 11;
+constexpr uint32_t entryClusterHigh     = 20;   // FAT32 only
+constexpr uint32_t entryClusterLow      = 26;
+constexpr uint32_t entryFileSize        = 28;
+constexpr uint8_t  entryEndOfDirectory  = 0x00;
+constexpr uint8_t  entryDeleted         = 0xE5;
+constexpr uint8_t  attributeVolumeLabel = 0x08;
+constexpr uint8_t  attributeDirectory   = 0x10;
+constexpr uint8_t  attributeLongName    = 0x0F;
+constexpr uint8_t  attributeMask        = 0x3F;
+
+// Same limits as FatFs uses to tell the FAT types apart
+constexpr uint32_t maxFAT12Clusters     = 0xFF5;
+constexpr uint32_t maxFAT16Clusters     = 0xFFF5;
+
+constexpr uint32_t fsInfoLeadSignature   = 0x41615252;
+constexpr uint32_t fsInfoStructSignature = 0x61417272;
+
+uint16_t load16(const uint8_t * const p)
+{
+  return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}   // End of load16()
+
+uint32_t load32(const uint8_t * const p)
+{
+  return (static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+          (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24));
+}   // End of load32()
+
+void store16(uint8_t * const p, const uint16_t value)
+{
+  p[0] = static_cast<uint8_t>(value);
+  p[1] = static_cast<uint8_t>(value >> 8);
+}   // End of store16()
+
+void store32(uint8_t * const p, const uint32_t value)
+{
+  p[0] = static_cast<uint8_t>(value);
+  p[1] = static_cast<uint8_t>(value >> 8);
+  p[2] = static_cast<uint8_t>(value >> 16);
+  p[3] = static_cast<uint8_t>(value >> 24);
+}   // End of store32()
+
+bool isPowerOfTwo(const uint32_t value)
+{
+  return ((0 != value) && (0 == (value & (value - 1))));
+}   // End of isPowerOfTwo()
+
+}   // End of unnamed namespace
+
+/*
+*********************************************************************************************************
+*                                  FATChecker static member functions
+*********************************************************************************************************
+*/
+
+bool FATChecker::parseBootSector(const uint8_t * const sector, const bd_addr_t offset, struct Volume * const volume)
+{
+  if ((0x55 != sector[510]) || (0xAA != sector[511]) || ((0xEB != sector[0]) && (0xE9 != sector[0])))
+  {
+    return false;
+  }
+  const uint32_t bytesPerSector = load16(sector + 11);
+  const uint32_t sectorsPerCluster = sector[13];
+  const uint32_t reservedSectors = load16(sector + 14);
+  const uint32_t numberOfFATs = sector[16];
+  const uint32_t rootEntries = load16(sector + 17);
+  const uint32_t totalSectors = (0 != load16(sector + 19)) ? load16(sector + 19) : load32(sector + 32);
+  const uint32_t fat16Sectors = load16(sector + 22);
+  const uint32_t fatSectors = (0 != fat16Sectors) ? fat16Sectors : load32(sector + 36);
+  // exFAT has 0 bytes per sector here, so it's rejected along with anything that isn't FAT
+  if ((false == isPowerOfTwo(bytesPerSector)) || (bytesPerSector < 512) || (bytesPerSector > maxSectorSize) ||
+      (false == isPowerOfTwo(sectorsPerCluster)) || (0 == reservedSectors) ||
+      ((1 != numberOfFATs) && (2 != numberOfFATs)) || (0 == fatSectors) || (0 == totalSectors))
+  {
+    return false;
+  }
+  const uint32_t rootDirectorySectors = ((rootEntries * entrySize) + bytesPerSector - 1) / bytesPerSector;
+  const uint64_t metadataSectors = reservedSectors + (static_cast<uint64_t>(numberOfFATs) * fatSectors) + rootDirectorySectors;
+  if (totalSectors <= metadataSectors)
+  {
+    return false;
+  }
+  const uint32_t clusters = static_cast<uint32_t>((totalSectors - metadataSectors) / sectorsPerCluster);
+  if (clusters <= maxFAT12Clusters)
+  {
+    return false;   // FAT12 isn't supported, it's only used on very small volumes
+  }
+  const bool fat32 = (clusters > maxFAT16Clusters);
+  if (((true == fat32) && ((0 != rootEntries) || (0 != fat16Sectors))) || ((false == fat32) && (0 == rootEntries)))
+  {
+    return false;
+  }
+  // The FAT must have room for every cluster
+  const uint64_t fatEntries = (static_cast<uint64_t>(fatSectors) * bytesPerSector) / ((true == fat32) ? 4 : 2);
+  if (fatEntries < (static_cast<uint64_t>(clusters) + 2))
+  {
+    return false;
+  }
+  volume->sectorSize = bytesPerSector;
+  volume->volumeOffset = offset;
+  volume->fatStart = reservedSectors;
+  volume->fatSectors = fatSectors;
+  volume->numberOfFATs = numberOfFATs;
+  volume->rootDirectoryStart = reservedSectors + (numberOfFATs * fatSectors);
+  volume->rootDirectorySectors = rootDirectorySectors;
+  volume->dataStart = static_cast<uint32_t>(metadataSectors);
+  volume->sectorsPerCluster = sectorsPerCluster;
+  volume->maxCluster = clusters + 1;
+  volume->fat32 = fat32;
+  volume->rootCluster = 0;
+  volume->fsInfoSector = 0;
+  if (true == fat32)
+  {
+    volume->rootCluster = load32(sector + 44);
+    if ((volume->rootCluster < 2) || (volume->rootCluster > volume->maxCluster))
+    {
+      return false;
+    }
+    const uint32_t fsInfoSector = load16(sector + 48);
+    if ((0 != fsInfoSector) && (fsInfoSector < reservedSectors))
+    {
+      volume->fsInfoSector = fsInfoSector;
+    }
+  }
+  return true;
+}   // End of FATChecker::parseBootSector()
+
+// WARNING: Don't set errno and return -1 in this function - just return 0 for success or the errno code!
+int FATChecker::locateVolume(BlockDevice * const device, uint8_t * const scratch, struct Volume * const volume)
+{
+  // Partition table entries count in units of the device's sectors
+  const bd_size_t readSize = device->get_read_size();
+  const bd_size_t unit = (readSize < 512) ? 512 : readSize;
+  if ((0 == readSize) || (unit > maxSectorSize) || (0 != (unit % readSize)))
+  {
+    return ENOTSUP;
+  }
+  if (0 != device->read(scratch, 0, unit))
+  {
+    return EIO;
+  }
+  bool found = parseBootSector(scratch, 0, volume);
+  if ((false == found) && (0x55 == scratch[510]) && (0xAA == scratch[511]))
+  {
+    // A master boot record, so look for the first FAT partition the same way FatFs does
+    uint32_t partitionStarts[4];
+    for (int i=0; i<4; i++)
+    {
+      partitionStarts[i] = (0 != scratch[446 + (16 * i) + 4]) ? load32(scratch + 446 + (16 * i) + 8) : 0;
+    }
+    for (int i=0; (i<4) && (false == found); i++)
+    {
+      if (0 == partitionStarts[i])
+      {
+        continue;
+      }
+      const bd_addr_t offset = static_cast<bd_addr_t>(partitionStarts[i]) * unit;
+      if ((offset + unit) > device->size())
+      {
+        continue;
+      }
+      if (0 != device->read(scratch, offset, unit))
+      {
+        return EIO;
+      }
+      found = parseBootSector(scratch, offset, volume);
+    }
+  }
+  if (false == found)
+  {
+    return ENOTSUP;
+  }
+  // Whole sectors must be readable and programmable on their own
+  const bd_size_t programSize = device->get_program_size();
+  if ((0 != (volume->sectorSize % readSize)) || (0 == programSize) || (0 != (volume->sectorSize % programSize)))
+  {
+    return ENOTSUP;
+  }
+  return 0;
+}   // End of FATChecker::locateVolume()
+
+// WARNING: Don't set errno and return -1 in this function - just return 0 for success or the errno code!
+int FATChecker::readSector(BlockDevice * const device, const struct Volume &volume, const uint32_t sector, uint8_t * const buffer)
+{
+  const bd_addr_t address = volume.volumeOffset + (static_cast<bd_addr_t>(sector) * volume.sectorSize);
+  return (0 == device->read(buffer, address, volume.sectorSize)) ? 0 : EIO;
+}   // End of FATChecker::readSector()
+
+// WARNING: Don't set errno and return -1 in this function - just return 0 for success or the errno code!
+int FATChecker::writeSector(BlockDevice * const device, const struct Volume &volume, const uint32_t sector, const uint8_t * const buffer)
+{
+  // Erase before program, like mbed's FatFs glue does
+  const bd_addr_t address = volume.volumeOffset + (static_cast<bd_addr_t>(sector) * volume.sectorSize);
+  if (0 != device->erase(address, volume.sectorSize))
+  {
+    return EIO;
+  }
+  return (0 == device->program(buffer, address, volume.sectorSize)) ? 0 : EIO;
+}   // End of FATChecker::writeSector()
+
+uint32_t FATChecker::cleanBit(const struct Volume &volume)
+{
+  // Set by f_mkfs() and never touched by FatFs afterwards
+  return (true == volume.fat32) ? 0x08000000 : 0x8000;
+}   // End of FATChecker::cleanBit()
+
+// WARNING: Don't set errno and return -1 in this function - just return 0 for success or the errno code!
+int FATChecker::setCleanBit(BlockDevice * const device, const bool clean, bool * const wasClean)
+{
+  uint8_t * const buffer = new(std::nothrow) uint8_t[maxSectorSize];
+  if (nullptr == buffer)
+  {
+    return ENOMEM;
+  }
+  if (0 != device->init())
+  {
+    delete[] buffer;
+    return EIO;
+  }
+  struct Volume volume;
+  int ret = locateVolume(device, buffer, &volume);
+  if (0 == ret)
+  {
+    // Entry 1 is always in the first sector of the FAT
+    ret = readSector(device, volume, volume.fatStart, buffer);
+  }
+  if (0 == ret)
+  {
+    const uint32_t bit = cleanBit(volume);
+    const uint32_t value = (true == volume.fat32) ? load32(buffer + 4) : load16(buffer + 2);
+    *wasClean = (0 != (value & bit));
+    if ((*wasClean) != clean)
+    {
+      const uint32_t newValue = (true == clean) ? (value | bit) : (value & ~bit);
+      if (true == volume.fat32)
+      {
+        store32(buffer + 4, newValue);
+      }
+      else
+      {
+        store16(buffer + 2, static_cast<uint16_t>(newValue));
+      }
+      for (uint32_t i = 0; (i < volume.numberOfFATs) && (0 == ret); i++)
+      {
+        ret = writeSector(device, volume, volume.fatStart + (i * volume.fatSectors), buffer);
+      }
+      if ((0 == ret) && (0 != device->sync()))
+      {
+        ret = EIO;
+      }
+    }
+  }
+  (void) device->deinit();
+  delete[] buffer;
+  return ret;
+}   // End of FATChecker::setCleanBit()
+
+// WARNING: Don't set errno and return -1 in this function - just return 0 for success or the errno code!
+int FATChecker::markVolumeDirty(BlockDevice * const device, bool * const wasClean)
+{
+  return setCleanBit(device, false, wasClean);
+}   // End of FATChecker::markVolumeDirty()
+
+// WARNING: Don't set errno and return -1 in this function - just return 0 for success or the errno code!
+int FATChecker::markVolumeClean(BlockDevice * const device)
+{
+  bool wasClean = false;
+  return setCleanBit(device, true, &wasClean);
+}   // End of FATChecker::markVolumeClean()
+
+/*
+*********************************************************************************************************
+*                                     FATChecker member functions
+*********************************************************************************************************
+*/
+
+FATChecker::FATChecker(BlockDevice * const checkedDevice, const enum FsckModes checkMode)
+  : device(checkedDevice),
+    mode(checkMode),
+    phase(PHASE_OPEN),
+    deviceInitialized(false),
+    volume(),
+    report(),
+    bitmap(nullptr),
+    windowStart(2),
+    sweepCluster(2),
+    rewalk(false),
+    fatBuffer(nullptr),
+    fatBufferSector(0),
+    fatBufferDirty(false),
+    directoryBuffer(nullptr),
+    directoryBufferSector(0),
+    depth(0),
+    chain()
+{
+}   // End of FATChecker::FATChecker()
+
+FATChecker::~FATChecker()
+{
+  if (true == deviceInitialized)
+  {
+    // Abandoned part way, so keep what has been repaired so far. The volume is still marked as
+    // not cleanly unmounted, so the next check starts over.
+    (void) flushFAT();
+    (void) device->deinit();
+  }
+  delete[] bitmap;
+  delete[] fatBuffer;
+  delete[] directoryBuffer;
+}   // End of FATChecker::~FATChecker()
+
+// WARNING: Don't set errno and return -1 in this function - just return 0 for success or the errno code!
+int FATChecker::step(const uint32_t budgetMicroseconds)
+{
+  const uint32_t startMicroseconds = micros();
+  while (PHASE_DONE != phase)
+  {
+    int ret = 0;
+    switch (phase)
+    {
+      case PHASE_OPEN:
+        ret = open();
+        break;
+      case PHASE_WALK:
+        ret = walkStep();
+        break;
+      case PHASE_SWEEP:
+        ret = sweepStep();
+        break;
+      case PHASE_FINISH:
+        ret = finish();
+        break;
+      default:
+        ret = EFAULT;   // This shouldn't happen unless there's a bug in the code
+        break;
+    }
+    if (0 != ret)
+    {
+      phase = PHASE_DONE;
+      return ret;
+    }
+    // Every step reads or writes at most a few sectors, so this is where the budget is checked
+    if ((PHASE_DONE != phase) && (0 != budgetMicroseconds) && ((micros() - startMicroseconds) >= budgetMicroseconds))
+    {
+      return EINPROGRESS;
+    }
+  }
+  return 0;
+}   // End of FATChecker::step()
+
+void FATChecker::getReport(struct FsckReport * const checkReport) const
+{
+  *checkReport = report;
+  if (PHASE_DONE == phase)
+  {
+    checkReport->progressPercent = 100;
+  }
+  else if ((PHASE_WALK == phase) || (PHASE_SWEEP == phase))
+  {
+    // Based on the swept clusters only, the walks take about the same time for every window
+    const uint32_t swept = ((PHASE_SWEEP == phase) ? sweepCluster : windowStart) - 2;
+    checkReport->progressPercent = static_cast<uint8_t>((static_cast<uint64_t>(swept) * 99) / (volume.maxCluster - 1));
+  }
+  else
+  {
+    checkReport->progressPercent = 0;
+  }
+}   // End of FATChecker::getReport()
+
+// WARNING: Don't set errno and return -1 in this function - just return 0 for success or the errno code!
+int FATChecker::open()
+{
+  fatBuffer = new(std::nothrow) uint8_t[maxSectorSize];
+  if (nullptr == fatBuffer)
+  {
+    return ENOMEM;
+  }
+  if (0 != device->init())
+  {
+    return EIO;
+  }
+  deviceInitialized = true;
+  const int locateReturn = locateVolume(device, fatBuffer, &volume);
+  if (0 != locateReturn)
+  {
+    return locateReturn;
+  }
+  directoryBuffer = new(std::nothrow) uint8_t[volume.sectorSize];
+  bitmap = new(std::nothrow) uint8_t[FSCK_BITMAP_SIZE];
+  if ((nullptr == directoryBuffer) || (nullptr == bitmap))
+  {
+    return ENOMEM;
+  }
+  uint32_t entry1 = 0;
+  const int readReturn = readFATEntry(1, &entry1);
+  if (0 != readReturn)
+  {
+    return readReturn;
+  }
+  report.wasClean = (0 != (entry1 & cleanBit(volume)));
+  // The fast path: a volume that was cleanly unmounted is consistent as far as FatFs is concerned
+  if ((FSCK_AUTO == mode) && (true == report.wasClean))
+  {
+    phase = PHASE_FINISH;
+    return 0;
+  }
+  report.checked = true;
+  windowStart = 2;
+  beginWindow();
+  phase = PHASE_WALK;
+  return 0;
+}   // End of FATChecker::open()
+
+void FATChecker::beginWindow()
+{
+  memset(bitmap, 0, FSCK_BITMAP_SIZE);
+  depth = 0;
+  chain.active = false;
+  sweepCluster = windowStart;
+  if (true == volume.fat32)
+  {
+    // The root directory is a cluster chain without a directory entry. startChain() can't fail
+    // here, because parseBootSector() checked the root cluster.
+    (void) startChain(volume.rootCluster, true, 0, 0, 0);
+  }
+  else
+  {
+    stack[0].cluster = 0;
+    stack[0].sector = 0;
+    stack[0].entry = 0;
+    stack[0].clustersVisited = 0;
+    depth = 1;
+  }
+}   // End of FATChecker::beginWindow()
+
+// WARNING: Don't set errno and return -1 in this function - just return 0 for success or the errno code!
+int FATChecker::walkStep()
+{
+  if (true == chain.active)
+  {
+    return chainStep();
+  }
+  if (0 == depth)
+  {
+    phase = PHASE_SWEEP;
+    return 0;
+  }
+  return directoryStep();
+}   // End of FATChecker::walkStep()
+
+// WARNING: Don't set errno and return -1 in this function - just return 0 for success or the errno code!
+int FATChecker::startChain(const uint32_t start,
+                           const bool isDirectory,
+                           const uint32_t entrySector,
+                           const uint32_t entryOffset,
+                           const uint32_t fileSize)
+{
+  // Problems that don't depend on the window are counted and repaired in the first window only
+  if (0 == start)
+  {
+    if ((true == isDirectory) || (0 != fileSize))
+    {
+      if (true == isFirstWindow())
+      {
+        report.badEntries++;
+        if (true == repairing())
+        {
+          // A directory without clusters has no "." and ".." entries, so there's nothing to keep
+          return (true == isDirectory) ? removeEntry(entrySector, entryOffset) : setEntry(entrySector, entryOffset, 0, 0);
+        }
+      }
+    }
+    return 0;
+  }
+  if ((start < 2) || (start > volume.maxCluster))
+  {
+    if (0 == entrySector)
+    {
+      return EIO;   // The FAT32 root directory, there's no way to find anything
+    }
+    if (true == isFirstWindow())
+    {
+      report.badEntries++;
+      if (true == repairing())
+      {
+        return (true == isDirectory) ? removeEntry(entrySector, entryOffset) : setEntry(entrySector, entryOffset, 0, 0);
+      }
+    }
+    return 0;
+  }
+  chain.active = true;
+  chain.isDirectory = isDirectory;
+  chain.start = start;
+  chain.cluster = start;
+  chain.previous = 0;
+  chain.length = 0;
+  chain.entrySector = entrySector;
+  chain.entryOffset = entryOffset;
+  chain.fileSize = fileSize;
+  return 0;
+}   // End of FATChecker::startChain()
+
+// WARNING: Don't set errno and return -1 in this function - just return 0 for success or the errno code!
+int FATChecker::chainStep()
+{
+  uint32_t value = 0;
+  int ret = readFATEntry(chain.cluster, &value);
+  if (0 != ret)
+  {
+    return ret;
+  }
+  // The chain runs into a cluster that isn't allocated
+  if ((0 == value) || (true == isBad(value)))
+  {
+    if (0 == chain.previous)
+    {
+      chain.active = false;
+      if (0 == chain.entrySector)
+      {
+        return EIO;
+      }
+      if (true == isFirstWindow())
+      {
+        report.badEntries++;
+        if (true == repairing())
+        {
+          return (true == chain.isDirectory) ? removeEntry(chain.entrySector, chain.entryOffset) :
+                                               setEntry(chain.entrySector, chain.entryOffset, 0, 0);
+        }
+      }
+      return 0;
+    }
+    if (true == isFirstWindow())
+    {
+      report.brokenChains++;
+      if (true == repairing())
+      {
+        ret = writeFATEntry(chain.previous, (true == volume.fat32) ? 0x0FFFFFFF : 0xFFFF);
+        if (0 != ret)
+        {
+          return ret;
+        }
+      }
+    }
+    return endChain(true);
+  }
+  if (true == inWindow(chain.cluster))
+  {
+    if (true == isMarked(chain.cluster))
+    {
+      // Reached before, by another chain or earlier in this one. The first one to get here keeps it.
+      report.crossLinks++;
+      if (true == repairing())
+      {
+        // Cutting a shared chain leaves clusters behind that were marked, maybe in a window that
+        // is swept already, and changes chains that were walked already
+        rewalk = true;
+      }
+      if (0 == chain.previous)
+      {
+        chain.active = false;
+        if (0 == chain.entrySector)
+        {
+          return EIO;
+        }
+        if (true == repairing())
+        {
+          return (true == chain.isDirectory) ? removeEntry(chain.entrySector, chain.entryOffset) :
+                                               setEntry(chain.entrySector, chain.entryOffset, 0, 0);
+        }
+        return 0;
+      }
+      if (true == repairing())
+      {
+        ret = writeFATEntry(chain.previous, (true == volume.fat32) ? 0x0FFFFFFF : 0xFFFF);
+        if (0 != ret)
+        {
+          return ret;
+        }
+      }
+      return endChain(true);
+    }
+    mark(chain.cluster);
+  }
+  chain.length++;
+  if (true == isEndOfChain(value))
+  {
+    return endChain(false);
+  }
+  if ((value < 2) || (value > volume.maxCluster))
+  {
+    if (true == isFirstWindow())
+    {
+      report.brokenChains++;
+      if (true == repairing())
+      {
+        ret = writeFATEntry(chain.cluster, (true == volume.fat32) ? 0x0FFFFFFF : 0xFFFF);
+        if (0 != ret)
+        {
+          return ret;
+        }
+      }
+    }
+    return endChain(true);
+  }
+  if (chain.length > volume.maxCluster)
+  {
+    // A loop outside this window. It's found and cut by the walk of the window it's in.
+    return endChain(false);
+  }
+  chain.previous = chain.cluster;
+  chain.cluster = value;
+  return 0;
+}   // End of FATChecker::chainStep()
+
+// WARNING: Don't set errno and return -1 in this function - just return 0 for success or the errno code!
+int FATChecker::endChain(const bool truncated)
+{
+  chain.active = false;
+  if (true == chain.isDirectory)
+  {
+    if (maxDepth == depth)
+    {
+      return ELOOP;   // Too deep to check, or a directory that contains itself
+    }
+    stack[depth].cluster = chain.start;
+    stack[depth].sector = 0;
+    stack[depth].entry = 0;
+    stack[depth].clustersVisited = 0;
+    depth++;
+    return 0;
+  }
+  // A file larger than its chain can't be read to the end, so cut it down to what is there.
+  // Truncations by cross-links can happen in any window, the rest only in the first one.
+  const uint64_t capacity = static_cast<uint64_t>(chain.length) * volume.sectorsPerCluster * volume.sectorSize;
+  if ((chain.fileSize > capacity) && ((true == truncated) || (true == isFirstWindow())))
+  {
+    if (false == truncated)
+    {
+      report.badEntries++;
+    }
+    if (true == repairing())
+    {
+      return setEntry(chain.entrySector, chain.entryOffset, chain.start, static_cast<uint32_t>(capacity));
+    }
+  }
+  return 0;
+}   // End of FATChecker::endChain()
+
+// WARNING: Don't set errno and return -1 in this function - just return 0 for success or the errno code!
+int FATChecker::directoryStep()
+{
+  struct DirectoryFrame &frame = stack[depth - 1];
+  uint32_t sector = 0;
+  if (0 == frame.cluster)
+  {
+    if (frame.sector >= volume.rootDirectorySectors)
+    {
+      depth--;
+      return 0;
+    }
+    sector = volume.rootDirectoryStart + frame.sector;
+  }
+  else
+  {
+    if (frame.sector >= volume.sectorsPerCluster)
+    {
+      uint32_t next = 0;
+      const int ret = readFATEntry(frame.cluster, &next);
+      if (0 != ret)
+      {
+        return ret;
+      }
+      frame.clustersVisited++;
+      // The chain itself has been checked already, so anything but a valid cluster ends the directory
+      if ((next < 2) || (next > volume.maxCluster) || (frame.clustersVisited > volume.maxCluster))
+      {
+        depth--;
+        return 0;
+      }
+      frame.cluster = next;
+      frame.sector = 0;
+      frame.entry = 0;
+      return 0;
+    }
+    sector = volume.dataStart + ((frame.cluster - 2) * volume.sectorsPerCluster) + frame.sector;
+  }
+  if (frame.entry >= (volume.sectorSize / entrySize))
+  {
+    frame.sector++;
+    frame.entry = 0;
+    return 0;
+  }
+  const int loadReturn = loadDirectorySector(sector);
+  if (0 != loadReturn)
+  {
+    return loadReturn;
+  }
+  const uint32_t offset = frame.entry * entrySize;
+  frame.entry++;
+  const uint8_t * const entry = directoryBuffer + offset;
+  if (entryEndOfDirectory == entry[0])
+  {
+    depth--;
+    return 0;
+  }
+  const uint8_t attributes = entry[entryAttributes];
+  if ((entryDeleted == entry[0]) || (attributeLongName == (attributes & attributeMask)) ||
+      (0 != (attributes & attributeVolumeLabel)) || ('.' == entry[0]))
+  {
+    return 0;   // Nothing of its own to follow, "." and ".." point to directories that are walked anyway
+  }
+  uint32_t start = load16(entry + entryClusterLow);
+  if (true == volume.fat32)
+  {
+    start |= static_cast<uint32_t>(load16(entry + entryClusterHigh)) << 16;
+  }
+  return startChain(start, (0 != (attributes & attributeDirectory)), sector, offset, load32(entry + entryFileSize));
+}   // End of FATChecker::directoryStep()
+
+// WARNING: Don't set errno and return -1 in this function - just return 0 for success or the errno code!
+int FATChecker::sweepStep()
+{
+  const uint64_t windowEnd = static_cast<uint64_t>(windowStart) + (static_cast<uint64_t>(FSCK_BITMAP_SIZE) * 8);
+  if ((sweepCluster > volume.maxCluster) || (sweepCluster >= windowEnd))
+  {
+    if ((windowEnd > volume.maxCluster) && (false == rewalk))
+    {
+      phase = PHASE_FINISH;
+    }
+    else if (windowEnd > volume.maxCluster)
+    {
+      // Once more from the first window, until a pass doesn't cut any chain
+      rewalk = false;
+      windowStart = 2;
+      beginWindow();
+      phase = PHASE_WALK;
+    }
+    else
+    {
+      windowStart = static_cast<uint32_t>(windowEnd);
+      beginWindow();
+      phase = PHASE_WALK;
+    }
+    return 0;
+  }
+  uint32_t value = 0;
+  const int ret = readFATEntry(sweepCluster, &value);
+  if (0 != ret)
+  {
+    return ret;
+  }
+  // Allocated, but not part of any file or directory
+  if ((0 != value) && (false == isBad(value)) && (false == isMarked(sweepCluster)))
+  {
+    report.lostClusters++;
+    if (true == isEndOfChain(value))
+    {
+      report.lostChains++;    // Every chain has one end
+    }
+    if (true == repairing())
+    {
+      const int writeReturn = writeFATEntry(sweepCluster, 0);
+      if (0 != writeReturn)
+      {
+        return writeReturn;
+      }
+    }
+  }
+  sweepCluster++;
+  return 0;
+}   // End of FATChecker::sweepStep()
+
+// WARNING: Don't set errno and return -1 in this function - just return 0 for success or the errno code!
+int FATChecker::finish()
+{
+  if (true == report.checked)
+  {
+    const uint32_t problems = report.lostClusters + report.crossLinks + report.brokenChains + report.badEntries;
+    if (true == repairing())
+    {
+      // FatFs trusts the free cluster count in FSInfo, which is wrong now
+      if ((0 != problems) && (0 != volume.fsInfoSector))
+      {
+        int ret = loadDirectorySector(volume.fsInfoSector);
+        if (0 != ret)
+        {
+          return ret;
+        }
+        if ((fsInfoLeadSignature == load32(directoryBuffer)) && (fsInfoStructSignature == load32(directoryBuffer + 484)))
+        {
+          store32(directoryBuffer + 488, 0xFFFFFFFF);   // Free count unknown
+          store32(directoryBuffer + 492, 0xFFFFFFFF);   // No hint for the next free cluster
+          ret = writeSector(device, volume, volume.fsInfoSector, directoryBuffer);
+          if (0 != ret)
+          {
+            return ret;
+          }
+        }
+      }
+      uint32_t entry1 = 0;
+      int ret = readFATEntry(1, &entry1);
+      if (0 == ret)
+      {
+        ret = writeFATEntry(1, entry1 | cleanBit(volume));
+      }
+      if (0 != ret)
+      {
+        return ret;
+      }
+      report.repaired = (0 != problems);
+    }
+    const int flushReturn = flushFAT();
+    if (0 != flushReturn)
+    {
+      return flushReturn;
+    }
+    if (0 != device->sync())
+    {
+      return EIO;
+    }
+  }
+  deviceInitialized = false;
+  (void) device->deinit();
+  phase = PHASE_DONE;
+  return 0;
+}   // End of FATChecker::finish()
+
+// WARNING: Don't set errno and return -1 in this function - just return 0 for success or the errno code!
+int FATChecker::removeEntry(const uint32_t sector, const uint32_t offset)
+{
+  const int ret = loadDirectorySector(sector);
+  if (0 != ret)
+  {
+    return ret;
+  }
+  directoryBuffer[offset] = entryDeleted;
+  return writeSector(device, volume, sector, directoryBuffer);
+}   // End of FATChecker::removeEntry()
+
+// WARNING: Don't set errno and return -1 in this function - just return 0 for success or the errno code!
+int FATChecker::setEntry(const uint32_t sector, const uint32_t offset, const uint32_t start, const uint32_t fileSize)
+{
+  const int ret = loadDirectorySector(sector);
+  if (0 != ret)
+  {
+    return ret;
+  }
+  uint8_t * const entry = directoryBuffer + offset;
+  store16(entry + entryClusterLow, static_cast<uint16_t>(start));
+  if (true == volume.fat32)
+  {
+    store16(entry + entryClusterHigh, static_cast<uint16_t>(start >> 16));
+  }
+  store32(entry + entryFileSize, fileSize);
+  return writeSector(device, volume, sector, directoryBuffer);
+}   // End of FATChecker::setEntry()
+
+// WARNING: Don't set errno and return -1 in this function - just return 0 for success or the errno code!
+int FATChecker::readFATEntry(const uint32_t cluster, uint32_t * const value)
+{
+  const uint32_t byteOffset = cluster * ((true == volume.fat32) ? 4 : 2);
+  const uint32_t sector = volume.fatStart + static_cast<uint32_t>(byteOffset / volume.sectorSize);
+  const uint32_t offset = static_cast<uint32_t>(byteOffset % volume.sectorSize);
+  if (sector != fatBufferSector)
+  {
+    int ret = flushFAT();
+    if (0 != ret)
+    {
+      return ret;
+    }
+    fatBufferSector = 0;
+    ret = readSector(device, volume, sector, fatBuffer);
+    if (0 != ret)
+    {
+      return ret;
+    }
+    fatBufferSector = sector;
+  }
+  *value = (true == volume.fat32) ? (load32(fatBuffer + offset) & 0x0FFFFFFF) : load16(fatBuffer + offset);
+  return 0;
+}   // End of FATChecker::readFATEntry()
+
+// WARNING: Don't set errno and return -1 in this function - just return 0 for success or the errno code!
+int FATChecker::writeFATEntry(const uint32_t cluster, const uint32_t value)
+{
+  // Loads the right sector
+  uint32_t oldValue = 0;
+  const int ret = readFATEntry(cluster, &oldValue);
+  if (0 != ret)
+  {
+    return ret;
+  }
+  const uint32_t offset = static_cast<uint32_t>((cluster * ((true == volume.fat32) ? 4 : 2)) % volume.sectorSize);
+  if (true == volume.fat32)
+  {
+    // The top 4 bits are reserved and must be kept as they are
+    store32(fatBuffer + offset, (load32(fatBuffer + offset) & 0xF0000000) | (value & 0x0FFFFFFF));
+  }
+  else
+  {
+    store16(fatBuffer + offset, static_cast<uint16_t>(value));
+  }
+  fatBufferDirty = true;
+  return 0;
+}   // End of FATChecker::writeFATEntry()
+
+// WARNING: Don't set errno and return -1 in this function - just return 0 for success or the errno code!
+int FATChecker::flushFAT()
+{
+  if (false == fatBufferDirty)
+  {
+    return 0;
+  }
+  // Every copy of the FAT gets the same contents
+  for (uint32_t i = 0; i < volume.numberOfFATs; i++)
+  {
+    const int ret = writeSector(device, volume, fatBufferSector + (i * volume.fatSectors), fatBuffer);
+    if (0 != ret)
+    {
+      return ret;
+    }
+  }
+  fatBufferDirty = false;
+  return 0;
+}   // End of FATChecker::flushFAT()
+
+// WARNING: Don't set errno and return -1 in this function - just return 0 for success or the errno code!
+int FATChecker::loadDirectorySector(const uint32_t sector)
+{
+  if (sector == directoryBufferSector)
+  {
+    return 0;
+  }
+  directoryBufferSector = 0;
+  const int ret = readSector(device, volume, sector, directoryBuffer);
+  if (0 != ret)
+  {
+    return ret;
+  }
+  directoryBufferSector = sector;
+  return 0;
+}   // End of FATChecker::loadDirectorySector()
+
+bool FATChecker::isEndOfChain(const uint32_t value) const
+{
+  return (value >= ((true == volume.fat32) ? 0x0FFFFFF8u : 0xFFF8u));
+}   // End of FATChecker::isEndOfChain()
+
+bool FATChecker::isBad(const uint32_t value) const
+{
+  return (value == ((true == volume.fat32) ? 0x0FFFFFF7u : 0xFFF7u));
+}   // End of FATChecker::isBad()
+
+bool FATChecker::inWindow(const uint32_t cluster) const
+{
+  return ((cluster >= windowStart) && ((cluster - windowStart) < (static_cast<uint32_t>(FSCK_BITMAP_SIZE) * 8)));
+}   // End of FATChecker::inWindow()
+
+bool FATChecker::isMarked(const uint32_t cluster) const
+{
+  const uint32_t bit = cluster - windowStart;
+  return (0 != (bitmap[bit / 8] & (1 << (bit % 8))));
+}   // End of FATChecker::isMarked()
+
+void FATChecker::mark(const uint32_t cluster)
+{
+  const uint32_t bit = cluster - windowStart;
+  bitmap[bit / 8] |= static_cast<uint8_t>(1 << (bit % 8));
+}   // End of FATChecker::mark()
+
+bool FATChecker::isFirstWindow() const
+{
+  return (2 == windowStart);
+}   // End of FATChecker::isFirstWindow()
+
+bool FATChecker::repairing() const
+{
+  return (FSCK_CHECK_ONLY != mode);
+}   // End of FATChecker::repairing()
@@ -0,0 +1,178 @@
+/*
+*********************************************************************************************************
+*                                      Arduino_POSIXStorage Library
+*
+*                            Copyright 2023 Arduino SA. http://arduino.cc
+*
+*                    Checks and repairs FAT16 and FAT32 volumes in bounded time slices, and
+*                    tracks whether a volume was cleanly unmounted.
+*
+*
+*                             SPDX-License-Identifier: LGPL-2.1-or-later
+*
+*                    This library is free software; you can redistribute it and/or
+*                    modify it under the terms of the GNU Lesser General Public
+*                    License as published by the Free Software Foundation; either
+*                    version 2.1 of the License, or (at your option) any later version.
+*
+*                    This library is distributed in the hope that it will be useful,
+*                    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*                    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*                    Lesser General Public License for more details.
+*
+*                    You should have received a copy of the GNU Lesser General
+*                    Public License along with this library; if not, write to the
+*                    Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+*                    Boston, MA  02111-1307  USA
+*
+*********************************************************************************************************
+*/
+
+#ifndef FATChecker_H
+#define FATChecker_H
+
+#include "Arduino_POSIXStorage.h"
+
+#if defined(ARDUINO_PORTENTA_H7_M7) || defined(ARDUINO_OPTA)
+  #include <BlockDevice.h>
+  using mbed::BlockDevice;
+  using mbed::bd_addr_t;
+  using mbed::bd_size_t;
+#endif
+
+// Works on the raw sectors of an unmounted device, because FatFs has no interface to its FAT.
+//
+// A check walks the directory tree and follows the cluster chain of every entry, marking the
+// clusters it reaches in a bitmap, then sweeps the FAT for allocated clusters that weren't
+// reached (lost chains) and frees them. A cluster reached twice is a cross-link, and the chain
+// that reached it second is truncated in front of it. Chains that run into a free or invalid
+// cluster are terminated where they break, and file sizes are cut down to what their chains can
+// hold. Only FSCK_BITMAP_SIZE bytes of bitmap are used, so a volume with more clusters than
+// (8 * FSCK_BITMAP_SIZE) is handled as several windows, with a walk and a sweep for each.
+// Truncating a cross-linked chain can leave clusters behind that were marked already, in this
+// or an earlier window, so after a repaired cross-link all the windows are checked once more.
+// The volume is only marked clean after a pass that didn't cut any chain.
+//
+// All state is kept in this object, so step() can return after a time budget and carry on where
+// it left off in the next call. A check that is interrupted by a power loss leaves the volume
+// marked as not cleanly unmounted, so it just runs again.
+class FATChecker {
+public:
+  FATChecker(BlockDevice *device, enum FsckModes mode);
+  ~FATChecker();
+
+  // WARNING: These return 0 for success or an errno code, they don't set errno!
+  // Returns 0 when done, EINPROGRESS when there's more to do, or another errno code on failure.
+  // A budgetMicroseconds of 0 means until done.
+  int step(uint32_t budgetMicroseconds);
+  void getReport(struct FsckReport *report) const;
+
+  // Set and restore the "cleanly unmounted" bit in FAT entry 1 around a read-write mount.
+  // markVolumeDirty() reports whether the bit was set, so that a volume that was already dirty
+  // isn't marked clean again before it has been checked. ENOTSUP if the device doesn't hold a
+  // FAT16 or FAT32 volume. The device must not be initialized by anyone else at the time.
+  static int markVolumeDirty(BlockDevice *device, bool *wasClean);
+  static int markVolumeClean(BlockDevice *device);
+
+private:
+  enum Phases : uint8_t
+  {
+    PHASE_OPEN,
+    PHASE_WALK,
+    PHASE_SWEEP,
+    PHASE_FINISH,
+    PHASE_DONE
+  };
+
+  struct Volume {
+    bd_size_t sectorSize;
+    bd_addr_t volumeOffset;       // In bytes, sector numbers are relative to this
+    uint32_t fatStart;
+    uint32_t fatSectors;          // Per copy of the FAT
+    uint32_t numberOfFATs;
+    uint32_t rootDirectoryStart;  // FAT16 only
+    uint32_t rootDirectorySectors;
+    uint32_t dataStart;
+    uint32_t sectorsPerCluster;
+    uint32_t maxCluster;          // Valid clusters are 2 to maxCluster
+    uint32_t rootCluster;         // FAT32 only
+    uint32_t fsInfoSector;        // FAT32 only, 0 if there is none
+    bool fat32;
+  };
+
+  struct DirectoryFrame {
+    uint32_t cluster;             // 0 for the FAT16 root directory
+    uint32_t sector;              // Within the cluster, or within the FAT16 root directory
+    uint32_t entry;               // Within the sector
+    uint32_t clustersVisited;
+  };
+
+  struct ChainWalk {
+    bool active;
+    bool isDirectory;
+    uint32_t start;
+    uint32_t cluster;
+    uint32_t previous;            // 0 while at the first cluster
+    uint32_t length;              // Clusters followed so far
+    uint32_t entrySector;         // Where the directory entry is, for repairs. 0 for the FAT32 root directory.
+    uint32_t entryOffset;
+    uint32_t fileSize;
+  };
+
+  static constexpr size_t maxDepth = 32;
+  static constexpr bd_size_t maxSectorSize = 4096;
+
+  static bool parseBootSector(const uint8_t *sector, bd_addr_t offset, struct Volume *volume);
+  static int locateVolume(BlockDevice *device, uint8_t *scratch, struct Volume *volume);
+  static int readSector(BlockDevice *device, const struct Volume &volume, uint32_t sector, uint8_t *buffer);
+  static int writeSector(BlockDevice *device, const struct Volume &volume, uint32_t sector, const uint8_t *buffer);
+  static int setCleanBit(BlockDevice *device, bool clean, bool *wasClean);
+  static uint32_t cleanBit(const struct Volume &volume);
+
+  int open();
+  int walkStep();
+  int chainStep();
+  int directoryStep();
+  int sweepStep();
+  int finish();
+  void beginWindow();
+  int startChain(uint32_t start, bool isDirectory, uint32_t entrySector, uint32_t entryOffset, uint32_t fileSize);
+  int endChain(bool truncated);
+  int removeEntry(uint32_t sector, uint32_t offset);
+  int setEntry(uint32_t sector, uint32_t offset, uint32_t start, uint32_t fileSize);
+  int readFATEntry(uint32_t cluster, uint32_t *value);
+  int writeFATEntry(uint32_t cluster, uint32_t value);
+  int flushFAT();
+  int loadDirectorySector(uint32_t sector);
+  bool isEndOfChain(uint32_t value) const;
+  bool isBad(uint32_t value) const;
+  bool inWindow(uint32_t cluster) const;
+  bool isMarked(uint32_t cluster) const;
+  void mark(uint32_t cluster);
+  bool isFirstWindow() const;
+  bool repairing() const;
+
+  BlockDevice * const device;
+  const enum FsckModes mode;
+  enum Phases phase;
+  bool deviceInitialized;
+  struct Volume volume;
+  struct FsckReport report;
+
+  uint8_t *bitmap;
+  uint32_t windowStart;
+  uint32_t sweepCluster;
+  bool rewalk;                    // A cross-link was cut, so all windows are checked once more
+
+  uint8_t *fatBuffer;
+  uint32_t fatBufferSector;       // 0 if nothing is loaded, sector 0 is never part of a FAT
+  bool fatBufferDirty;
+  uint8_t *directoryBuffer;
+  uint32_t directoryBufferSector; // 0 if nothing is loaded
+
+  struct DirectoryFrame stack[maxDepth];
+  size_t depth;
+  struct ChainWalk chain;
+};
+
+#endif  // FATChecker_H
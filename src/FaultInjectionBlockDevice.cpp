@@ -0,0 +1,179 @@
+/*
+*********************************************************************************************************
+*                                      Arduino_POSIXStorage Library
+*
+*                            Copyright 2023 Arduino SA. http://arduino.cc
+*
+*                    Block device that injects delays, errors, and removal of the device, for
+*                    testing how the library and sketches cope with degraded media.
+*
+*
+*                             SPDX-License-Identifier: LGPL-2.1-or-later
+*
+*                    This library is free software; you can redistribute it and/or
+*                    modify it under the terms of the GNU Lesser General Public
+*                    License as published by the Free Software Foundation; either
+*                    version 2.1 of the License, or (at your option) any later version.
+*
+*                    This library is distributed in the hope that it will be useful,
+*                    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*                    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*                    Lesser General Public License for more details.
+*
+*                    You should have received a copy of the GNU Lesser General
+*                    Public License along with this library; if not, write to the
+*                    Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+*                    Boston, MA  02111-1307  USA
+*
+*********************************************************************************************************
+*/
+
+/*
+*********************************************************************************************************
+*                                         Included header files
+*********************************************************************************************************
+*/
+
+#include "FaultInjectionBlockDevice.h"
+
+#include <Arduino.h>
+
+/*
+*********************************************************************************************************
+*                               FaultInjectionBlockDevice member functions
+*********************************************************************************************************
+*/
+
+FaultInjectionBlockDevice::FaultInjectionBlockDevice(BlockDevice * const underlyingDevice,
+                                                     const struct FaultInjectionSettings &injectionSettings,
+                                                     struct FaultInjectionStatistics * const injectionStatistics)
+  : ForwardingBlockDevice(underlyingDevice),
+    settings(injectionSettings),
+    statistics(injectionStatistics),
+    // Each mount continues with different numbers, but the same settings still repeat the same run
+    randomState(injectionSettings.seed ^ (injectionStatistics->operations * 2654435761u))
+{
+  // Xorshift never leaves 0
+  if (0 == randomState)
+  {
+    randomState = 0x9E3779B9;
+  }
+}   // End of FaultInjectionBlockDevice::FaultInjectionBlockDevice()
+
+FaultInjectionBlockDevice::~FaultInjectionBlockDevice()
+{
+}   // End of FaultInjectionBlockDevice::~FaultInjectionBlockDevice()
+
+int FaultInjectionBlockDevice::init()
+{
+  // A removed device can't be mounted again, but deinit() still works like on a real one
+  if (true == statistics->removed)
+  {
+    statistics->removedErrors++;
+    return BD_ERROR_DEVICE_ERROR;
+  }
+  return underlying->init();
+}   // End of FaultInjectionBlockDevice::init()
+
+int FaultInjectionBlockDevice::sync()
+{
+  if (true == statistics->removed)
+  {
+    statistics->removedErrors++;
+    return BD_ERROR_DEVICE_ERROR;
+  }
+  return underlying->sync();
+}   // End of FaultInjectionBlockDevice::sync()
+
+int FaultInjectionBlockDevice::read(void * const buffer, const bd_addr_t addr, const bd_size_t size)
+{
+  const int faultReturn = injectFault(addr, size, settings.readErrorPermille);
+  if (0 != faultReturn)
+  {
+    return faultReturn;
+  }
+  return underlying->read(buffer, addr, size);
+}   // End of FaultInjectionBlockDevice::read()
+
+int FaultInjectionBlockDevice::program(const void * const buffer, const bd_addr_t addr, const bd_size_t size)
+{
+  // A failed program leaves the device as it was
+  const int faultReturn = injectFault(addr, size, settings.programErrorPermille);
+  if (0 != faultReturn)
+  {
+    return faultReturn;
+  }
+  return underlying->program(buffer, addr, size);
+}   // End of FaultInjectionBlockDevice::program()
+
+int FaultInjectionBlockDevice::erase(const bd_addr_t addr, const bd_size_t size)
+{
+  const int faultReturn = injectFault(addr, size, 0);
+  if (0 != faultReturn)
+  {
+    return faultReturn;
+  }
+  return underlying->erase(addr, size);
+}   // End of FaultInjectionBlockDevice::erase()
+
+int FaultInjectionBlockDevice::trim(const bd_addr_t addr, const bd_size_t size)
+{
+  const int faultReturn = injectFault(addr, size, 0);
+  if (0 != faultReturn)
+  {
+    return faultReturn;
+  }
+  return underlying->trim(addr, size);
+}   // End of FaultInjectionBlockDevice::trim()
+
+int FaultInjectionBlockDevice::injectFault(const bd_addr_t addr, const bd_size_t size, const uint16_t errorPermille)
+{
+  statistics->operations++;
+  if ((false == statistics->removed) &&
+      (0 != settings.removeAfterOperations) && (statistics->operations > settings.removeAfterOperations))
+  {
+    statistics->removed = true;
+  }
+  if (true == statistics->removed)
+  {
+    statistics->removedErrors++;
+    return BD_ERROR_DEVICE_ERROR;
+  }
+  uint32_t injectedDelay = settings.latencyMicroseconds;
+  if (0 != settings.latencyJitterMicroseconds)
+  {
+    injectedDelay += nextRandom() % (settings.latencyJitterMicroseconds + 1);
+  }
+  if ((0 != settings.stallPermille) && ((nextRandom() % 1000) < settings.stallPermille))
+  {
+    injectedDelay += settings.stallMicroseconds;
+    statistics->stalls++;
+  }
+  if (0 != injectedDelay)
+  {
+    // delayMicroseconds() is only accurate for short delays, and delay() lets other threads run
+    delay(injectedDelay / 1000);
+    delayMicroseconds(injectedDelay % 1000);
+    statistics->delayedMicroseconds += injectedDelay;
+  }
+  if ((0 != settings.badSize) && (addr < (settings.badStart + settings.badSize)) && (settings.badStart < (addr + size)))
+  {
+    statistics->permanentErrors++;
+    return BD_ERROR_DEVICE_ERROR;
+  }
+  if ((0 != errorPermille) && ((nextRandom() % 1000) < errorPermille))
+  {
+    statistics->transientErrors++;
+    return BD_ERROR_DEVICE_ERROR;
+  }
+  return 0;
+}   // End of FaultInjectionBlockDevice::injectFault()
+
+uint32_t FaultInjectionBlockDevice::nextRandom()
+{
+  // Xorshift32, which is plenty for picking faults and doesn't share state with the sketch's random()
+  randomState ^= randomState << 13;
+  randomState ^= randomState >> 17;
+  randomState ^= randomState << 5;
+  return randomState;
+}   // End of FaultInjectionBlockDevice::nextRandom()
@@ -0,0 +1,69 @@
+/*
+*********************************************************************************************************
+*                                      Arduino_POSIXStorage Library
+*
+*                            Copyright 2023 Arduino SA. http://arduino.cc
+*
+*                    Block device that injects delays, errors, and removal of the device, for
+*                    testing how the library and sketches cope with degraded media.
+*
+*
+*                             SPDX-License-Identifier: LGPL-2.1-or-later
+*
+*                    This library is free software; you can redistribute it and/or
+*                    modify it under the terms of the GNU Lesser General Public
+*                    License as published by the Free Software Foundation; either
+*                    version 2.1 of the License, or (at your option) any later version.
+*
+*                    This library is distributed in the hope that it will be useful,
+*                    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*                    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*                    Lesser General Public License for more details.
+*
+*                    You should have received a copy of the GNU Lesser General
+*                    Public License along with this library; if not, write to the
+*                    Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+*                    Boston, MA  02111-1307  USA
+*
+*********************************************************************************************************
+*/
+
+#ifndef FaultInjectionBlockDevice_H
+#define FaultInjectionBlockDevice_H
+
+#include "ForwardingBlockDevice.h"
+
+#if defined(ARDUINO_PORTENTA_H7_M7) || defined(ARDUINO_OPTA)
+  using mbed::BD_ERROR_DEVICE_ERROR;
+#endif
+
+// Sits right above the device, so that the block devices the library inserts and the file system
+// see its faults just like faults of the device. Reads, programs, erases, and trims are delayed
+// by the configured latency, and can fail with BD_ERROR_DEVICE_ERROR: at random, in a bad region,
+// or for good once the device counts as removed. The counters live outside the object, so that
+// they and the removal carry over from one mount to the next.
+class FaultInjectionBlockDevice : public ForwardingBlockDevice {
+public:
+  FaultInjectionBlockDevice(BlockDevice *underlyingDevice,
+                            const struct FaultInjectionSettings &settings,
+                            struct FaultInjectionStatistics *statistics);
+  virtual ~FaultInjectionBlockDevice();
+
+  virtual int init();
+  virtual int sync();
+  virtual int read(void *buffer, bd_addr_t addr, bd_size_t size);
+  virtual int program(const void *buffer, bd_addr_t addr, bd_size_t size);
+  virtual int erase(bd_addr_t addr, bd_size_t size);
+  virtual int trim(bd_addr_t addr, bd_size_t size);
+
+private:
+  // Returns 0 if the operation should go on to the device, or the error code to fail it with
+  int injectFault(bd_addr_t addr, bd_size_t size, uint16_t errorPermille);
+  uint32_t nextRandom();
+
+  const struct FaultInjectionSettings settings;
+  struct FaultInjectionStatistics * const statistics;
+  uint32_t randomState;
+};
+
+#endif  // FaultInjectionBlockDevice_H
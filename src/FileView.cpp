@@ -0,0 +1,272 @@
+/*
+*********************************************************************************************************
+*                                      Arduino_POSIXStorage Library
+*
+*                            Copyright 2023 Arduino SA. http://arduino.cc
+*
+*                    Read-only views of files, backed by a page cache, for random access without
+*                    going through stdio for every access.
+*
+*
+*                             SPDX-License-Identifier: LGPL-2.1-or-later
+*
+*                    This library is free software; you can redistribute it and/or
+*                    modify it under the terms of the GNU Lesser General Public
+*                    License as published by the Free Software Foundation; either
+*                    version 2.1 of the License, or (at your option) any later version.
+*
+*                    This library is distributed in the hope that it will be useful,
+*                    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*                    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*                    Lesser General Public License for more details.
+*
+*                    You should have received a copy of the GNU Lesser General
+*                    Public License along with this library; if not, write to the
+*                    Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+*                    Boston, MA  02111-1307  USA
+*
+*********************************************************************************************************
+*/
+
+/*
+*********************************************************************************************************
+*                                         Included header files
+*********************************************************************************************************
+*/
+
+#include "FileView.h"
+
+#include <Arduino.h>
+
+/*
+*********************************************************************************************************
+*                                       FileView member functions
+*********************************************************************************************************
+*/
+
+FileView::FileView(const enum StorageDevices viewDeviceName, const struct FileViewSettings &settings)
+  : deviceName(viewDeviceName),
+    pageSize((0 != settings.pageSize) ? settings.pageSize : defaultPageSize),
+    pageCount((0 != settings.pageCount) ? settings.pageCount : defaultPageCount),
+    prefetchPages(settings.prefetchPages),
+    isOpen(false),
+    fileSize(0),
+    filePosition(0),
+    useCounter(0),
+    pages(nullptr),
+    pageTable(nullptr),
+    straddleBuffer(nullptr)
+{
+}   // End of FileView::FileView()
+
+FileView::~FileView()
+{
+  (void) close();
+}   // End of FileView::~FileView()
+
+int FileView::open(FileSystem * const fileSystem, const char * const path)
+{
+  // Two pages at least, because a window that straddles two pages needs both. Prefetching must
+  // leave room for the page that was asked for. The pages are allocated in one piece, so their total
+  // size must fit in a size_t.
+  if ((pageCount < 2) || (prefetchPages >= pageCount) || (pageCount > (SIZE_MAX / pageSize)))
+  {
+    return EINVAL;
+  }
+  pages = new(std::nothrow) uint8_t[pageSize * pageCount];
+  pageTable = new(std::nothrow) struct Page[pageCount];
+  straddleBuffer = new(std::nothrow) uint8_t[pageSize];
+  if ((nullptr == pages) || (nullptr == pageTable) || (nullptr == straddleBuffer))
+  {
+    return ENOMEM;
+  }
+  for (size_t i = 0; i < pageCount; i++)
+  {
+    pageTable[i].valid = false;
+  }
+  // mbed's file functions return negative errno codes
+  const int openReturn = file.open(fileSystem, path, O_RDONLY);
+  if (0 != openReturn)
+  {
+    return -openReturn;
+  }
+  isOpen = true;
+  fileSize = file.size();
+  if (fileSize < 0)
+  {
+    return static_cast<int>(-fileSize);
+  }
+  filePosition = 0;
+  return 0;
+}   // End of FileView::open()
+
+int FileView::map(const off_t offset, const size_t length, const void ** const window, size_t * const mapped)
+{
+  if (false == isOpen)
+  {
+    return EBADF;
+  }
+  if ((offset < 0) || (offset >= fileSize) || (0 == length) || (length > pageSize))
+  {
+    return EINVAL;
+  }
+  // Shorter than asked for at the end of the file, like read()
+  const size_t available = ((fileSize - offset) < static_cast<off_t>(length)) ? static_cast<size_t>(fileSize - offset) : length;
+  const uint32_t firstPage = static_cast<uint32_t>(offset / static_cast<off_t>(pageSize));
+  const uint32_t lastPage = static_cast<uint32_t>((offset + available - 1) / static_cast<off_t>(pageSize));
+  const size_t offsetInPage = static_cast<size_t>(offset % static_cast<off_t>(pageSize));
+  size_t slot = 0;
+  int ret = getPage(firstPage, &slot);
+  if (0 != ret)
+  {
+    return ret;
+  }
+  if (firstPage == lastPage)
+  {
+    *window = pages + (slot * pageSize) + offsetInPage;
+    *mapped = available;
+    return 0;
+  }
+  // Copy the first part before the second page is fetched, which could evict the first one
+  const size_t firstLength = pageSize - offsetInPage;
+  memcpy(straddleBuffer, pages + (slot * pageSize) + offsetInPage, firstLength);
+  ret = getPage(lastPage, &slot);
+  if (0 != ret)
+  {
+    return ret;
+  }
+  memcpy(straddleBuffer + firstLength, pages + (slot * pageSize), available - firstLength);
+  *window = straddleBuffer;
+  *mapped = available;
+  return 0;
+}   // End of FileView::map()
+
+int FileView::close()
+{
+  int ret = 0;
+  if (true == isOpen)
+  {
+    isOpen = false;
+    ret = -file.close();
+  }
+  delete[] pages;
+  pages = nullptr;
+  delete[] pageTable;
+  pageTable = nullptr;
+  delete[] straddleBuffer;
+  straddleBuffer = nullptr;
+  return ret;
+}   // End of FileView::close()
+
+off_t FileView::size() const
+{
+  return fileSize;
+}   // End of FileView::size()
+
+enum StorageDevices FileView::getDeviceName() const
+{
+  return deviceName;
+}   // End of FileView::getDeviceName()
+
+int FileView::getPage(const uint32_t number, size_t * const slot)
+{
+  useCounter++;
+  *slot = findPage(number);
+  if (pageCount != *slot)
+  {
+    pageTable[*slot].lastUse = useCounter;
+    return 0;
+  }
+  *slot = leastRecentlyUsed(pageCount);
+  const int ret = loadPage(number, *slot);
+  if (0 != ret)
+  {
+    return ret;
+  }
+  // Read ahead while the file position is right there anyway. A failure here isn't the caller's
+  // problem, the page will just be read again when it's needed.
+  for (size_t i = 1; i <= prefetchPages; i++)
+  {
+    const uint32_t next = number + i;
+    if ((static_cast<off_t>(next) * static_cast<off_t>(pageSize)) >= fileSize)
+    {
+      break;
+    }
+    if (pageCount == findPage(next))
+    {
+      if (0 != loadPage(next, leastRecentlyUsed(*slot)))
+      {
+        break;
+      }
+    }
+  }
+  return 0;
+}   // End of FileView::getPage()
+
+int FileView::loadPage(const uint32_t number, const size_t slot)
+{
+  struct Page &page = pageTable[slot];
+  page.valid = false;
+  const off_t start = static_cast<off_t>(number) * static_cast<off_t>(pageSize);
+  const size_t length = ((fileSize - start) < static_cast<off_t>(pageSize)) ? static_cast<size_t>(fileSize - start) : pageSize;
+  if (start != filePosition)
+  {
+    const off_t seekReturn = file.seek(start, SEEK_SET);
+    if (seekReturn < 0)
+    {
+      filePosition = -1;    // Unknown, seek before the next read
+      return static_cast<int>(-seekReturn);
+    }
+    filePosition = start;
+  }
+  uint8_t * const destination = pages + (slot * pageSize);
+  size_t done = 0;
+  while (done < length)
+  {
+    const ssize_t readReturn = file.read(destination + done, length - done);
+    if (readReturn <= 0)
+    {
+      filePosition = -1;
+      return (readReturn < 0) ? static_cast<int>(-readReturn) : EIO;   // The file shrank under us
+    }
+    done += static_cast<size_t>(readReturn);
+  }
+  filePosition = start + static_cast<off_t>(length);
+  page.valid = true;
+  page.number = number;
+  page.lastUse = useCounter;
+  return 0;
+}   // End of FileView::loadPage()
+
+size_t FileView::findPage(const uint32_t number) const
+{
+  for (size_t i = 0; i < pageCount; i++)
+  {
+    if ((true == pageTable[i].valid) && (number == pageTable[i].number))
+    {
+      return i;
+    }
+  }
+  return pageCount;
+}   // End of FileView::findPage()
+
+size_t FileView::leastRecentlyUsed(const size_t excludedSlot) const
+{
+  size_t oldest = (0 == excludedSlot) ? 1 : 0;
+  for (size_t i = 0; i < pageCount; i++)
+  {
+    if (i == excludedSlot)
+    {
+      continue;
+    }
+    if (false == pageTable[i].valid)
+    {
+      return i;
+    }
+    if ((useCounter - pageTable[i].lastUse) > (useCounter - pageTable[oldest].lastUse))
+    {
+      oldest = i;
+    }
+  }
+  return oldest;
+}   // End of FileView::leastRecentlyUsed()
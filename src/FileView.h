@@ -0,0 +1,91 @@
+/*
+*********************************************************************************************************
+*                                      Arduino_POSIXStorage Library
+*
+*                            Copyright 2023 Arduino SA. http://arduino.cc
+*
+*                    Read-only views of files, backed by a page cache, for random access without
+*                    going through stdio for every access.
+*
+*
+*                             SPDX-License-Identifier: LGPL-2.1-or-later
+*
+*                    This library is free software; you can redistribute it and/or
+*                    modify it under the terms of the GNU Lesser General Public
+*                    License as published by the Free Software Foundation; either
+*                    version 2.1 of the License, or (at your option) any later version.
+*
+*                    This library is distributed in the hope that it will be useful,
+*                    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*                    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*                    Lesser General Public License for more details.
+*
+*                    You should have received a copy of the GNU Lesser General
+*                    Public License along with this library; if not, write to the
+*                    Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+*                    Boston, MA  02111-1307  USA
+*
+*********************************************************************************************************
+*/
+
+#ifndef FileView_H
+#define FileView_H
+
+#include "Arduino_POSIXStorage.h"
+
+#if defined(ARDUINO_PORTENTA_H7_M7) || defined(ARDUINO_OPTA)
+  using mbed::File;
+  using mbed::FileSystem;
+#endif
+
+// A file opened directly on the library's FileSystem object, with a cache of fixed size pages of
+// it. map() returns a pointer into a cached page, so repeated and nearby accesses don't reach the
+// file system at all. A window that straddles two pages is copied into a separate buffer. On a
+// miss, the pages that follow are read too, because parsers tend to move forward through a file.
+class FileView {
+public:
+  FileView(enum StorageDevices deviceName, const struct FileViewSettings &settings);
+  ~FileView();
+
+  // WARNING: These return 0 for success or an errno code, they don't set errno!
+  int open(FileSystem *fileSystem, const char *path);
+  int map(off_t offset, size_t length, const void **window, size_t *mapped);
+  int close();
+
+  off_t size() const;
+  enum StorageDevices getDeviceName() const;
+
+private:
+  struct Page {
+    bool valid;
+    uint32_t number;      // Offset in the file divided by the page size
+    uint32_t lastUse;
+  };
+
+  // Sets *slot to the cache slot that holds the page, reading it and the ones after it if needed
+  int getPage(uint32_t number, size_t *slot);
+  int loadPage(uint32_t number, size_t slot);
+  size_t findPage(uint32_t number) const;     // pageCount if not cached
+  size_t leastRecentlyUsed(size_t excludedSlot) const;
+
+  // Used for the settings that are 0
+  static constexpr size_t defaultPageSize = 512;
+  static constexpr size_t defaultPageCount = 8;
+  static constexpr size_t defaultPrefetchPages = 1;
+
+  const enum StorageDevices deviceName;
+  const size_t pageSize;
+  const size_t pageCount;
+  const size_t prefetchPages;
+
+  File file;
+  bool isOpen;
+  off_t fileSize;
+  off_t filePosition;
+  uint32_t useCounter;
+  uint8_t *pages;
+  struct Page *pageTable;
+  uint8_t *straddleBuffer;
+};
+
+#endif  // FileView_H
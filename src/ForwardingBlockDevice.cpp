@@ -0,0 +1,124 @@
+/*
+*********************************************************************************************************
+*                                      Arduino_POSIXStorage Library
+*
+*                            Copyright 2023 Arduino SA. http://arduino.cc
+*
+*                    Base class for the block devices the library inserts between a file system
+*                    and the SD Card or USB thumb drive block device.
+*
+*
+*                             SPDX-License-Identifier: LGPL-2.1-or-later
+*
+*                    This library is free software; you can redistribute it and/or
+*                    modify it under the terms of the GNU Lesser General Public
+*                    License as published by the Free Software Foundation; either
+*                    version 2.1 of the License, or (at your option) any later version.
+*
+*                    This library is distributed in the hope that it will be useful,
+*                    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*                    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*                    Lesser General Public License for more details.
+*
+*                    You should have received a copy of the GNU Lesser General
+*                    Public License along with this library; if not, write to the
+*                    Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+*                    Boston, MA  02111-1307  USA
+*
+*********************************************************************************************************
+*/
+
+/*
+*********************************************************************************************************
+*                                         Included header files
+*********************************************************************************************************
+*/
+
+#include "ForwardingBlockDevice.h"
+
+/*
+*********************************************************************************************************
+*                                  ForwardingBlockDevice member functions
+*********************************************************************************************************
+*/
+
+ForwardingBlockDevice::ForwardingBlockDevice(BlockDevice * const underlyingDevice)
+  : underlying(underlyingDevice)
+{
+}   // End of ForwardingBlockDevice::ForwardingBlockDevice()
+
+ForwardingBlockDevice::~ForwardingBlockDevice()
+{
+  // The underlying device is owned by someone else
+}   // End of ForwardingBlockDevice::~ForwardingBlockDevice()
+
+int ForwardingBlockDevice::init()
+{
+  return underlying->init();
+}   // End of ForwardingBlockDevice::init()
+
+int ForwardingBlockDevice::deinit()
+{
+  return underlying->deinit();
+}   // End of ForwardingBlockDevice::deinit()
+
+int ForwardingBlockDevice::sync()
+{
+  return underlying->sync();
+}   // End of ForwardingBlockDevice::sync()
+
+int ForwardingBlockDevice::read(void * const buffer, const bd_addr_t addr, const bd_size_t size)
+{
+  return underlying->read(buffer, addr, size);
+}   // End of ForwardingBlockDevice::read()
+
+int ForwardingBlockDevice::program(const void * const buffer, const bd_addr_t addr, const bd_size_t size)
+{
+  return underlying->program(buffer, addr, size);
+}   // End of ForwardingBlockDevice::program()
+
+int ForwardingBlockDevice::erase(const bd_addr_t addr, const bd_size_t size)
+{
+  return underlying->erase(addr, size);
+}   // End of ForwardingBlockDevice::erase()
+
+int ForwardingBlockDevice::trim(const bd_addr_t addr, const bd_size_t size)
+{
+  return underlying->trim(addr, size);
+}   // End of ForwardingBlockDevice::trim()
+
+bd_size_t ForwardingBlockDevice::get_read_size() const
+{
+  return underlying->get_read_size();
+}   // End of ForwardingBlockDevice::get_read_size()
+
+bd_size_t ForwardingBlockDevice::get_program_size() const
+{
+  return underlying->get_program_size();
+}   // End of ForwardingBlockDevice::get_program_size()
+
+bd_size_t ForwardingBlockDevice::get_erase_size() const
+{
+  return underlying->get_erase_size();
+}   // End of ForwardingBlockDevice::get_erase_size()
+
+bd_size_t ForwardingBlockDevice::get_erase_size(const bd_addr_t addr) const
+{
+  return underlying->get_erase_size(addr);
+}   // End of ForwardingBlockDevice::get_erase_size()
+
+int ForwardingBlockDevice::get_erase_value() const
+{
+  return underlying->get_erase_value();
+}   // End of ForwardingBlockDevice::get_erase_value()
+
+bd_size_t ForwardingBlockDevice::size() const
+{
+  return underlying->size();
+}   // End of ForwardingBlockDevice::size()
+
+// Report the type of the real device, in case anything above us depends on it
+const char *ForwardingBlockDevice::get_type() const
+{
+  return underlying->get_type();
+}   // End of ForwardingBlockDevice::get_type()
@@ -0,0 +1,69 @@
+/*
+*********************************************************************************************************
+*                                      Arduino_POSIXStorage Library
+*
+*                            Copyright 2023 Arduino SA. http://arduino.cc
+*
+*                    Base class for the block devices the library inserts between a file system
+*                    and the SD Card or USB thumb drive block device.
+*
+*
+*                             SPDX-License-Identifier: LGPL-2.1-or-later
+*
+*                    This library is free software; you can redistribute it and/or
+*                    modify it under the terms of the GNU Lesser General Public
+*                    License as published by the Free Software Foundation; either
+*                    version 2.1 of the License, or (at your option) any later version.
+*
+*                    This library is distributed in the hope that it will be useful,
+*                    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*                    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*                    Lesser General Public License for more details.
+*
+*                    You should have received a copy of the GNU Lesser General
+*                    Public License along with this library; if not, write to the
+*                    Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+*                    Boston, MA  02111-1307  USA
+*
+*********************************************************************************************************
+*/
+
+#ifndef ForwardingBlockDevice_H
+#define ForwardingBlockDevice_H
+
+#include "Arduino_POSIXStorage.h"
+
+#if defined(ARDUINO_PORTENTA_H7_M7) || defined(ARDUINO_OPTA)
+  #include <BlockDevice.h>
+  using mbed::BlockDevice;
+  using mbed::bd_addr_t;
+  using mbed::bd_size_t;
+#endif
+
+// Passes every call on to the underlying block device, which it doesn't own. Derived classes
+// override the calls they are interested in.
+class ForwardingBlockDevice : public BlockDevice {
+public:
+  explicit ForwardingBlockDevice(BlockDevice *underlyingDevice);
+  virtual ~ForwardingBlockDevice();
+
+  virtual int init();
+  virtual int deinit();
+  virtual int sync();
+  virtual int read(void *buffer, bd_addr_t addr, bd_size_t size);
+  virtual int program(const void *buffer, bd_addr_t addr, bd_size_t size);
+  virtual int erase(bd_addr_t addr, bd_size_t size);
+  virtual int trim(bd_addr_t addr, bd_size_t size);
+  virtual bd_size_t get_read_size() const;
+  virtual bd_size_t get_program_size() const;
+  virtual bd_size_t get_erase_size() const;
+  virtual bd_size_t get_erase_size(bd_addr_t addr) const;
+  virtual int get_erase_value() const;
+  virtual bd_size_t size() const;
+  virtual const char *get_type() const;
+
+protected:
+  BlockDevice *underlying;
+};
+
+#endif  // ForwardingBlockDevice_H
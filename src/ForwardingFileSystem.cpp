@@ -0,0 +1,231 @@
+/*
+*********************************************************************************************************
+*                                      Arduino_POSIXStorage Library
+*
+*                            Copyright 2023 Arduino SA. http://arduino.cc
+*
+*                    Base class for the file systems the library wraps around the FAT or LittleFS
+*                    file system object, taking over its mount point name.
+*
+*
+*                             SPDX-License-Identifier: LGPL-2.1-or-later
+*
+*                    This library is free software; you can redistribute it and/or
+*                    modify it under the terms of the GNU Lesser General Public
+*                    License as published by the Free Software Foundation; either
+*                    version 2.1 of the License, or (at your option) any later version.
+*
+*                    This library is distributed in the hope that it will be useful,
+*                    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*                    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*                    Lesser General Public License for more details.
+*
+*                    You should have received a copy of the GNU Lesser General
+*                    Public License along with this library; if not, write to the
+*                    Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+*                    Boston, MA  02111-1307  USA
+*
+*********************************************************************************************************
+*/
+
+/*
+*********************************************************************************************************
+*                                         Included header files
+*********************************************************************************************************
+*/
+
+#include "ForwardingFileSystem.h"
+
+#include <Arduino.h>
+
+/*
+*********************************************************************************************************
+*                                  ForwardingFileSystem member functions
+*********************************************************************************************************
+*/
+
+ForwardingFileSystem::ForwardingFileSystem(const char * const name, FileSystem * const underlyingFileSystem)
+  : FileSystem(name),
+    underlying(underlyingFileSystem)
+{
+}   // End of ForwardingFileSystem::ForwardingFileSystem()
+
+ForwardingFileSystem::~ForwardingFileSystem()
+{
+  // Ok to delete with base class pointer because the destructor of the base class is virtual
+  delete underlying;
+}   // End of ForwardingFileSystem::~ForwardingFileSystem()
+
+int ForwardingFileSystem::mount(BlockDevice * const bd)
+{
+  return underlying->mount(bd);
+}   // End of ForwardingFileSystem::mount()
+
+int ForwardingFileSystem::unmount()
+{
+  return underlying->unmount();
+}   // End of ForwardingFileSystem::unmount()
+
+int ForwardingFileSystem::reformat(BlockDevice * const bd)
+{
+  return underlying->reformat(bd);
+}   // End of ForwardingFileSystem::reformat()
+
+int ForwardingFileSystem::remove(const char * const path)
+{
+  return underlying->remove(path);
+}   // End of ForwardingFileSystem::remove()
+
+int ForwardingFileSystem::rename(const char * const path, const char * const newpath)
+{
+  return underlying->rename(path, newpath);
+}   // End of ForwardingFileSystem::rename()
+
+int ForwardingFileSystem::stat(const char * const path, struct stat * const st)
+{
+  return underlying->stat(path, st);
+}   // End of ForwardingFileSystem::stat()
+
+int ForwardingFileSystem::mkdir(const char * const path, const mode_t mode)
+{
+  return underlying->mkdir(path, mode);
+}   // End of ForwardingFileSystem::mkdir()
+
+int ForwardingFileSystem::statvfs(const char * const path, struct statvfs * const buf)
+{
+  return underlying->statvfs(path, buf);
+}   // End of ForwardingFileSystem::statvfs()
+
+int ForwardingFileSystem::openForwardedFile(ForwardedFile * const forwardedFile,
+                                            fs_file_t * const file,
+                                            const char * const path,
+                                            const int flags)
+{
+  const int openReturn = forwardedFile->file.open(underlying, path, flags);
+  if (0 != openReturn)
+  {
+    delete forwardedFile;
+    return openReturn;
+  }
+  *file = forwardedFile;
+  return 0;
+}   // End of ForwardingFileSystem::openForwardedFile()
+
+ForwardingFileSystem::ForwardedFile *ForwardingFileSystem::getForwardedFile(const fs_file_t file)
+{
+  return static_cast<ForwardedFile*>(file);
+}   // End of ForwardingFileSystem::getForwardedFile()
+
+int ForwardingFileSystem::file_open(fs_file_t * const file, const char * const path, const int flags)
+{
+  ForwardedFile * const forwardedFile = new(std::nothrow) ForwardedFile;
+  if (nullptr == forwardedFile)
+  {
+    return -ENOMEM;
+  }
+  return openForwardedFile(forwardedFile, file, path, flags);
+}   // End of ForwardingFileSystem::file_open()
+
+int ForwardingFileSystem::file_close(const fs_file_t file)
+{
+  ForwardedFile * const forwardedFile = getForwardedFile(file);
+  const int closeReturn = forwardedFile->file.close();
+  // Ok to delete with base class pointer because the destructor of the base class is virtual
+  delete forwardedFile;
+  return closeReturn;
+}   // End of ForwardingFileSystem::file_close()
+
+ssize_t ForwardingFileSystem::file_read(const fs_file_t file, void * const buffer, const size_t size)
+{
+  return getForwardedFile(file)->file.read(buffer, size);
+}   // End of ForwardingFileSystem::file_read()
+
+ssize_t ForwardingFileSystem::file_write(const fs_file_t file, const void * const buffer, const size_t size)
+{
+  return getForwardedFile(file)->file.write(buffer, size);
+}   // End of ForwardingFileSystem::file_write()
+
+int ForwardingFileSystem::file_sync(const fs_file_t file)
+{
+  return getForwardedFile(file)->file.sync();
+}   // End of ForwardingFileSystem::file_sync()
+
+int ForwardingFileSystem::file_isatty(const fs_file_t file)
+{
+  return getForwardedFile(file)->file.isatty();
+}   // End of ForwardingFileSystem::file_isatty()
+
+off_t ForwardingFileSystem::file_seek(const fs_file_t file, const off_t offset, const int whence)
+{
+  return getForwardedFile(file)->file.seek(offset, whence);
+}   // End of ForwardingFileSystem::file_seek()
+
+off_t ForwardingFileSystem::file_tell(const fs_file_t file)
+{
+  return getForwardedFile(file)->file.tell();
+}   // End of ForwardingFileSystem::file_tell()
+
+void ForwardingFileSystem::file_rewind(const fs_file_t file)
+{
+  getForwardedFile(file)->file.rewind();
+}   // End of ForwardingFileSystem::file_rewind()
+
+off_t ForwardingFileSystem::file_size(const fs_file_t file)
+{
+  return getForwardedFile(file)->file.size();
+}   // End of ForwardingFileSystem::file_size()
+
+int ForwardingFileSystem::file_truncate(const fs_file_t file, const off_t length)
+{
+  return getForwardedFile(file)->file.truncate(length);
+}   // End of ForwardingFileSystem::file_truncate()
+
+int ForwardingFileSystem::dir_open(fs_dir_t * const dir, const char * const path)
+{
+  Dir * const underlyingDir = new(std::nothrow) Dir;
+  if (nullptr == underlyingDir)
+  {
+    return -ENOMEM;
+  }
+  const int openReturn = underlyingDir->open(underlying, path);
+  if (0 != openReturn)
+  {
+    delete underlyingDir;
+    return openReturn;
+  }
+  *dir = underlyingDir;
+  return 0;
+}   // End of ForwardingFileSystem::dir_open()
+
+int ForwardingFileSystem::dir_close(const fs_dir_t dir)
+{
+  Dir * const underlyingDir = static_cast<Dir*>(dir);
+  const int closeReturn = underlyingDir->close();
+  delete underlyingDir;
+  return closeReturn;
+}   // End of ForwardingFileSystem::dir_close()
+
+ssize_t ForwardingFileSystem::dir_read(const fs_dir_t dir, struct dirent * const ent)
+{
+  return static_cast<Dir*>(dir)->read(ent);
+}   // End of ForwardingFileSystem::dir_read()
+
+void ForwardingFileSystem::dir_seek(const fs_dir_t dir, const off_t offset)
+{
+  static_cast<Dir*>(dir)->seek(offset);
+}   // End of ForwardingFileSystem::dir_seek()
+
+off_t ForwardingFileSystem::dir_tell(const fs_dir_t dir)
+{
+  return static_cast<Dir*>(dir)->tell();
+}   // End of ForwardingFileSystem::dir_tell()
+
+void ForwardingFileSystem::dir_rewind(const fs_dir_t dir)
+{
+  static_cast<Dir*>(dir)->rewind();
+}   // End of ForwardingFileSystem::dir_rewind()
+
+size_t ForwardingFileSystem::dir_size(const fs_dir_t dir)
+{
+  return static_cast<Dir*>(dir)->size();
+}   // End of ForwardingFileSystem::dir_size()
@@ -0,0 +1,99 @@
+/*
+*********************************************************************************************************
+*                                      Arduino_POSIXStorage Library
+*
+*                            Copyright 2023 Arduino SA. http://arduino.cc
+*
+*                    Base class for the file systems the library wraps around the FAT or LittleFS
+*                    file system object, taking over its mount point name.
+*
+*
+*                             SPDX-License-Identifier: LGPL-2.1-or-later
+*
+*                    This library is free software; you can redistribute it and/or
+*                    modify it under the terms of the GNU Lesser General Public
+*                    License as published by the Free Software Foundation; either
+*                    version 2.1 of the License, or (at your option) any later version.
+*
+*                    This library is distributed in the hope that it will be useful,
+*                    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*                    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*                    Lesser General Public License for more details.
+*
+*                    You should have received a copy of the GNU Lesser General
+*                    Public License along with this library; if not, write to the
+*                    Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+*                    Boston, MA  02111-1307  USA
+*
+*********************************************************************************************************
+*/
+
+#ifndef ForwardingFileSystem_H
+#define ForwardingFileSystem_H
+
+#include "Arduino_POSIXStorage.h"
+
+#if defined(ARDUINO_PORTENTA_H7_M7) || defined(ARDUINO_OPTA)
+  using mbed::BlockDevice;
+  using mbed::Dir;
+  using mbed::File;
+  using mbed::FileSystem;
+  using mbed::fs_dir_t;
+  using mbed::fs_file_t;
+#endif
+
+// Passes every call on to the underlying file system through File and Dir objects, because the
+// file_*() and dir_*() functions of another FileSystem object are out of reach. Derived classes
+// override the calls they are interested in, and can keep state per open file by deriving from
+// ForwardedFile and opening it with openForwardedFile().
+class ForwardingFileSystem : public FileSystem {
+public:
+  // Takes ownership of underlyingFileSystem, which must have been created without a name so that
+  // this object can take over the mount point name
+  ForwardingFileSystem(const char *name, FileSystem *underlyingFileSystem);
+  virtual ~ForwardingFileSystem();
+
+  virtual int mount(BlockDevice *bd);
+  virtual int unmount();
+  virtual int reformat(BlockDevice *bd);
+  virtual int remove(const char *path);
+  virtual int rename(const char *path, const char *newpath);
+  virtual int stat(const char *path, struct stat *st);
+  virtual int mkdir(const char *path, mode_t mode);
+  virtual int statvfs(const char *path, struct statvfs *buf);
+
+protected:
+  struct ForwardedFile {
+    virtual ~ForwardedFile() {}
+    File file;
+  };
+
+  // Opens forwardedFile on the underlying file system and hands it out as file. Deletes it if the
+  // open fails.
+  int openForwardedFile(ForwardedFile *forwardedFile, fs_file_t *file, const char *path, int flags);
+  static ForwardedFile *getForwardedFile(fs_file_t file);
+
+  virtual int file_open(fs_file_t *file, const char *path, int flags);
+  // Closes and deletes the ForwardedFile, including what a derived class added to it
+  virtual int file_close(fs_file_t file);
+  virtual ssize_t file_read(fs_file_t file, void *buffer, size_t size);
+  virtual ssize_t file_write(fs_file_t file, const void *buffer, size_t size);
+  virtual int file_sync(fs_file_t file);
+  virtual int file_isatty(fs_file_t file);
+  virtual off_t file_seek(fs_file_t file, off_t offset, int whence);
+  virtual off_t file_tell(fs_file_t file);
+  virtual void file_rewind(fs_file_t file);
+  virtual off_t file_size(fs_file_t file);
+  virtual int file_truncate(fs_file_t file, off_t length);
+  virtual int dir_open(fs_dir_t *dir, const char *path);
+  virtual int dir_close(fs_dir_t dir);
+  virtual ssize_t dir_read(fs_dir_t dir, struct dirent *ent);
+  virtual void dir_seek(fs_dir_t dir, off_t offset);
+  virtual off_t dir_tell(fs_dir_t dir);
+  virtual void dir_rewind(fs_dir_t dir);
+  virtual size_t dir_size(fs_dir_t dir);
+
+  FileSystem *underlying;
+};
+
+#endif  // ForwardingFileSystem_H
@@ -0,0 +1,229 @@
+/*
+*********************************************************************************************************
+*                                      Arduino_POSIXStorage Library
+*
+*                            Copyright 2023 Arduino SA. http://arduino.cc
+*
+*                    Ring of trace records in RAM, shared by the block level and file level
+*                    tracing of a device, and written to a file on request.
+*
+*
+*                             SPDX-License-Identifier: LGPL-2.1-or-later
+*
+*                    This library is free software; you can redistribute it and/or
+*                    modify it under the terms of the GNU Lesser General Public
+*                    License as published by the Free Software Foundation; either
+*                    version 2.1 of the License, or (at your option) any later version.
+*
+*                    This library is distributed in the hope that it will be useful,
+*                    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*                    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*                    Lesser General Public License for more details.
+*
+*                    You should have received a copy of the GNU Lesser General
+*                    Public License along with this library; if not, write to the
+*                    Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+*                    Boston, MA  02111-1307  USA
+*
+*********************************************************************************************************
+*/
+
+/*
+*********************************************************************************************************
+*                                         Included header files
+*********************************************************************************************************
+*/
+
+#include "TraceRecorder.h"
+
+#include <Arduino.h>
+
+/*
+*********************************************************************************************************
+*                                     TraceRecorder member functions
+*********************************************************************************************************
+*/
+
+TraceRecorder::TraceRecorder(const struct TraceSettings &traceSettings)
+  : settings(traceSettings),
+    ring(nullptr),
+    next(0),
+    count(0),
+    overwrittenRecords(0),
+    droppedRecords(0),
+    paused(false),
+    pathHashes(nullptr),
+    knownPaths(0)
+{
+  if (0 != settings.records)
+  {
+    ring = new(std::nothrow) TraceRecord[settings.records];
+  }
+  // Block operations don't use paths
+  if (true == settings.fileLevel)
+  {
+    pathHashes = new(std::nothrow) uint32_t[maxPaths];
+  }
+}   // End of TraceRecorder::TraceRecorder()
+
+TraceRecorder::~TraceRecorder()
+{
+  delete[] ring;
+  delete[] pathHashes;
+}   // End of TraceRecorder::~TraceRecorder()
+
+bool TraceRecorder::isValid() const
+{
+  return ((nullptr != ring) && ((false == settings.fileLevel) || (nullptr != pathHashes)));
+}   // End of TraceRecorder::isValid()
+
+bool TraceRecorder::tracesBlocks() const
+{
+  return settings.blockLevel;
+}   // End of TraceRecorder::tracesBlocks()
+
+bool TraceRecorder::tracesFiles() const
+{
+  return settings.fileLevel;
+}   // End of TraceRecorder::tracesFiles()
+
+uint32_t TraceRecorder::getFileNumber(const char * const path, const bool assign)
+{
+  // 32-bit FNV-1a of the path as given, so differently spelled paths to the same file get different numbers
+  uint32_t pathHash = 2166136261u;
+  for (const char *character = path; '\0' != *character; character++)
+  {
+    pathHash = (pathHash ^ static_cast<uint8_t>(*character)) * 16777619u;
+  }
+  lock();
+  size_t index = 0;
+  while ((index < knownPaths) && (pathHashes[index] != pathHash))
+  {
+    index++;
+  }
+  uint32_t number = static_cast<uint32_t>(index + 1);
+  if (index == knownPaths)
+  {
+    // Paths used while paused, like those of a replay, aren't in the trace and don't need numbers
+    if ((true == assign) && (false == paused) && (knownPaths < maxPaths))
+    {
+      pathHashes[index] = pathHash;
+      knownPaths++;
+    }
+    else
+    {
+      number = 0;
+    }
+  }
+  unlock();
+  return number;
+}   // End of TraceRecorder::getFileNumber()
+
+void TraceRecorder::record(const enum TraceOperations operation,
+                           const uint32_t file,
+                           const uint64_t offset,
+                           const uint32_t size,
+                           const int32_t result,
+                           const uint32_t startMicroseconds)
+{
+  const uint32_t durationMicroseconds = micros() - startMicroseconds;
+  lock();
+  if (false == paused)
+  {
+    struct TraceRecord * const traceRecord = &(ring[next]);
+    traceRecord->timestampMicroseconds = startMicroseconds;
+    traceRecord->durationMicroseconds = durationMicroseconds;
+    traceRecord->offset = offset;
+    traceRecord->size = size;
+    traceRecord->result = result;
+    traceRecord->operation = operation;
+    memset(traceRecord->reserved, 0, sizeof(traceRecord->reserved));
+    traceRecord->file = file;
+    next = (next + 1) % settings.records;
+    if (count < settings.records)
+    {
+      count++;
+    }
+    else
+    {
+      overwrittenRecords++;
+    }
+  }
+  unlock();
+}   // End of TraceRecorder::record()
+
+void TraceRecorder::drop()
+{
+  lock();
+  if (false == paused)
+  {
+    droppedRecords++;
+  }
+  unlock();
+}   // End of TraceRecorder::drop()
+
+int TraceRecorder::dump(const char * const pathname)
+{
+  setPaused(true);
+  FILE * const fp = fopen(pathname, "wb");
+  if (nullptr == fp)
+  {
+    const int openError = errno;
+    setPaused(false);
+    return openError;
+  }
+  struct TraceFileHeader header;
+  memcpy(header.magic, "PSTR", sizeof(header.magic));
+  header.version = 2;
+  header.recordSize = sizeof(struct TraceRecord);
+  header.records = static_cast<uint32_t>(count);
+  header.overwrittenRecords = overwrittenRecords;
+  header.files = static_cast<uint32_t>(knownPaths);
+  header.droppedRecords = droppedRecords;
+  // The oldest record is at next once the ring has wrapped around, and at 0 before that
+  const size_t oldest = (count < settings.records) ? 0 : next;
+  const size_t firstPart = (count < settings.records) ? count : (settings.records - oldest);
+  bool writeOk = (1 == fwrite(&header, sizeof(header), 1, fp));
+  if ((true == writeOk) && (0 != firstPart))
+  {
+    writeOk = (firstPart == fwrite(ring + oldest, sizeof(struct TraceRecord), firstPart, fp));
+  }
+  if ((true == writeOk) && (count != firstPart))
+  {
+    writeOk = ((count - firstPart) == fwrite(ring, sizeof(struct TraceRecord), count - firstPart, fp));
+  }
+  const int writeError = (true == writeOk) ? 0 : errno;
+  const bool closeOk = (0 == fclose(fp));
+  const int closeError = (true == closeOk) ? 0 : errno;
+  setPaused(false);
+  if (false == writeOk)
+  {
+    return (0 != writeError) ? writeError : EIO;
+  }
+  if (false == closeOk)
+  {
+    return (0 != closeError) ? closeError : EIO;
+  }
+  return 0;
+}   // End of TraceRecorder::dump()
+
+void TraceRecorder::setPaused(const bool pausedState)
+{
+  lock();
+  paused = pausedState;
+  unlock();
+}   // End of TraceRecorder::setPaused()
+
+void TraceRecorder::lock()
+{
+#if defined(TRACE_RECORDER_HAS_MUTEX)
+  mutex.lock();
+#endif
+}   // End of TraceRecorder::lock()
+
+void TraceRecorder::unlock()
+{
+#if defined(TRACE_RECORDER_HAS_MUTEX)
+  mutex.unlock();
+#endif
+}   // End of TraceRecorder::unlock()
@@ -0,0 +1,88 @@
+/*
+*********************************************************************************************************
+*                                      Arduino_POSIXStorage Library
+*
+*                            Copyright 2023 Arduino SA. http://arduino.cc
+*
+*                    Ring of trace records in RAM, shared by the block level and file level
+*                    tracing of a device, and written to a file on request.
+*
+*
+*                             SPDX-License-Identifier: LGPL-2.1-or-later
+*
+*                    This library is free software; you can redistribute it and/or
+*                    modify it under the terms of the GNU Lesser General Public
+*                    License as published by the Free Software Foundation; either
+*                    version 2.1 of the License, or (at your option) any later version.
+*
+*                    This library is distributed in the hope that it will be useful,
+*                    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*                    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*                    Lesser General Public License for more details.
+*
+*                    You should have received a copy of the GNU Lesser General
+*                    Public License along with this library; if not, write to the
+*                    Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+*                    Boston, MA  02111-1307  USA
+*
+*********************************************************************************************************
+*/
+
+#ifndef TraceRecorder_H
+#define TraceRecorder_H
+
+#include "Arduino_POSIXStorage.h"
+
+#if defined(ARDUINO_PORTENTA_H7_M7) || defined(ARDUINO_OPTA)
+  #define TRACE_RECORDER_HAS_MUTEX
+#endif
+
+// Records are copied into a ring that is allocated once, so recording never allocates memory or
+// touches a device. On the mbed based boards, files on the same device can be used by several
+// threads at once, so the ring is protected by a mutex there.
+class TraceRecorder {
+public:
+  explicit TraceRecorder(const struct TraceSettings &settings);
+  ~TraceRecorder();
+
+  // False if the ring couldn't be allocated
+  bool isValid() const;
+  bool tracesBlocks() const;
+  bool tracesFiles() const;
+
+  // Numbers paths from 1 in the order they are first given a number, so that a path keeps its number
+  // when it's used again, even after a remount. Returns 0 if the path has no number and assign is
+  // false, or if all maxPaths numbers have been given out.
+  uint32_t getFileNumber(const char *path, bool assign);
+  void record(enum TraceOperations operation, uint32_t file, uint64_t offset, uint32_t size,
+              int32_t result, uint32_t startMicroseconds);
+  // Counts an operation that can't be recorded because its path couldn't be numbered
+  void drop();
+  // WARNING: Returns 0 for success or an errno code, doesn't set errno!
+  // Nothing is recorded while the dump is written, so the dump doesn't show up in the trace
+  int dump(const char *pathname);
+  // Nothing is recorded while paused, for example while a trace is replayed on the traced device
+  void setPaused(bool paused);
+
+  // Numbers are never reused, so that a replay can't mix up two files
+  static constexpr size_t maxPaths = 1024;
+
+private:
+  void lock();
+  void unlock();
+
+  const struct TraceSettings settings;
+  struct TraceRecord *ring;
+  size_t next;                  // Where the next record goes
+  size_t count;                 // Records in the ring, at most settings.records
+  uint32_t overwrittenRecords;
+  uint32_t droppedRecords;
+  bool paused;
+  uint32_t *pathHashes;         // Hash of the path of file number (index + 1), if tracing files
+  size_t knownPaths;            // Numbers given out, at most maxPaths
+#if defined(TRACE_RECORDER_HAS_MUTEX)
+  rtos::Mutex mutex;
+#endif
+};
+
+#endif  // TraceRecorder_H
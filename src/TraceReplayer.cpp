@@ -0,0 +1,413 @@
+/*
+*********************************************************************************************************
+*                                      Arduino_POSIXStorage Library
+*
+*                            Copyright 2023 Arduino SA. http://arduino.cc
+*
+*                    Replays the file operations of a trace file on a mounted file system, to
+*                    compare file systems and settings under a recorded workload.
+*
+*
+*                             SPDX-License-Identifier: LGPL-2.1-or-later
+*
+*                    This library is free software; you can redistribute it and/or
+*                    modify it under the terms of the GNU Lesser General Public
+*                    License as published by the Free Software Foundation; either
+*                    version 2.1 of the License, or (at your option) any later version.
+*
+*                    This library is distributed in the hope that it will be useful,
+*                    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*                    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*                    Lesser General Public License for more details.
+*
+*                    You should have received a copy of the GNU Lesser General
+*                    Public License along with this library; if not, write to the
+*                    Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+*                    Boston, MA  02111-1307  USA
+*
+*********************************************************************************************************
+*/
+
+/*
+*********************************************************************************************************
+*                                         Included header files
+*********************************************************************************************************
+*/
+
+#include "TraceReplayer.h"
+
+#include <Arduino.h>
+
+/*
+*********************************************************************************************************
+*                                     TraceReplayer member functions
+*********************************************************************************************************
+*/
+
+TraceReplayer::TraceReplayer(FileSystem * const replayFileSystem)
+  : fileSystem(replayFileSystem),
+    files(nullptr),
+    fileCount(0),
+    buffer(nullptr),
+    bufferSize(512)
+{
+}   // End of TraceReplayer::TraceReplayer()
+
+TraceReplayer::~TraceReplayer()
+{
+  cleanUp();
+  delete[] files;
+  delete[] buffer;
+}   // End of TraceReplayer::~TraceReplayer()
+
+int TraceReplayer::run(const char * const tracePathname, struct TraceReplayReport * const report)
+{
+  *report = {};
+  errno = 0;
+  FILE * const trace = fopen(tracePathname, "rb");
+  if (nullptr == trace)
+  {
+    return (0 != errno) ? errno : ENOENT;
+  }
+  struct TraceFileHeader header;
+  int replayReturn = readHeader(trace, &header);
+  if (0 == replayReturn)
+  {
+    replayReturn = allocateFiles(header.files);
+  }
+  if (0 == replayReturn)
+  {
+    replayReturn = scan(trace, header.records);
+  }
+  if (0 == replayReturn)
+  {
+    buffer = new(std::nothrow) uint8_t[bufferSize];
+    replayReturn = (nullptr != buffer) ? 0 : ENOMEM;
+  }
+  if (0 == replayReturn)
+  {
+    // The data doesn't matter, but a pattern makes replayed files easy to recognize
+    for (uint32_t i=0; i<bufferSize; i++)
+    {
+      buffer[i] = static_cast<uint8_t>('0' + (i % 10));
+    }
+    const int mkdirReturn = fileSystem->mkdir("replay", 0777);
+    replayReturn = ((0 == mkdirReturn) || (-EEXIST == mkdirReturn)) ? 0 : -mkdirReturn;
+  }
+  if (0 == replayReturn)
+  {
+    replayReturn = prefill();
+  }
+  if ((0 == replayReturn) && (0 != fseek(trace, sizeof(header), SEEK_SET)))
+  {
+    replayReturn = EIO;
+  }
+  if (0 == replayReturn)
+  {
+    bool firstRecord = true;
+    uint32_t firstMicroseconds = 0;
+    uint32_t endMicroseconds = 0;
+    const uint32_t startMicroseconds = micros();
+    for (uint32_t i=0; i<header.records; i++)
+    {
+      struct TraceRecord traceRecord;
+      if (1 != fread(&traceRecord, sizeof(traceRecord), 1, trace))
+      {
+        replayReturn = EIO;
+        break;
+      }
+      const uint32_t replayedBefore = report->replayedOperations;
+      replay(traceRecord, report);
+      if (report->replayedOperations != replayedBefore)
+      {
+        if (true == firstRecord)
+        {
+          firstMicroseconds = traceRecord.timestampMicroseconds;
+          firstRecord = false;
+        }
+        endMicroseconds = traceRecord.timestampMicroseconds + traceRecord.durationMicroseconds;
+      }
+    }
+    // Files that are still open are closed as part of the replay, because closing writes what is cached
+    for (uint32_t i=0; i<fileCount; i++)
+    {
+      if (nullptr != files[i].file)
+      {
+        (void) files[i].file->close();
+        delete files[i].file;
+        files[i].file = nullptr;
+      }
+    }
+    report->elapsedMicroseconds = micros() - startMicroseconds;
+    report->recordedMicroseconds = endMicroseconds - firstMicroseconds;
+  }
+  (void) fclose(trace);
+  cleanUp();
+  return replayReturn;
+}   // End of TraceReplayer::run()
+
+int TraceReplayer::readHeader(FILE * const trace, struct TraceFileHeader * const header)
+{
+  if (1 != fread(header, sizeof(*header), 1, trace))
+  {
+    return EINVAL;
+  }
+  if ((0 != memcmp(header->magic, "PSTR", sizeof(header->magic))) || (2 != header->version) ||
+      (sizeof(struct TraceRecord) != header->recordSize))
+  {
+    return EINVAL;
+  }
+  return 0;
+}   // End of TraceReplayer::readHeader()
+
+int TraceReplayer::allocateFiles(const uint32_t pathCount)
+{
+  // Number 0 isn't used, so there is one more than there are paths
+  if (pathCount >= (SIZE_MAX / sizeof(struct ReplayFile)))
+  {
+    return ENOMEM;
+  }
+  files = new(std::nothrow) ReplayFile[static_cast<size_t>(pathCount) + 1]();
+  if (nullptr == files)
+  {
+    return ENOMEM;
+  }
+  fileCount = pathCount + 1;
+  return 0;
+}   // End of TraceReplayer::allocateFiles()
+
+int TraceReplayer::scan(FILE * const trace, const uint32_t records)
+{
+  for (uint32_t i=0; i<records; i++)
+  {
+    struct TraceRecord traceRecord;
+    if (1 != fread(&traceRecord, sizeof(traceRecord), 1, trace))
+    {
+      return EINVAL;    // The header promised more records than the file holds
+    }
+    const uint32_t number = traceRecord.file;
+    // Records with numbers beyond the header are skipped by the replay as well
+    if ((traceRecord.operation < TRACE_FILE_OPEN) || (0 == number) || (number >= fileCount))
+    {
+      continue;
+    }
+    if (false == files[number].seen)
+    {
+      files[number].seen = true;
+      // A path that the trace used before creating it must exist before the replay uses it
+      if ((0 == traceRecord.result) &&
+          (((TRACE_FILE_OPEN == traceRecord.operation) && (0 == (traceRecord.size & O_CREAT))) ||
+           (TRACE_FILE_REMOVE == traceRecord.operation) || (TRACE_FILE_RENAME == traceRecord.operation) ||
+           (TRACE_FILE_STAT == traceRecord.operation)))
+      {
+        files[number].created = true;
+      }
+    }
+    if ((TRACE_FILE_RENAME == traceRecord.operation) && (traceRecord.offset < fileCount))
+    {
+      files[traceRecord.offset].seen = true;    // Created by the rename
+    }
+    if ((TRACE_FILE_READ == traceRecord.operation) || (TRACE_FILE_WRITE == traceRecord.operation))
+    {
+      if ((TRACE_FILE_READ == traceRecord.operation) && (traceRecord.result > 0))
+      {
+        const uint64_t end = traceRecord.offset + static_cast<uint64_t>(traceRecord.result);
+        if ((end > files[number].prefillSize) && (end <= UINT32_MAX))
+        {
+          files[number].prefillSize = static_cast<uint32_t>(end);
+          files[number].created = true;
+        }
+      }
+      if (traceRecord.size > bufferSize)
+      {
+        bufferSize = (traceRecord.size < maxBufferSize) ? traceRecord.size : maxBufferSize;
+      }
+    }
+  }
+  return 0;
+}   // End of TraceReplayer::scan()
+
+int TraceReplayer::prefill()
+{
+  for (uint32_t i=1; i<fileCount; i++)
+  {
+    if (false == files[i].created)
+    {
+      continue;
+    }
+    char path[24];
+    makePath(i, path, sizeof(path));
+    File file;
+    const int openReturn = file.open(fileSystem, path, O_WRONLY | O_CREAT | O_TRUNC);
+    if (0 != openReturn)
+    {
+      return -openReturn;
+    }
+    const int64_t writeReturn = transfer(&file, true, 0, files[i].prefillSize);
+    const int closeReturn = file.close();
+    if (writeReturn < 0)
+    {
+      return static_cast<int>(-writeReturn);
+    }
+    if (0 != closeReturn)
+    {
+      return -closeReturn;
+    }
+  }
+  return 0;
+}   // End of TraceReplayer::prefill()
+
+void TraceReplayer::replay(const struct TraceRecord &traceRecord, struct TraceReplayReport * const report)
+{
+  const uint32_t number = traceRecord.file;
+  if ((traceRecord.operation < TRACE_FILE_OPEN) || (0 == number) || (number >= fileCount) ||
+      ((TRACE_FILE_RENAME == traceRecord.operation) && ((0 == traceRecord.offset) || (traceRecord.offset >= fileCount))))
+  {
+    report->skippedRecords++;
+    return;
+  }
+  File *file = files[number].file;
+  // These work on paths, the others on files that are open
+  const bool pathOperation = ((TRACE_FILE_OPEN == traceRecord.operation) || (TRACE_FILE_REMOVE == traceRecord.operation) ||
+                              (TRACE_FILE_RENAME == traceRecord.operation) || (TRACE_FILE_MKDIR == traceRecord.operation) ||
+                              (TRACE_FILE_STAT == traceRecord.operation));
+  if ((false == pathOperation) && (nullptr == file))
+  {
+    report->skippedRecords++;
+    return;
+  }
+  report->replayedOperations++;
+  bool replayOk = true;
+  char path[24];
+  makePath(number, path, sizeof(path));
+  switch (traceRecord.operation)
+  {
+    case TRACE_FILE_OPEN:
+      {   // Curly braces necessary to keep new variables inside the case statement
+      if (nullptr != file)
+      {
+        (void) file->close();
+        delete file;
+        files[number].file = nullptr;
+      }
+      file = new(std::nothrow) File;
+      if (nullptr == file)
+      {
+        replayOk = false;
+        break;
+      }
+      files[number].created = true;
+      if (0 != file->open(fileSystem, path, static_cast<int>(traceRecord.size)))
+      {
+        delete file;
+        replayOk = false;
+        break;
+      }
+      files[number].file = file;
+      }   // Curly braces necessary to keep new variables inside the case statement
+      break;
+    case TRACE_FILE_CLOSE:
+      replayOk = (0 == file->close());
+      delete file;
+      files[number].file = nullptr;
+      break;
+    case TRACE_FILE_READ:
+    case TRACE_FILE_WRITE:
+      {   // Curly braces necessary to keep new variables inside the case statement
+      const int64_t transferred = transfer(file, (TRACE_FILE_WRITE == traceRecord.operation),
+                                           traceRecord.offset, traceRecord.size);
+      replayOk = (transferred >= traceRecord.result);
+      }   // Curly braces necessary to keep new variables inside the case statement
+      break;
+    case TRACE_FILE_SYNC:
+      replayOk = (0 == file->sync());
+      break;
+    case TRACE_FILE_TRUNCATE:
+      replayOk = (0 == file->truncate(static_cast<off_t>(traceRecord.offset)));
+      break;
+    case TRACE_FILE_REMOVE:
+      replayOk = (0 == fileSystem->remove(path));
+      break;
+    case TRACE_FILE_RENAME:
+      {   // Curly braces necessary to keep new variables inside the case statement
+      const uint32_t newNumber = static_cast<uint32_t>(traceRecord.offset);
+      char newPath[24];
+      makePath(newNumber, newPath, sizeof(newPath));
+      files[newNumber].created = true;
+      replayOk = (0 == fileSystem->rename(path, newPath));
+      }   // Curly braces necessary to keep new variables inside the case statement
+      break;
+    case TRACE_FILE_MKDIR:
+      files[number].created = true;
+      replayOk = (0 == fileSystem->mkdir(path, static_cast<mode_t>(traceRecord.size)));
+      break;
+    case TRACE_FILE_STAT:
+      {   // Curly braces necessary to keep new variables inside the case statement
+      struct stat st;
+      replayOk = (0 == fileSystem->stat(path, &st));
+      }   // Curly braces necessary to keep new variables inside the case statement
+      break;
+    default:
+      // Operations from a newer version of the library
+      report->replayedOperations--;
+      report->skippedRecords++;
+      return;
+  }
+  // Operations that failed in the trace too aren't counted
+  if ((false == replayOk) && (traceRecord.result >= 0))
+  {
+    report->failedOperations++;
+  }
+}   // End of TraceReplayer::replay()
+
+int64_t TraceReplayer::transfer(File * const file, const bool writing, const uint64_t offset, const uint32_t size)
+{
+  const off_t seekReturn = file->seek(static_cast<off_t>(offset), SEEK_SET);
+  if (seekReturn < 0)
+  {
+    return seekReturn;
+  }
+  uint32_t done = 0;
+  while (done < size)
+  {
+    const uint32_t chunk = ((size - done) < bufferSize) ? (size - done) : bufferSize;
+    const ssize_t chunkReturn = (true == writing) ? file->write(buffer, chunk) : file->read(buffer, chunk);
+    if (chunkReturn < 0)
+    {
+      return chunkReturn;
+    }
+    done += static_cast<uint32_t>(chunkReturn);
+    if (static_cast<uint32_t>(chunkReturn) < chunk)
+    {
+      break;    // End of the file, or the device is full
+    }
+  }
+  return done;
+}   // End of TraceReplayer::transfer()
+
+void TraceReplayer::makePath(const uint32_t number, char * const path, const size_t pathSize) const
+{
+  (void) snprintf(path, pathSize, "replay/%u.bin", static_cast<unsigned int>(number));
+}   // End of TraceReplayer::makePath()
+
+void TraceReplayer::cleanUp()
+{
+  for (uint32_t i=0; i<fileCount; i++)
+  {
+    if (nullptr != files[i].file)
+    {
+      (void) files[i].file->close();
+      delete files[i].file;
+      files[i].file = nullptr;
+    }
+    if (true == files[i].created)
+    {
+      char path[24];
+      makePath(i, path, sizeof(path));
+      (void) fileSystem->remove(path);
+      files[i].created = false;
+    }
+  }
+  // Fails if the directory held anything else, which is fine
+  (void) fileSystem->remove("replay");
+}   // End of TraceReplayer::cleanUp()
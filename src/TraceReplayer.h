@@ -0,0 +1,83 @@
+/*
+*********************************************************************************************************
+*                                      Arduino_POSIXStorage Library
+*
+*                            Copyright 2023 Arduino SA. http://arduino.cc
+*
+*                    Replays the file operations of a trace file on a mounted file system, to
+*                    compare file systems and settings under a recorded workload.
+*
+*
+*                             SPDX-License-Identifier: LGPL-2.1-or-later
+*
+*                    This library is free software; you can redistribute it and/or
+*                    modify it under the terms of the GNU Lesser General Public
+*                    License as published by the Free Software Foundation; either
+*                    version 2.1 of the License, or (at your option) any later version.
+*
+*                    This library is distributed in the hope that it will be useful,
+*                    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*                    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*                    Lesser General Public License for more details.
+*
+*                    You should have received a copy of the GNU Lesser General
+*                    Public License along with this library; if not, write to the
+*                    Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+*                    Boston, MA  02111-1307  USA
+*
+*********************************************************************************************************
+*/
+
+#ifndef TraceReplayer_H
+#define TraceReplayer_H
+
+#include "Arduino_POSIXStorage.h"
+
+#if defined(ARDUINO_PORTENTA_H7_M7) || defined(ARDUINO_OPTA)
+  using mbed::File;
+  using mbed::FileSystem;
+#endif
+
+// Replays through File objects on the file system object, so a replay goes through the same block
+// devices as the sketch would, but not through stdio buffering. The trace is read twice: first to
+// find out which files must exist with how much data and how large the buffer must be, and then to
+// replay it, timed. The state of each replay file is allocated for the number of paths in the
+// trace header.
+class TraceReplayer {
+public:
+  explicit TraceReplayer(FileSystem *fileSystem);
+  ~TraceReplayer();
+
+  // WARNING: Returns 0 for success or an errno code, doesn't set errno!
+  int run(const char *tracePathname, struct TraceReplayReport *report);
+
+private:
+  // Returns 0 or an errno code
+  int readHeader(FILE *trace, struct TraceFileHeader *header);
+  int allocateFiles(uint32_t files);
+  int scan(FILE *trace, uint32_t records);
+  int prefill();
+  void replay(const struct TraceRecord &traceRecord, struct TraceReplayReport *report);
+  // Returns the bytes transferred, or a negative error code
+  int64_t transfer(File *file, bool writing, uint64_t offset, uint32_t size);
+  void makePath(uint32_t number, char *path, size_t pathSize) const;
+  void cleanUp();
+
+  // The largest read or write replayed in one call, larger ones are split up
+  static constexpr uint32_t maxBufferSize = 32768;
+
+  struct ReplayFile {
+    File *file;                 // Open replay file
+    uint32_t prefillSize;       // Bytes the trace reads from the file
+    bool created;               // The replay file has to be removed
+    bool seen;                  // The trace has used the path so far, while scanning
+  };
+
+  FileSystem * const fileSystem;
+  struct ReplayFile *files;     // Indexed by file number, 0 isn't used
+  uint32_t fileCount;
+  uint8_t *buffer;
+  uint32_t bufferSize;
+};
+
+#endif  // TraceReplayer_H
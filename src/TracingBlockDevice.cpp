@@ -0,0 +1,95 @@
+/*
+*********************************************************************************************************
+*                                      Arduino_POSIXStorage Library
+*
+*                            Copyright 2023 Arduino SA. http://arduino.cc
+*
+*                    Block device that records every operation the file system sends to the
+*                    device into a trace.
+*
+*
+*                             SPDX-License-Identifier: LGPL-2.1-or-later
+*
+*                    This library is free software; you can redistribute it and/or
+*                    modify it under the terms of the GNU Lesser General Public
+*                    License as published by the Free Software Foundation; either
+*                    version 2.1 of the License, or (at your option) any later version.
+*
+*                    This library is distributed in the hope that it will be useful,
+*                    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*                    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*                    Lesser General Public License for more details.
+*
+*                    You should have received a copy of the GNU Lesser General
+*                    Public License along with this library; if not, write to the
+*                    Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+*                    Boston, MA  02111-1307  USA
+*
+*********************************************************************************************************
+*/
+
+/*
+*********************************************************************************************************
+*                                         Included header files
+*********************************************************************************************************
+*/
+
+#include "TracingBlockDevice.h"
+
+#include <Arduino.h>
+
+/*
+*********************************************************************************************************
+*                                   TracingBlockDevice member functions
+*********************************************************************************************************
+*/
+
+TracingBlockDevice::TracingBlockDevice(BlockDevice * const underlyingDevice, TraceRecorder * const traceRecorder)
+  : ForwardingBlockDevice(underlyingDevice),
+    recorder(traceRecorder)
+{
+}   // End of TracingBlockDevice::TracingBlockDevice()
+
+TracingBlockDevice::~TracingBlockDevice()
+{
+}   // End of TracingBlockDevice::~TracingBlockDevice()
+
+int TracingBlockDevice::sync()
+{
+  const uint32_t startMicroseconds = micros();
+  const int syncReturn = underlying->sync();
+  recorder->record(TRACE_BLOCK_SYNC, 0, 0, 0, syncReturn, startMicroseconds);
+  return syncReturn;
+}   // End of TracingBlockDevice::sync()
+
+int TracingBlockDevice::read(void * const buffer, const bd_addr_t addr, const bd_size_t size)
+{
+  const uint32_t startMicroseconds = micros();
+  const int readReturn = underlying->read(buffer, addr, size);
+  recorder->record(TRACE_BLOCK_READ, 0, addr, static_cast<uint32_t>(size), readReturn, startMicroseconds);
+  return readReturn;
+}   // End of TracingBlockDevice::read()
+
+int TracingBlockDevice::program(const void * const buffer, const bd_addr_t addr, const bd_size_t size)
+{
+  const uint32_t startMicroseconds = micros();
+  const int programReturn = underlying->program(buffer, addr, size);
+  recorder->record(TRACE_BLOCK_PROGRAM, 0, addr, static_cast<uint32_t>(size), programReturn, startMicroseconds);
+  return programReturn;
+}   // End of TracingBlockDevice::program()
+
+int TracingBlockDevice::erase(const bd_addr_t addr, const bd_size_t size)
+{
+  const uint32_t startMicroseconds = micros();
+  const int eraseReturn = underlying->erase(addr, size);
+  recorder->record(TRACE_BLOCK_ERASE, 0, addr, static_cast<uint32_t>(size), eraseReturn, startMicroseconds);
+  return eraseReturn;
+}   // End of TracingBlockDevice::erase()
+
+int TracingBlockDevice::trim(const bd_addr_t addr, const bd_size_t size)
+{
+  const uint32_t startMicroseconds = micros();
+  const int trimReturn = underlying->trim(addr, size);
+  recorder->record(TRACE_BLOCK_TRIM, 0, addr, static_cast<uint32_t>(size), trimReturn, startMicroseconds);
+  return trimReturn;
+}   // End of TracingBlockDevice::trim()
@@ -0,0 +1,55 @@
+/*
+*********************************************************************************************************
+*                                      Arduino_POSIXStorage Library
+*
+*                            Copyright 2023 Arduino SA. http://arduino.cc
+*
+*                    Block device that records every operation the file system sends to the
+*                    device into a trace.
+*
+*
+*                             SPDX-License-Identifier: LGPL-2.1-or-later
+*
+*                    This library is free software; you can redistribute it and/or
+*                    modify it under the terms of the GNU Lesser General Public
+*                    License as published by the Free Software Foundation; either
+*                    version 2.1 of the License, or (at your option) any later version.
+*
+*                    This library is distributed in the hope that it will be useful,
+*                    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*                    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*                    Lesser General Public License for more details.
+*
+*                    You should have received a copy of the GNU Lesser General
+*                    Public License along with this library; if not, write to the
+*                    Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+*                    Boston, MA  02111-1307  USA
+*
+*********************************************************************************************************
+*/
+
+#ifndef TracingBlockDevice_H
+#define TracingBlockDevice_H
+
+#include "ForwardingBlockDevice.h"
+#include "TraceRecorder.h"
+
+// Sits right below the file system, so the trace shows what the file system asks for, the same
+// no matter which block devices the library inserts below it.
+class TracingBlockDevice : public ForwardingBlockDevice {
+public:
+  // Doesn't take ownership of the recorder
+  TracingBlockDevice(BlockDevice *underlyingDevice, TraceRecorder *recorder);
+  virtual ~TracingBlockDevice();
+
+  virtual int sync();
+  virtual int read(void *buffer, bd_addr_t addr, bd_size_t size);
+  virtual int program(const void *buffer, bd_addr_t addr, bd_size_t size);
+  virtual int erase(bd_addr_t addr, bd_size_t size);
+  virtual int trim(bd_addr_t addr, bd_size_t size);
+
+private:
+  TraceRecorder * const recorder;
+};
+
+#endif  // TracingBlockDevice_H
@@ -0,0 +1,195 @@
+/*
+*********************************************************************************************************
+*                                      Arduino_POSIXStorage Library
+*
+*                            Copyright 2023 Arduino SA. http://arduino.cc
+*
+*                    File system that records the file operations of the sketch into a trace,
+*                    and forwards everything to the file system it wraps.
+*
+*
+*                             SPDX-License-Identifier: LGPL-2.1-or-later
+*
+*                    This library is free software; you can redistribute it and/or
+*                    modify it under the terms of the GNU Lesser General Public
+*                    License as published by the Free Software Foundation; either
+*                    version 2.1 of the License, or (at your option) any later version.
+*
+*                    This library is distributed in the hope that it will be useful,
+*                    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*                    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*                    Lesser General Public License for more details.
+*
+*                    You should have received a copy of the GNU Lesser General
+*                    Public License along with this library; if not, write to the
+*                    Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+*                    Boston, MA  02111-1307  USA
+*
+*********************************************************************************************************
+*/
+
+/*
+*********************************************************************************************************
+*                                         Included header files
+*********************************************************************************************************
+*/
+
+#include "TracingFileSystem.h"
+
+#include <Arduino.h>
+
+/*
+*********************************************************************************************************
+*                                   TracingFileSystem member functions
+*********************************************************************************************************
+*/
+
+TracingFileSystem::TracingFileSystem(const char * const name,
+                                     FileSystem * const underlyingFileSystem,
+                                     TraceRecorder * const traceRecorder)
+  : ForwardingFileSystem(name, underlyingFileSystem),
+    recorder(traceRecorder)
+{
+}   // End of TracingFileSystem::TracingFileSystem()
+
+TracingFileSystem::~TracingFileSystem()
+{
+  // The recorder is owned by someone else
+}   // End of TracingFileSystem::~TracingFileSystem()
+
+// Paths are numbered when an operation on them succeeds, other than a stat(), so that paths that were
+// only looked up or failed to open don't use up numbers. Failed operations on paths without a number
+// are recorded with file number 0.
+
+int TracingFileSystem::remove(const char * const path)
+{
+  const uint32_t startMicroseconds = micros();
+  const int removeReturn = ForwardingFileSystem::remove(path);
+  const bool assign = (0 == removeReturn);
+  const uint32_t number = recorder->getFileNumber(path, assign);
+  recordOrDrop(TRACE_FILE_REMOVE, number, assign, 0, 0, removeReturn, startMicroseconds);
+  return removeReturn;
+}   // End of TracingFileSystem::remove()
+
+int TracingFileSystem::rename(const char * const path, const char * const newpath)
+{
+  const uint32_t startMicroseconds = micros();
+  const int renameReturn = ForwardingFileSystem::rename(path, newpath);
+  const bool assign = (0 == renameReturn);
+  const uint32_t number = recorder->getFileNumber(path, assign);
+  const uint32_t newNumber = recorder->getFileNumber(newpath, assign);
+  // The replay needs both numbers of a rename that worked
+  recordOrDrop(TRACE_FILE_RENAME, ((true == assign) && (0 == newNumber)) ? 0 : number, assign, newNumber, 0, renameReturn,
+               startMicroseconds);
+  return renameReturn;
+}   // End of TracingFileSystem::rename()
+
+int TracingFileSystem::stat(const char * const path, struct stat * const st)
+{
+  const uint32_t startMicroseconds = micros();
+  const int statReturn = ForwardingFileSystem::stat(path, st);
+  const uint32_t number = recorder->getFileNumber(path, false);
+  recordOrDrop(TRACE_FILE_STAT, number, false, 0, 0, statReturn, startMicroseconds);
+  return statReturn;
+}   // End of TracingFileSystem::stat()
+
+int TracingFileSystem::mkdir(const char * const path, const mode_t mode)
+{
+  const uint32_t startMicroseconds = micros();
+  const int mkdirReturn = ForwardingFileSystem::mkdir(path, mode);
+  const bool assign = (0 == mkdirReturn);
+  const uint32_t number = recorder->getFileNumber(path, assign);
+  recordOrDrop(TRACE_FILE_MKDIR, number, assign, 0, static_cast<uint32_t>(mode), mkdirReturn, startMicroseconds);
+  return mkdirReturn;
+}   // End of TracingFileSystem::mkdir()
+
+int TracingFileSystem::file_open(fs_file_t * const file, const char * const path, const int flags)
+{
+  const uint32_t startMicroseconds = micros();
+  struct TracedFile * const tracedFile = new(std::nothrow) TracedFile;
+  if (nullptr == tracedFile)
+  {
+    return -ENOMEM;
+  }
+  // Deletes tracedFile if the open fails
+  const int openReturn = openForwardedFile(tracedFile, file, path, flags);
+  const bool assign = (0 == openReturn);
+  const uint32_t number = recorder->getFileNumber(path, assign);
+  if (true == assign)
+  {
+    tracedFile->number = number;
+  }
+  recordOrDrop(TRACE_FILE_OPEN, number, assign, 0, static_cast<uint32_t>(flags), openReturn, startMicroseconds);
+  return openReturn;
+}   // End of TracingFileSystem::file_open()
+
+int TracingFileSystem::file_close(const fs_file_t file)
+{
+  const uint32_t startMicroseconds = micros();
+  const uint32_t number = static_cast<struct TracedFile*>(getForwardedFile(file))->number;
+  // Deletes the TracedFile
+  const int closeReturn = ForwardingFileSystem::file_close(file);
+  recordOrDrop(TRACE_FILE_CLOSE, number, true, 0, 0, closeReturn, startMicroseconds);
+  return closeReturn;
+}   // End of TracingFileSystem::file_close()
+
+ssize_t TracingFileSystem::file_read(const fs_file_t file, void * const buffer, const size_t size)
+{
+  const uint32_t startMicroseconds = micros();
+  struct TracedFile * const tracedFile = static_cast<struct TracedFile*>(getForwardedFile(file));
+  const off_t offset = tracedFile->file.tell();
+  const ssize_t readReturn = tracedFile->file.read(buffer, size);
+  recordOrDrop(TRACE_FILE_READ, tracedFile->number, true, static_cast<uint64_t>(offset), static_cast<uint32_t>(size),
+               static_cast<int32_t>(readReturn), startMicroseconds);
+  return readReturn;
+}   // End of TracingFileSystem::file_read()
+
+ssize_t TracingFileSystem::file_write(const fs_file_t file, const void * const buffer, const size_t size)
+{
+  const uint32_t startMicroseconds = micros();
+  struct TracedFile * const tracedFile = static_cast<struct TracedFile*>(getForwardedFile(file));
+  off_t offset = tracedFile->file.tell();
+  const ssize_t writeReturn = tracedFile->file.write(buffer, size);
+  // With O_APPEND the data goes to the end of the file, wherever the position was
+  if (writeReturn > 0)
+  {
+    offset = tracedFile->file.tell() - writeReturn;
+  }
+  recordOrDrop(TRACE_FILE_WRITE, tracedFile->number, true, static_cast<uint64_t>(offset), static_cast<uint32_t>(size),
+               static_cast<int32_t>(writeReturn), startMicroseconds);
+  return writeReturn;
+}   // End of TracingFileSystem::file_write()
+
+int TracingFileSystem::file_sync(const fs_file_t file)
+{
+  const uint32_t startMicroseconds = micros();
+  struct TracedFile * const tracedFile = static_cast<struct TracedFile*>(getForwardedFile(file));
+  const int syncReturn = tracedFile->file.sync();
+  recordOrDrop(TRACE_FILE_SYNC, tracedFile->number, true, 0, 0, syncReturn, startMicroseconds);
+  return syncReturn;
+}   // End of TracingFileSystem::file_sync()
+
+int TracingFileSystem::file_truncate(const fs_file_t file, const off_t length)
+{
+  const uint32_t startMicroseconds = micros();
+  struct TracedFile * const tracedFile = static_cast<struct TracedFile*>(getForwardedFile(file));
+  const int truncateReturn = tracedFile->file.truncate(length);
+  recordOrDrop(TRACE_FILE_TRUNCATE, tracedFile->number, true, static_cast<uint64_t>(length), 0, truncateReturn, startMicroseconds);
+  return truncateReturn;
+}   // End of TracingFileSystem::file_truncate()
+
+void TracingFileSystem::recordOrDrop(const enum TraceOperations operation,
+                                     const uint32_t number,
+                                     const bool needsNumber,
+                                     const uint64_t offset,
+                                     const uint32_t size,
+                                     const int32_t result,
+                                     const uint32_t startMicroseconds)
+{
+  if ((true == needsNumber) && (0 == number))
+  {
+    recorder->drop();
+    return;
+  }
+  recorder->record(operation, number, offset, size, result, startMicroseconds);
+}   // End of TracingFileSystem::recordOrDrop()
@@ -0,0 +1,73 @@
+/*
+*********************************************************************************************************
+*                                      Arduino_POSIXStorage Library
+*
+*                            Copyright 2023 Arduino SA. http://arduino.cc
+*
+*                    File system that records the file operations of the sketch into a trace,
+*                    and forwards everything to the file system it wraps.
+*
+*
+*                             SPDX-License-Identifier: LGPL-2.1-or-later
+*
+*                    This library is free software; you can redistribute it and/or
+*                    modify it under the terms of the GNU Lesser General Public
+*                    License as published by the Free Software Foundation; either
+*                    version 2.1 of the License, or (at your option) any later version.
+*
+*                    This library is distributed in the hope that it will be useful,
+*                    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*                    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*                    Lesser General Public License for more details.
+*
+*                    You should have received a copy of the GNU Lesser General
+*                    Public License along with this library; if not, write to the
+*                    Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+*                    Boston, MA  02111-1307  USA
+*
+*********************************************************************************************************
+*/
+
+#ifndef TracingFileSystem_H
+#define TracingFileSystem_H
+
+#include "ForwardingFileSystem.h"
+#include "TraceRecorder.h"
+
+// Wraps the file system the same way as DirectoryCacheFileSystem, and records opens, closes, reads,
+// writes, syncs, and truncates of files, and removes, renames, mkdir() calls, and stat() calls. The
+// trace has no room for paths, so files are numbered by the recorder instead, which is all that a
+// replay needs to tell them apart.
+class TracingFileSystem : public ForwardingFileSystem {
+public:
+  // Takes ownership of underlyingFileSystem, like ForwardingFileSystem. Doesn't take ownership of
+  // the recorder.
+  TracingFileSystem(const char *name, FileSystem *underlyingFileSystem, TraceRecorder *recorder);
+  virtual ~TracingFileSystem();
+
+  virtual int remove(const char *path);
+  virtual int rename(const char *path, const char *newpath);
+  virtual int stat(const char *path, struct stat *st);
+  virtual int mkdir(const char *path, mode_t mode);
+
+protected:
+  virtual int file_open(fs_file_t *file, const char *path, int flags);
+  virtual int file_close(fs_file_t file);
+  virtual ssize_t file_read(fs_file_t file, void *buffer, size_t size);
+  virtual ssize_t file_write(fs_file_t file, const void *buffer, size_t size);
+  virtual int file_sync(fs_file_t file);
+  virtual int file_truncate(fs_file_t file, off_t length);
+
+private:
+  struct TracedFile : public ForwardedFile {
+    uint32_t number = 0;        // 0 if the path has no number, nothing on the file is recorded then
+  };
+
+  // Records the operation, or only counts it if it needed a number and the recorder ran out of them
+  void recordOrDrop(enum TraceOperations operation, uint32_t number, bool needsNumber, uint64_t offset,
+                    uint32_t size, int32_t result, uint32_t startMicroseconds);
+
+  TraceRecorder * const recorder;
+};
+
+#endif  // TracingFileSystem_H
@@ -0,0 +1,211 @@
+/*
+*********************************************************************************************************
+*                                      Arduino_POSIXStorage Library
+*
+*                            Copyright 2023 Arduino SA. http://arduino.cc
+*
+*                    Block device that collects trim requests from the file system and passes
+*                    them on to the device later, in batches.
+*
+*
+*                             SPDX-License-Identifier: LGPL-2.1-or-later
+*
+*                    This library is free software; you can redistribute it and/or
+*                    modify it under the terms of the GNU Lesser General Public
+*                    License as published by the Free Software Foundation; either
+*                    version 2.1 of the License, or (at your option) any later version.
+*
+*                    This library is distributed in the hope that it will be useful,
+*                    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*                    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*                    Lesser General Public License for more details.
+*
+*                    You should have received a copy of the GNU Lesser General
+*                    Public License along with this library; if not, write to the
+*                    Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+*                    Boston, MA  02111-1307  USA
+*
+*********************************************************************************************************
+*/
+
+/*
+*********************************************************************************************************
+*                                         Included header files
+*********************************************************************************************************
+*/
+
+#include "TrimBatchingBlockDevice.h"
+
+/*
+*********************************************************************************************************
+*                                 TrimBatchingBlockDevice member functions
+*********************************************************************************************************
+*/
+
+TrimBatchingBlockDevice::TrimBatchingBlockDevice(BlockDevice * const underlyingDevice)
+  : ForwardingBlockDevice(underlyingDevice),
+    pendingCount(0)
+{
+}   // End of TrimBatchingBlockDevice::TrimBatchingBlockDevice()
+
+int TrimBatchingBlockDevice::deinit()
+{
+  // Called by unmount(), so this is the last chance to tell the device about the free ranges. A
+  // failed trim is harmless, so don't let it stop the device from being deinitialized.
+  (void) flushTrims(0);
+  return underlying->deinit();
+}   // End of TrimBatchingBlockDevice::deinit()
+
+int TrimBatchingBlockDevice::program(const void * const buffer, const bd_addr_t addr, const bd_size_t size)
+{
+  forgetRange(addr, addr + size);
+  return underlying->program(buffer, addr, size);
+}   // End of TrimBatchingBlockDevice::program()
+
+int TrimBatchingBlockDevice::erase(const bd_addr_t addr, const bd_size_t size)
+{
+  forgetRange(addr, addr + size);
+  return underlying->erase(addr, size);
+}   // End of TrimBatchingBlockDevice::erase()
+
+int TrimBatchingBlockDevice::trim(const bd_addr_t addr, const bd_size_t size)
+{
+  if (0 == size)
+  {
+    return 0;
+  }
+  bd_addr_t start = addr;
+  bd_addr_t end = addr + size;
+  // Merge with every pending range that overlaps or touches the new one. The union of touching
+  // free ranges is still free, and larger ranges mean fewer commands to the device.
+  size_t i = 0;
+  while (i < pendingCount)
+  {
+    if ((pending[i].start <= end) && (start <= pending[i].end))
+    {
+      start = (pending[i].start < start) ? pending[i].start : start;
+      end = (pending[i].end > end) ? pending[i].end : end;
+      removeRange(i);
+    }
+    else
+    {
+      i++;
+    }
+  }
+  if (maxPendingRanges == pendingCount)
+  {
+    // Make room by passing on the oldest range, which is the one least likely to grow any further
+    const struct TrimRange oldest = pending[0];
+    removeRange(0);
+    (void) underlying->trim(oldest.start, oldest.end - oldest.start);
+  }
+  pending[pendingCount].start = start;
+  pending[pendingCount].end = end;
+  pendingCount++;
+  return 0;
+}   // End of TrimBatchingBlockDevice::trim()
+
+int TrimBatchingBlockDevice::flushTrims(const bd_size_t byteBudget)
+{
+  bd_size_t trimmed = 0;
+  const bd_size_t eraseSize = underlying->get_erase_size();
+  while (pendingCount > 0)
+  {
+    if ((0 != byteBudget) && (trimmed >= byteBudget))
+    {
+      break;
+    }
+    struct TrimRange range = pending[0];
+    bd_size_t length = range.end - range.start;
+    bool partial = false;
+    if ((0 != byteBudget) && (length > (byteBudget - trimmed)) && (0 != eraseSize))
+    {
+      // Only pass on as much of a large range as the budget allows, on an erase unit boundary
+      const bd_size_t allowed = ((byteBudget - trimmed) / eraseSize) * eraseSize;
+      if (0 == allowed)
+      {
+        break;
+      }
+      length = allowed;
+      partial = true;
+    }
+    if (true == partial)
+    {
+      pending[0].start += length;
+    }
+    else
+    {
+      removeRange(0);
+    }
+    // A range is dropped even if the trim fails, because trims are only advisory
+    const int trimReturn = underlying->trim(range.start, length);
+    if (0 != trimReturn)
+    {
+      return trimReturn;
+    }
+    trimmed += length;
+  }
+  return 0;
+}   // End of TrimBatchingBlockDevice::flushTrims()
+
+bd_size_t TrimBatchingBlockDevice::pendingBytes() const
+{
+  bd_size_t total = 0;
+  for (size_t i = 0; i < pendingCount; i++)
+  {
+    total += pending[i].end - pending[i].start;
+  }
+  return total;
+}   // End of TrimBatchingBlockDevice::pendingBytes()
+
+void TrimBatchingBlockDevice::removeRange(const size_t index)
+{
+  // Keep the table ordered from oldest to newest
+  for (size_t i = index + 1; i < pendingCount; i++)
+  {
+    pending[i - 1] = pending[i];
+  }
+  pendingCount--;
+}   // End of TrimBatchingBlockDevice::removeRange()
+
+void TrimBatchingBlockDevice::forgetRange(const bd_addr_t start, const bd_addr_t end)
+{
+  size_t i = 0;
+  while (i < pendingCount)
+  {
+    struct TrimRange &range = pending[i];
+    if ((range.end <= start) || (end <= range.start))
+    {
+      i++;    // No overlap
+    }
+    else if ((start <= range.start) && (range.end <= end))
+    {
+      removeRange(i);   // Completely covered
+    }
+    else if (start <= range.start)
+    {
+      range.start = end;  // Head covered
+      i++;
+    }
+    else if (range.end <= end)
+    {
+      range.end = start;  // Tail covered
+      i++;
+    }
+    else
+    {
+      // Middle covered, so the range splits in two. If there's no room for the second half it is
+      // simply dropped, which is safe because the device is never told about it.
+      const bd_addr_t tailStart = end;
+      const bd_addr_t tailEnd = range.end;
+      range.end = start;
+      if (pendingCount < maxPendingRanges)
+      {
+        pending[pendingCount].start = tailStart;
+        pending[pendingCount].end = tailEnd;
+        pendingCount++;
+      }
+      i++;
+    }
+  }
+}   // End of TrimBatchingBlockDevice::forgetRange()
@@ -0,0 +1,71 @@
+/*
+*********************************************************************************************************
+*                                      Arduino_POSIXStorage Library
+*
+*                            Copyright 2023 Arduino SA. http://arduino.cc
+*
+*                    Block device that collects trim requests from the file system and passes
+*                    them on to the device later, in batches.
+*
+*
+*                             SPDX-License-Identifier: LGPL-2.1-or-later
+*
+*                    This library is free software; you can redistribute it and/or
+*                    modify it under the terms of the GNU Lesser General Public
+*                    License as published by the Free Software Foundation; either
+*                    version 2.1 of the License, or (at your option) any later version.
+*
+*                    This library is distributed in the hope that it will be useful,
+*                    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*                    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*                    Lesser General Public License for more details.
+*
+*                    You should have received a copy of the GNU Lesser General
+*                    Public License along with this library; if not, write to the
+*                    Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+*                    Boston, MA  02111-1307  USA
+*
+*********************************************************************************************************
+*/
+
+#ifndef TrimBatchingBlockDevice_H
+#define TrimBatchingBlockDevice_H
+
+#include "ForwardingBlockDevice.h"
+
+// FatFs reports every cluster chain it frees with a trim() call, which on an SD Card is an erase
+// command that is issued in the middle of the write that freed the clusters. This class instead
+// records the freed ranges, merges neighbouring ones, and passes them on when flushTrims() is
+// called, when the table of pending ranges is full, or when the device is deinitialized by
+// unmount(). A range that is programmed or erased again before it has been passed on is dropped,
+// so a delayed trim never destroys new data.
+class TrimBatchingBlockDevice : public ForwardingBlockDevice {
+public:
+  explicit TrimBatchingBlockDevice(BlockDevice *underlyingDevice);
+
+  virtual int deinit();
+  virtual int program(const void *buffer, bd_addr_t addr, bd_size_t size);
+  virtual int erase(bd_addr_t addr, bd_size_t size);
+  virtual int trim(bd_addr_t addr, bd_size_t size);
+
+  // Passes on pending ranges, oldest first, until about byteBudget bytes have been trimmed.
+  // A byteBudget of 0 passes on everything. Returns 0 or a negative error code from the device.
+  int flushTrims(bd_size_t byteBudget);
+  bd_size_t pendingBytes() const;
+
+private:
+  struct TrimRange {
+    bd_addr_t start;
+    bd_addr_t end;    // Exclusive
+  };
+  static constexpr size_t maxPendingRanges = 32;
+
+  void removeRange(size_t index);
+  // Drops the parts of pending ranges that overlap [start, end)
+  void forgetRange(bd_addr_t start, bd_addr_t end);
+
+  struct TrimRange pending[maxPendingRanges];
+  size_t pendingCount;
+};
+
+#endif  // TrimBatchingBlockDevice_H
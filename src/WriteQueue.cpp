@@ -0,0 +1,361 @@
+/*
+*********************************************************************************************************
+*                                      Arduino_POSIXStorage Library
+*
+*                            Copyright 2023 Arduino SA. http://arduino.cc
+*
+*                    Preallocated write queue that decouples the time a write is accepted from
+*                    the time it reaches the device.
+*
+*
+*                             SPDX-License-Identifier: LGPL-2.1-or-later
+*
+*                    This library is free software; you can redistribute it and/or
+*                    modify it under the terms of the GNU Lesser General Public
+*                    License as published by the Free Software Foundation; either
+*                    version 2.1 of the License, or (at your option) any later version.
+*
+*                    This library is distributed in the hope that it will be useful,
+*                    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*                    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*                    Lesser General Public License for more details.
+*
+*                    You should have received a copy of the GNU Lesser General
+*                    Public License along with this library; if not, write to the
+*                    Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+*                    Boston, MA  02111-1307  USA
+*
+*********************************************************************************************************
+*/
+
+/*
+*********************************************************************************************************
+*                                         Included header files
+*********************************************************************************************************
+*/
+
+#include "WriteQueue.h"
+
+#include <Arduino.h>
+#include <unistd.h>
+
+/*
+*********************************************************************************************************
+*                                    Library-internal constants
+*********************************************************************************************************
+*/
+
+namespace {
+
+#if defined(WRITE_QUEUE_HAS_WORKER_THREAD)
+// FatFs and the block device drivers need a few KB of stack on the way down to the device
+constexpr uint32_t workerStackSize = 4096;
+#endif
+
+}   // End of unnamed namespace
+
+/*
+*********************************************************************************************************
+*                                        WriteQueue member functions
+*********************************************************************************************************
+*/
+
+// The ring positions run from 0 to (2 * bufferSize - 1), so that a full ring (head - tail == bufferSize)
+// can be told apart from an empty one (head == tail) without wasting a byte
+
+WriteQueue::WriteQueue(const struct WriteQueueSettings &queueSettings)
+  : settings(queueSettings),
+    buffer(nullptr),
+    head(0),
+    tail(0),
+    stopping(false),
+    queuedWrites(0),
+    completedWrites(0),
+    droppedWrites(0),
+    failedWrites(0),
+    deadlineOverruns(0),
+    maxLatencyMicroseconds(0),
+    highWaterMark(0)
+#if defined(WRITE_QUEUE_HAS_WORKER_THREAD)
+    ,
+    dataAvailable(0, 1),
+    spaceAvailable(0, 1),
+    worker(nullptr)
+#endif
+{
+}   // End of WriteQueue::WriteQueue()
+
+WriteQueue::~WriteQueue()
+{
+#if defined(WRITE_QUEUE_HAS_WORKER_THREAD)
+  if (nullptr != worker)
+  {
+    stopping = true;
+    dataAvailable.release();
+    worker->join();
+    delete worker;
+  }
+#endif
+  delete[] buffer;
+}   // End of WriteQueue::~WriteQueue()
+
+int WriteQueue::start()
+{
+  // A queue that can't hold at least one byte of data is useless, and positions must fit in 32 bits
+  if ((settings.bufferSize <= sizeof(struct RecordHeader)) || (settings.bufferSize > (UINT32_MAX / 2)))
+  {
+    return EINVAL;
+  }
+  if ((QUEUE_DROP != settings.fullPolicy) && (QUEUE_BLOCK != settings.fullPolicy))
+  {
+    return EINVAL;
+  }
+  buffer = new(std::nothrow) uint8_t[settings.bufferSize];
+  if (nullptr == buffer)
+  {
+    return ENOMEM;
+  }
+#if defined(WRITE_QUEUE_HAS_WORKER_THREAD)
+  worker = new(std::nothrow) rtos::Thread(osPriorityNormal, workerStackSize, nullptr, "WriteQueue");
+  if (nullptr == worker)
+  {
+    return ENOMEM;
+  }
+  if (osOK != worker->start(mbed::callback(this, &WriteQueue::workerMain)))
+  {
+    delete worker;
+    worker = nullptr;
+    return ENOMEM;
+  }
+#endif
+  return 0;
+}   // End of WriteQueue::start()
+
+int WriteQueue::enqueue(const int fileDescriptor, const void * const data, const size_t count)
+{
+  if (0 == count)
+  {
+    return 0;
+  }
+  if (nullptr == data)
+  {
+    return EFAULT;
+  }
+  if (fileDescriptor < 0)
+  {
+    return EBADF;
+  }
+  if (count > (settings.bufferSize - sizeof(struct RecordHeader)))
+  {
+    return EMSGSIZE;    // Could never fit, no matter how long we wait
+  }
+  const uint32_t needed = static_cast<uint32_t>(sizeof(struct RecordHeader) + count);
+  const uint32_t ringSize = static_cast<uint32_t>(settings.bufferSize);
+  const uint32_t startMicroseconds = micros();
+#if defined(WRITE_QUEUE_HAS_WORKER_THREAD)
+  producerMutex.lock();
+#endif
+  while (true)
+  {
+    const uint32_t used = (head.load() + 2 * ringSize - tail.load()) % (2 * ringSize);
+    if ((ringSize - used) >= needed)
+    {
+      break;
+    }
+    if ((QUEUE_DROP == settings.fullPolicy) ||
+        ((micros() - startMicroseconds) >= settings.blockTimeoutMicroseconds))
+    {
+#if defined(WRITE_QUEUE_HAS_WORKER_THREAD)
+      producerMutex.unlock();
+#endif
+      droppedWrites++;
+      return (QUEUE_DROP == settings.fullPolicy) ? EAGAIN : ETIMEDOUT;
+    }
+#if defined(WRITE_QUEUE_HAS_WORKER_THREAD)
+    // Short waits, because a single release can't wake every blocked producer
+    producerMutex.unlock();
+    (void) spaceAvailable.try_acquire_for(std::chrono::milliseconds(1));
+    producerMutex.lock();
+#else
+    // Without a worker thread, the only way to make room is to write the oldest record ourselves. The
+    // timeout is checked between records, so a wait can overrun it by the time one write takes.
+    (void) writeOldest();
+#endif
+  }
+  struct RecordHeader header;
+  header.fileDescriptor = fileDescriptor;
+  header.length = static_cast<uint32_t>(count);
+  header.queuedAtMicroseconds = startMicroseconds;
+  const uint32_t position = head.load();
+  copyIn(position, &header, sizeof(header));
+  copyIn((position + sizeof(header)) % (2 * ringSize), data, count);
+  head.store((position + needed) % (2 * ringSize));
+  const uint32_t used = (head.load() + 2 * ringSize - tail.load()) % (2 * ringSize);
+  if (used > highWaterMark.load())
+  {
+    highWaterMark = used;
+  }
+  queuedWrites++;
+#if defined(WRITE_QUEUE_HAS_WORKER_THREAD)
+  producerMutex.unlock();
+  dataAvailable.release();
+#endif
+  return 0;
+}   // End of WriteQueue::enqueue()
+
+int WriteQueue::service(const uint32_t budgetMicroseconds)
+{
+  const uint32_t startMicroseconds = micros();
+#if defined(WRITE_QUEUE_HAS_WORKER_THREAD)
+  // The worker thread does the writing, so just wait for it
+  while ((head.load() != tail.load()) &&
+         ((0 == budgetMicroseconds) || ((micros() - startMicroseconds) < budgetMicroseconds)))
+  {
+    rtos::ThisThread::sleep_for(std::chrono::milliseconds(1));
+  }
+#else
+  drainUntil(startMicroseconds, budgetMicroseconds);
+#endif
+  return (head.load() == tail.load()) ? 0 : EINPROGRESS;
+}   // End of WriteQueue::service()
+
+int WriteQueue::stop()
+{
+  const uint32_t failedBefore = failedWrites.load();
+#if defined(WRITE_QUEUE_HAS_WORKER_THREAD)
+  if (nullptr != worker)
+  {
+    stopping = true;
+    dataAvailable.release();
+    worker->join();     // The worker writes everything that is queued before it exits
+    delete worker;
+    worker = nullptr;
+  }
+#endif
+  drainUntil(micros(), 0);
+  // Nobody else will see these, the queue goes away after this
+  return (failedWrites.load() != failedBefore) ? EIO : 0;
+}   // End of WriteQueue::stop()
+
+void WriteQueue::lock()
+{
+#if defined(WRITE_QUEUE_HAS_WORKER_THREAD)
+  consumerMutex.lock();
+#endif
+}   // End of WriteQueue::lock()
+
+void WriteQueue::unlock()
+{
+#if defined(WRITE_QUEUE_HAS_WORKER_THREAD)
+  consumerMutex.unlock();
+#endif
+}   // End of WriteQueue::unlock()
+
+void WriteQueue::getStatistics(struct WriteQueueStatistics * const statistics) const
+{
+  const uint32_t ringSize = static_cast<uint32_t>(settings.bufferSize);
+  statistics->queuedWrites           = queuedWrites.load();
+  statistics->completedWrites        = completedWrites.load();
+  statistics->droppedWrites          = droppedWrites.load();
+  statistics->failedWrites           = failedWrites.load();
+  statistics->deadlineOverruns       = deadlineOverruns.load();
+  statistics->maxLatencyMicroseconds = maxLatencyMicroseconds.load();
+  statistics->queuedBytes            = (head.load() + 2 * ringSize - tail.load()) % (2 * ringSize);
+  statistics->highWaterMark          = highWaterMark.load();
+}   // End of WriteQueue::getStatistics()
+
+void WriteQueue::copyIn(const uint32_t position, const void * const source, const size_t length)
+{
+  const size_t offset = position % settings.bufferSize;
+  const size_t first = ((settings.bufferSize - offset) < length) ? (settings.bufferSize - offset) : length;
+  memcpy(buffer + offset, source, first);
+  memcpy(buffer, static_cast<const uint8_t*>(source) + first, length - first);
+}   // End of WriteQueue::copyIn()
+
+void WriteQueue::copyOut(const uint32_t position, void * const destination, const size_t length) const
+{
+  const size_t offset = position % settings.bufferSize;
+  const size_t first = ((settings.bufferSize - offset) < length) ? (settings.bufferSize - offset) : length;
+  memcpy(destination, buffer + offset, first);
+  memcpy(static_cast<uint8_t*>(destination) + first, buffer, length - first);
+}   // End of WriteQueue::copyOut()
+
+bool WriteQueue::writeOldest()
+{
+  const uint32_t ringSize = static_cast<uint32_t>(settings.bufferSize);
+  const uint32_t position = tail.load();
+  if (head.load() == position)
+  {
+    return false;
+  }
+  struct RecordHeader header;
+  copyOut(position, &header, sizeof(header));
+  // Write straight from the ring, in at most two pieces if the data wraps around
+  uint32_t dataPosition = (position + sizeof(header)) % (2 * ringSize);
+  size_t remaining = header.length;
+  bool failed = false;
+  while (remaining > 0)
+  {
+    const size_t offset = dataPosition % ringSize;
+    const size_t contiguous = ((ringSize - offset) < remaining) ? (ringSize - offset) : remaining;
+    const ssize_t written = write(header.fileDescriptor, buffer + offset, contiguous);
+    if (written <= 0)
+    {
+      failed = true;
+      break;
+    }
+    dataPosition = (dataPosition + static_cast<uint32_t>(written)) % (2 * ringSize);
+    remaining -= static_cast<size_t>(written);
+  }
+  tail.store((position + sizeof(header) + header.length) % (2 * ringSize));
+#if defined(WRITE_QUEUE_HAS_WORKER_THREAD)
+  spaceAvailable.release();
+#endif
+  if (true == failed)
+  {
+    failedWrites++;
+  }
+  else
+  {
+    completedWrites++;
+  }
+  const uint32_t latency = micros() - header.queuedAtMicroseconds;
+  if ((0 != settings.deadlineMicroseconds) && (latency > settings.deadlineMicroseconds))
+  {
+    deadlineOverruns++;
+  }
+  if (latency > maxLatencyMicroseconds.load())
+  {
+    maxLatencyMicroseconds = latency;
+  }
+  return true;
+}   // End of WriteQueue::writeOldest()
+
+// A budgetMicroseconds of 0 means until the queue is empty
+void WriteQueue::drainUntil(const uint32_t startMicroseconds, const uint32_t budgetMicroseconds)
+{
+  lock();
+  while ((0 == budgetMicroseconds) || ((micros() - startMicroseconds) < budgetMicroseconds))
+  {
+    if (false == writeOldest())
+    {
+      break;
+    }
+  }
+  unlock();
+}   // End of WriteQueue::drainUntil()
+
+#if defined(WRITE_QUEUE_HAS_WORKER_THREAD)
+void WriteQueue::workerMain()
+{
+  while (true)
+  {
+    dataAvailable.acquire();
+    drainUntil(micros(), 0);
+    if (true == stopping)
+    {
+      return;
+    }
+  }
+}   // End of WriteQueue::workerMain()
+#endif
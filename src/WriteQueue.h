@@ -0,0 +1,112 @@
+/*
+*********************************************************************************************************
+*                                      Arduino_POSIXStorage Library
+*
+*                            Copyright 2023 Arduino SA. http://arduino.cc
+*
+*                    Preallocated write queue that decouples the time a write is accepted from
+*                    the time it reaches the device.
+*
+*
+*                             SPDX-License-Identifier: LGPL-2.1-or-later
+*
+*                    This library is free software; you can redistribute it and/or
+*                    modify it under the terms of the GNU Lesser General Public
+*                    License as published by the Free Software Foundation; either
+*                    version 2.1 of the License, or (at your option) any later version.
+*
+*                    This library is distributed in the hope that it will be useful,
+*                    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*                    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*                    Lesser General Public License for more details.
+*
+*                    You should have received a copy of the GNU Lesser General
+*                    Public License along with this library; if not, write to the
+*                    Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+*                    Boston, MA  02111-1307  USA
+*
+*********************************************************************************************************
+*/
+
+#ifndef WriteQueue_H
+#define WriteQueue_H
+
+#include "Arduino_POSIXStorage.h"
+
+#include <atomic>
+
+// The mbed based boards run an RTOS, so the queue is drained by a thread of its own. The Portenta
+// C33 doesn't, so there the queue is drained by write_queue_service() calls from the sketch.
+//
+// The worker thread only ever calls write() on the queued file descriptors, while the sketch keeps
+// using the same device. That is safe because mbed's FATFileSystem and LittleFileSystem lock every
+// call, which serializes everything below them (the block device wrappers), and the wrappers above
+// them that keep state across files (DirectoryCacheFileSystem, and TracingFileSystem through
+// TraceRecorder) have mutexes of their own. Everything else in the library, such as mount(), umount(),
+// and the set_*() functions, is still only meant to be called from one thread.
+#if defined(ARDUINO_PORTENTA_H7_M7) || defined(ARDUINO_OPTA)
+  #define WRITE_QUEUE_HAS_WORKER_THREAD
+#endif
+
+// Writes are copied into a ring buffer that is allocated once by start(), as a 12 byte record header
+// followed by the data. Accepting a write is a bounded copy under a mutex and never touches the
+// file system, so its cost doesn't depend on FAT allocation, directory updates, or the card.
+class WriteQueue {
+public:
+  explicit WriteQueue(const struct WriteQueueSettings &settings);
+  ~WriteQueue();
+
+  // WARNING: These return 0 for success or an errno code, they don't set errno!
+  int start();
+  int enqueue(int fileDescriptor, const void *buffer, size_t count);
+  int service(uint32_t budgetMicroseconds);
+  // Writes everything that is still queued and stops the worker thread. Returns EIO if any of those
+  // writes failed, but stops in any case.
+  int stop();
+  // Keeps the queue from writing to the device, for example while the device is being trimmed
+  void lock();
+  void unlock();
+
+  void getStatistics(struct WriteQueueStatistics *statistics) const;
+
+private:
+  struct RecordHeader {
+    int32_t fileDescriptor;
+    uint32_t length;
+    uint32_t queuedAtMicroseconds;
+  };
+
+  void copyIn(uint32_t position, const void *source, size_t length);
+  void copyOut(uint32_t position, void *destination, size_t length) const;
+  // Writes the oldest record to its file, returns false if the queue is empty
+  bool writeOldest();
+  void drainUntil(uint32_t startMicroseconds, uint32_t budgetMicroseconds);
+#if defined(WRITE_QUEUE_HAS_WORKER_THREAD)
+  void workerMain();
+#endif
+
+  const struct WriteQueueSettings settings;
+  uint8_t *buffer;
+  // Run from 0 to (2 * settings.bufferSize - 1), the buffer offsets are these modulo settings.bufferSize
+  std::atomic<uint32_t> head;   // Advanced by producers
+  std::atomic<uint32_t> tail;   // Advanced by the consumer
+  std::atomic<bool> stopping;
+
+  std::atomic<uint32_t> queuedWrites;
+  std::atomic<uint32_t> completedWrites;
+  std::atomic<uint32_t> droppedWrites;
+  std::atomic<uint32_t> failedWrites;
+  std::atomic<uint32_t> deadlineOverruns;
+  std::atomic<uint32_t> maxLatencyMicroseconds;
+  std::atomic<uint32_t> highWaterMark;
+
+#if defined(WRITE_QUEUE_HAS_WORKER_THREAD)
+  rtos::Mutex producerMutex;
+  rtos::Mutex consumerMutex;
+  rtos::Semaphore dataAvailable;
+  rtos::Semaphore spaceAvailable;
+  rtos::Thread *worker;
+#endif
+};
+
+#endif  // WriteQueue_H